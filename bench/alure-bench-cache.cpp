@@ -0,0 +1,145 @@
+/*
+ * A micro-benchmark for the buffer cache index, comparing the hash index used
+ * by the context against a name-hash sorted vector (the previous approach).
+ * Measures inserting, looking up, and removing 1k, 10k, and 100k names.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+
+#include "hashindex.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Named {
+    alure::String mName;
+    size_t mNameHash;
+
+    Named(alure::String name, size_t hash) : mName(std::move(name)), mNameHash(hash) { }
+};
+
+struct NamedNameOf {
+    alure::StringView operator()(const alure::UniquePtr<Named> &obj) const
+    { return obj->mName; }
+};
+
+class SortedVectorIndex {
+    alure::Vector<alure::UniquePtr<Named>> mList;
+
+public:
+    alure::Vector<alure::UniquePtr<Named>>::iterator lookup(alure::StringView name, size_t hash)
+    {
+        auto iter = std::lower_bound(mList.begin(), mList.end(), hash,
+            [](const alure::UniquePtr<Named> &lhs, size_t rhs) -> bool
+            { return lhs->mNameHash < rhs; }
+        );
+        while(iter != mList.end() && (*iter)->mNameHash == hash &&
+              alure::StringView((*iter)->mName) != name)
+            ++iter;
+        return iter;
+    }
+
+    void insert(alure::StringView name, size_t hash)
+    {
+        auto iter = lookup(name, hash);
+        mList.insert(iter, alure::MakeUnique<Named>(alure::String(name), hash));
+    }
+
+    Named *find(alure::StringView name, size_t hash)
+    {
+        auto iter = lookup(name, hash);
+        if(iter != mList.end() && (*iter)->mNameHash == hash) return iter->get();
+        return nullptr;
+    }
+
+    void erase(alure::StringView name, size_t hash)
+    {
+        auto iter = lookup(name, hash);
+        if(iter != mList.end() && (*iter)->mNameHash == hash) mList.erase(iter);
+    }
+};
+
+class HashIndex {
+    alure::NameHashIndex<alure::UniquePtr<Named>,NamedNameOf> mIndex;
+
+public:
+    void insert(alure::StringView name, size_t hash)
+    { mIndex.insert(hash, alure::MakeUnique<Named>(alure::String(name), hash)); }
+
+    Named *find(alure::StringView name, size_t hash)
+    {
+        alure::UniquePtr<Named> *obj = mIndex.find(name, hash);
+        return obj ? obj->get() : nullptr;
+    }
+
+    void erase(alure::StringView name, size_t hash)
+    { mIndex.erase(name, hash); }
+};
+
+double ElapsedNs(clock_type::time_point start, size_t count)
+{
+    std::chrono::duration<double,std::nano> dur = clock_type::now() - start;
+    return dur.count() / static_cast<double>(count);
+}
+
+template<typename T>
+void RunBench(const char *label, const alure::Vector<alure::String> &names,
+              const alure::Vector<size_t> &hashes)
+{
+    T index;
+    size_t found = 0;
+
+    auto start = clock_type::now();
+    for(size_t i = 0;i < names.size();++i)
+        index.insert(names[i], hashes[i]);
+    double insert_ns = ElapsedNs(start, names.size());
+
+    start = clock_type::now();
+    for(size_t i = 0;i < names.size();++i)
+    {
+        // Look up names in a different order than they were inserted.
+        size_t idx = (i*7919) % names.size();
+        found += index.find(names[idx], hashes[idx]) != nullptr;
+    }
+    double find_ns = ElapsedNs(start, names.size());
+
+    start = clock_type::now();
+    for(size_t i = 0;i < names.size();++i)
+        index.erase(names[i], hashes[i]);
+    double erase_ns = ElapsedNs(start, names.size());
+
+    std::cout<< std::setw(8)<<names.size()<<"  "<<std::setw(14)<<label
+             << std::fixed<<std::setprecision(1)
+             << std::setw(14)<<insert_ns<<std::setw(14)<<find_ns<<std::setw(14)<<erase_ns
+             << (found == names.size() ? "" : "  (lookup failures!)") <<std::endl;
+}
+
+} // namespace
+
+int main()
+{
+    auto hasher = std::hash<alure::StringView>();
+
+    std::cout<< "   count           index   insert ns/op   lookup ns/op   remove ns/op" <<std::endl;
+    for(size_t count : {1000u, 10000u, 100000u})
+    {
+        alure::Vector<alure::String> names;
+        alure::Vector<size_t> hashes;
+        names.reserve(count);
+        hashes.reserve(count);
+        for(size_t i = 0;i < count;++i)
+        {
+            names.emplace_back("sounds/sfx/effect_"+std::to_string(i)+".ogg");
+            hashes.push_back(hasher(names.back()));
+        }
+
+        RunBench<SortedVectorIndex>("sorted vector", names, hashes);
+        RunBench<HashIndex>("hash index", names, hashes);
+    }
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * A micro-benchmark for the sample conversions used by the decoders, checking
+ * that they give the same results as the previous approaches. Measures frames
+ * per second for:
+ *
+ *  - the planar to interleaved conversions used by the FLAC decoder,
+ *    converting 8, 16, and 24-bit samples to UInt8, Int16, and Float32 for 1
+ *    to 8 channels, against per-channel strided loops,
+ *  - the Vorbis to OpenAL channel reordering used by the Vorbis and Opus
+ *    decoders, for each channel configuration, against per-frame swaps.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+
+#include "sampleconv.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr ALuint BlockLen = 4608;
+constexpr ALuint MinFrames = 50*1000*1000;
+
+void StridedUInt8(ALubyte *dst, const ALint *const src[], ALuint channels, ALuint count,
+                  int shift)
+{
+    for(ALuint c = 0;c < channels;c++)
+    {
+        for(ALuint i = 0;i < count;i++)
+            dst[i*channels + c] = ALubyte((src[c][i]<<shift) + 0x80);
+    }
+}
+
+void StridedInt16(ALshort *dst, const ALint *const src[], ALuint channels, ALuint count,
+                  int shift)
+{
+    if(shift >= 0)
+    {
+        for(ALuint c = 0;c < channels;c++)
+        {
+            for(ALuint i = 0;i < count;i++)
+                dst[i*channels + c] = src[c][i] << shift;
+        }
+    }
+    else
+    {
+        shift = -shift;
+        for(ALuint c = 0;c < channels;c++)
+        {
+            for(ALuint i = 0;i < count;i++)
+                dst[i*channels + c] = src[c][i] >> shift;
+        }
+    }
+}
+
+void StridedFloat32(ALfloat *dst, const ALint *const src[], ALuint channels, ALuint count,
+                    ALfloat scale)
+{
+    for(ALuint c = 0;c < channels;c++)
+    {
+        for(ALuint i = 0;i < count;i++)
+            dst[i*channels + c] = (ALfloat)src[c][i] * scale;
+    }
+}
+
+// OpenAL : FL, FR, FC, LFE, RL, RR
+// Vorbis : FL, FC, FR,  RL, RR, LFE
+// OpenAL : FL, FR, FC, LFE, RC, SL, SR
+// Vorbis : FL, FC, FR,  SL, SR, RC, LFE
+// OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
+// Vorbis : FL, FC, FR,  SL, SR, RL, RR, LFE
+template<typename T>
+void SwapReorder(T *samples, ALuint frames, alure::ChannelConfig chans)
+{
+    if(chans == alure::ChannelConfig::X51)
+    {
+        for(ALuint i = 0;i < frames;++i)
+        {
+            std::swap(samples[i*6 + 1], samples[i*6 + 2]);
+            std::swap(samples[i*6 + 3], samples[i*6 + 5]);
+            std::swap(samples[i*6 + 4], samples[i*6 + 5]);
+        }
+    }
+    else if(chans == alure::ChannelConfig::X61)
+    {
+        for(ALuint i = 0;i < frames;++i)
+        {
+            std::swap(samples[i*7 + 1], samples[i*7 + 2]);
+            std::swap(samples[i*7 + 3], samples[i*7 + 6]);
+            std::swap(samples[i*7 + 4], samples[i*7 + 5]);
+            std::swap(samples[i*7 + 5], samples[i*7 + 6]);
+        }
+    }
+    else if(chans == alure::ChannelConfig::X71)
+    {
+        for(ALuint i = 0;i < frames;++i)
+        {
+            std::swap(samples[i*8 + 1], samples[i*8 + 2]);
+            std::swap(samples[i*8 + 3], samples[i*8 + 7]);
+            std::swap(samples[i*8 + 4], samples[i*8 + 5]);
+            std::swap(samples[i*8 + 5], samples[i*8 + 6]);
+            std::swap(samples[i*8 + 6], samples[i*8 + 7]);
+        }
+    }
+}
+
+template<typename F>
+double FramesPerSec(F func)
+{
+    ALuint frames = 0;
+    auto start = clock_type::now();
+    while(frames < MinFrames)
+    {
+        func();
+        frames += BlockLen;
+    }
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    return frames / elapsed.count();
+}
+
+struct Result {
+    double mStrided;
+    double mKernel;
+    bool mMatch;
+};
+
+template<typename T, typename S, typename K>
+Result Compare(ALuint channels, S strided, K kernel)
+{
+    alure::Vector<T> out0(BlockLen*channels), out1(BlockLen*channels);
+    Result res;
+    res.mStrided = FramesPerSec([&]{ strided(out0.data()); });
+    res.mKernel = FramesPerSec([&]{ kernel(out1.data()); });
+    res.mMatch = (out0 == out1);
+    return res;
+}
+
+// Reorders the same input with both, checking the results match.
+template<typename T>
+Result CompareReorder(alure::ChannelConfig chans, std::mt19937 &rng, bool timed)
+{
+    const ALuint channels = alure::FramesToBytes(1, chans, alure::SampleType::UInt8);
+    std::uniform_int_distribution<int> dist(-32768, 32767);
+    alure::Vector<T> input(BlockLen*channels);
+    for(T &sample : input)
+        sample = static_cast<T>(dist(rng));
+
+    alure::Vector<T> out0 = input, out1 = input;
+    SwapReorder(out0.data(), BlockLen, chans);
+    alure::ReorderVorbisChannels(out1.data(), BlockLen, chans);
+
+    // The frame data is repeatedly reordered in place for timing.
+    alure::Vector<T> work = input;
+    Result res{0.0, 0.0, out0 == out1};
+    if(timed)
+    {
+        res.mStrided = FramesPerSec([&]{ SwapReorder(work.data(), BlockLen, chans); });
+        res.mKernel = FramesPerSec([&]{ alure::ReorderVorbisChannels(work.data(), BlockLen, chans); });
+    }
+
+    // Check the channels went where the map says.
+    const ALubyte *map = alure::GetVorbisChannelMap(chans);
+    for(ALuint i = 0;i < BlockLen && res.mMatch;++i)
+    {
+        for(ALuint c = 0;c < channels;++c)
+            res.mMatch &= (out1[i*channels + c] == input[i*channels + map[c]]);
+    }
+    return res;
+}
+
+void Print(const char *name, ALuint channels, const Result &res)
+{
+    std::cout<< std::setw(8)<<name << std::setw(10)<<channels
+             << std::setw(14)<<std::fixed<<std::setprecision(1)<<(res.mStrided/1e6)
+             << std::setw(14)<<(res.mKernel/1e6)
+             << std::setw(10)<<std::setprecision(2)<<(res.mKernel/res.mStrided)<<"x"
+             << (res.mMatch ? "" : "  MISMATCH") <<std::endl;
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 rng(12345);
+
+    std::cout<< "Planar to interleaved conversion, million frames/sec:" <<std::endl;
+    std::cout<< std::setw(8)<<"type" << std::setw(10)<<"channels" << std::setw(14)<<"strided"
+             << std::setw(14)<<"kernel" << std::setw(11)<<"speedup" <<std::endl;
+
+    bool all_match = true;
+    for(ALuint channels = 1;channels <= 8;++channels)
+    {
+        // Sample data for each of the input bit depths used below.
+        alure::Vector<alure::Vector<ALint>> planes8(channels), planes16(channels),
+                                            planes24(channels);
+        alure::Vector<const ALint*> src8, src16, src24;
+        for(ALuint c = 0;c < channels;++c)
+        {
+            std::uniform_int_distribution<ALint> dist8(-128, 127);
+            std::uniform_int_distribution<ALint> dist16(-32768, 32767);
+            std::uniform_int_distribution<ALint> dist24(-8388608, 8388607);
+            for(ALuint i = 0;i < BlockLen;++i)
+            {
+                planes8[c].push_back(dist8(rng));
+                planes16[c].push_back(dist16(rng));
+                planes24[c].push_back(dist24(rng));
+            }
+            src8.push_back(planes8[c].data());
+            src16.push_back(planes16[c].data());
+            src24.push_back(planes24[c].data());
+        }
+
+        Result res = Compare<ALubyte>(channels,
+            [&](ALubyte *dst) { StridedUInt8(dst, src8.data(), channels, BlockLen, 0); },
+            [&](ALubyte *dst) { alure::InterleaveUInt8(dst, src8.data(), channels, 0, BlockLen, 0); }
+        );
+        Print("u8", channels, res);
+        all_match &= res.mMatch;
+
+        res = Compare<ALshort>(channels,
+            [&](ALshort *dst) { StridedInt16(dst, src16.data(), channels, BlockLen, 0); },
+            [&](ALshort *dst) { alure::InterleaveInt16(dst, src16.data(), channels, 0, BlockLen, 0); }
+        );
+        Print("s16", channels, res);
+        all_match &= res.mMatch;
+
+        res = Compare<ALshort>(channels,
+            [&](ALshort *dst) { StridedInt16(dst, src24.data(), channels, BlockLen, -8); },
+            [&](ALshort *dst) { alure::InterleaveInt16(dst, src24.data(), channels, 0, BlockLen, -8); }
+        );
+        Print("s24>s16", channels, res);
+        all_match &= res.mMatch;
+
+        const ALfloat scale = 1.0f / 8388608.0f;
+        res = Compare<ALfloat>(channels,
+            [&](ALfloat *dst) { StridedFloat32(dst, src24.data(), channels, BlockLen, scale); },
+            [&](ALfloat *dst) { alure::InterleaveFloat32(dst, src24.data(), channels, 0, BlockLen, scale); }
+        );
+        Print("s24>f32", channels, res);
+        all_match &= res.mMatch;
+    }
+
+    std::cout<< "\nVorbis to OpenAL channel reordering, million frames/sec:" <<std::endl;
+    std::cout<< std::setw(8)<<"type" << std::setw(10)<<"channels" << std::setw(14)<<"swaps"
+             << std::setw(14)<<"kernel" << std::setw(11)<<"speedup" <<std::endl;
+    for(alure::ChannelConfig chans : {alure::ChannelConfig::Mono, alure::ChannelConfig::Stereo,
+        alure::ChannelConfig::Quad, alure::ChannelConfig::X51, alure::ChannelConfig::X61,
+        alure::ChannelConfig::X71})
+    {
+        const ALuint channels = alure::FramesToBytes(1, chans, alure::SampleType::UInt8);
+
+        // Configurations in the same order are only checked.
+        if(channels <= 4)
+        {
+            bool match = CompareReorder<ALshort>(chans, rng, false).mMatch &&
+                         CompareReorder<ALfloat>(chans, rng, false).mMatch;
+            std::cout<< std::setw(18)<<channels << (match ? "  unchanged" : "  MISMATCH")
+                     <<std::endl;
+            all_match &= match;
+            continue;
+        }
+
+        Result res = CompareReorder<ALshort>(chans, rng, true);
+        Print("s16", channels, res);
+        all_match &= res.mMatch;
+
+        res = CompareReorder<ALfloat>(chans, rng, true);
+        Print("f32", channels, res);
+        all_match &= res.mMatch;
+    }
+
+    return all_match ? 0 : 1;
+}
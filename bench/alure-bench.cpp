@@ -0,0 +1,790 @@
+/*
+ * A benchmark suite for the library's main paths, writing its results as JSON
+ * (to stdout, or to the file given with -o). It measures:
+ *
+ *  - the decode rate of each decoder's read(), for a generated WAVE file and
+ *    any files given on the command line,
+ *  - getBuffer latency for uncached (cold) and cached (warm) buffers,
+ *  - precacheBuffersAsync throughput with one and with all decode threads,
+ *    and how much of its staging memory was reused,
+ *  - the longest Context::update and upload step while loading buffers
+ *    asynchronously, with and without an upload budget,
+ *  - the CPU cost of refilling a streaming source, measured against the same
+ *    number of static sources,
+ *  - the cost of Context::update with 64, 256, and 1024 playing sources,
+ *  - the cost of moving 2000 playing sources each update, one source at a
+ *    time and in bulk through the context,
+ *  - the cost of Context::update with 1000 sources fading at once, for each
+ *    fade curve, against the same sources not fading.
+ *
+ * Generated sounds are served from memory by a FileIOFactory, so no files are
+ * needed. Unless a device is given with -device, OpenAL Soft's null backend is
+ * requested (by setting ALSOFT_DRIVERS=null, if not already set) so it runs
+ * without an audio device.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <ctime>
+
+#include "alure2.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr ALuint BenchFrequency = 44100;
+
+double ElapsedSec(clock_type::time_point start)
+{ return std::chrono::duration<double>(clock_type::now() - start).count(); }
+
+double CpuSec()
+{ return static_cast<double>(std::clock()) / CLOCKS_PER_SEC; }
+
+
+// Generates a 16-bit stereo WAVE file holding a sine tone.
+alure::Vector<char> MakeWave(ALuint frames)
+{
+    auto put = [](alure::Vector<char> &out, uint32_t val, size_t size) -> void
+    {
+        for(size_t i = 0;i < size;++i)
+            out.push_back(static_cast<char>((val>>(i*8)) & 0xff));
+    };
+
+    const uint32_t data_size = frames * 4;
+    alure::Vector<char> wave;
+    wave.reserve(44 + data_size);
+    wave.insert(wave.end(), {'R','I','F','F'});
+    put(wave, 36 + data_size, 4);
+    wave.insert(wave.end(), {'W','A','V','E','f','m','t',' '});
+    put(wave, 16, 4);
+    put(wave, 1, 2); /* PCM */
+    put(wave, 2, 2);
+    put(wave, BenchFrequency, 4);
+    put(wave, BenchFrequency * 4, 4);
+    put(wave, 4, 2);
+    put(wave, 16, 2);
+    wave.insert(wave.end(), {'d','a','t','a'});
+    put(wave, data_size, 4);
+    for(ALuint i = 0;i < frames;++i)
+    {
+        auto val = static_cast<int16_t>(std::sin(i * 0.0627) * 16000.0);
+        put(wave, static_cast<uint16_t>(val), 2);
+        put(wave, static_cast<uint16_t>(val), 2);
+    }
+    return wave;
+}
+
+// Serves generated WAVE files for names starting with "bench:", and passes
+// other names on to the previous factory. "bench:tone.wav" and names starting
+// with "bench:long-" are 10 seconds long, all others are 1 second.
+class BenchFileIOFactory final : public alure::FileIOFactory {
+    alure::FileIOFactory &mFallback;
+    alure::SharedPtr<alure::Vector<char>> mLongWave;
+    alure::SharedPtr<alure::Vector<char>> mShortWave;
+
+public:
+    BenchFileIOFactory(alure::FileIOFactory &fallback)
+      : mFallback(fallback)
+      , mLongWave(alure::MakeShared<alure::Vector<char>>(MakeWave(BenchFrequency*10)))
+      , mShortWave(alure::MakeShared<alure::Vector<char>>(MakeWave(BenchFrequency)))
+    { }
+
+    alure::UniquePtr<std::istream> openFile(const alure::String &name) noexcept override
+    {
+        if(name.compare(0, 6, "bench:") != 0)
+            return mFallback.openFile(name);
+        const alure::SharedPtr<alure::Vector<char>> &wave =
+            (name == "bench:tone.wav" || name.compare(0, 11, "bench:long-") == 0) ?
+            mLongWave : mShortWave;
+        try {
+            return alure::CreateMemoryStream(*wave, wave);
+        }
+        catch(...) {
+            return nullptr;
+        }
+    }
+};
+
+// An endless 16-bit mono tone, counting how many times it's read from.
+class ToneDecoder final : public alure::Decoder {
+    std::atomic<uint64_t> &mReads;
+    uint64_t mPos{0};
+
+public:
+    ToneDecoder(std::atomic<uint64_t> &reads) : mReads(reads) { }
+
+    ALuint getFrequency() const noexcept override { return BenchFrequency; }
+    alure::ChannelConfig getChannelConfig() const noexcept override
+    { return alure::ChannelConfig::Mono; }
+    alure::SampleType getSampleType() const noexcept override
+    { return alure::SampleType::Int16; }
+    uint64_t getLength() const noexcept override { return 0; }
+    bool seek(uint64_t pos) noexcept override { mPos = pos; return true; }
+    std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override { return {0, 0}; }
+
+    ALuint read(ALvoid *ptr, ALuint count) noexcept override
+    {
+        auto samples = static_cast<int16_t*>(ptr);
+        for(ALuint i = 0;i < count;++i)
+            samples[i] = static_cast<int16_t>(std::sin((mPos+i) * 0.0627) * 16000.0);
+        mPos += count;
+        mReads.fetch_add(1, std::memory_order_relaxed);
+        return count;
+    }
+};
+
+
+// Records the longest upload step and the total load time of loaded buffers.
+class LoadTimingHandler final : public alure::MessageHandler {
+public:
+    std::chrono::nanoseconds mLongestStep{0};
+    std::chrono::nanoseconds mTotalTime{0};
+    ALuint mSteps{0};
+    ALuint mLoaded{0};
+
+    void bufferLoaded(alure::StringView, const alure::BufferLoadTiming &timing) noexcept override
+    {
+        mLongestStep = std::max(mLongestStep, timing.mLongestStep);
+        mTotalTime += timing.mTotalTime;
+        mSteps += timing.mUploadSteps;
+        ++mLoaded;
+    }
+};
+
+
+// A minimal JSON writer. Objects and arrays are opened and closed explicitly,
+// and commas are inserted as needed.
+class JsonWriter {
+    std::ostream &mOut;
+    alure::Vector<bool> mFirst;
+
+    void sep()
+    {
+        if(mFirst.empty()) return;
+        if(!mFirst.back()) mOut<< ",";
+        mFirst.back() = false;
+        mOut<< "\n" <<std::string(mFirst.size()*2, ' ');
+    }
+
+    void string(alure::StringView str)
+    {
+        mOut<< '"';
+        for(char ch : str)
+        {
+            if(ch == '"' || ch == '\\')
+                mOut<< '\\' << ch;
+            else if(static_cast<unsigned char>(ch) < 0x20)
+                mOut<< "\\u" <<std::hex<<std::setw(4)<<std::setfill('0')
+                    << static_cast<int>(ch) <<std::dec<<std::setfill(' ');
+            else
+                mOut<< ch;
+        }
+        mOut<< '"';
+    }
+
+    void key(const char *name)
+    {
+        sep();
+        if(name)
+        {
+            string(name);
+            mOut<< ": ";
+        }
+    }
+
+public:
+    JsonWriter(std::ostream &out) : mOut(out) { mOut<<std::setprecision(6); }
+
+    void beginObject(const char *name=nullptr)
+    { key(name); mOut<< "{"; mFirst.push_back(true); }
+    void endObject()
+    { mFirst.pop_back(); mOut<< "\n" <<std::string(mFirst.size()*2, ' ')<< "}"; }
+
+    void beginArray(const char *name=nullptr)
+    { key(name); mOut<< "["; mFirst.push_back(true); }
+    void endArray()
+    { mFirst.pop_back(); mOut<< "\n" <<std::string(mFirst.size()*2, ' ')<< "]"; }
+
+    void value(const char *name, alure::StringView str) { key(name); string(str); }
+    void value(const char *name, const alure::String &str) { value(name, alure::StringView(str)); }
+    void value(const char *name, const char *str) { value(name, alure::StringView(str)); }
+    void value(const char *name, double val)
+    {
+        key(name);
+        if(std::isfinite(val)) mOut<< val;
+        else mOut<< "null";
+    }
+    void value(const char *name, uint64_t val) { key(name); mOut<< val; }
+    void value(const char *name, ALuint val) { key(name); mOut<< val; }
+    void value(const char *name, bool val) { key(name); mOut<< (val ? "true" : "false"); }
+};
+
+
+void BenchDecoders(alure::Context &ctx, JsonWriter &json, const alure::Vector<alure::String> &names)
+{
+    constexpr ALuint ChunkLen = 4096;
+
+    json.beginArray("decoders");
+    for(const alure::String &name : names)
+    {
+        alure::SharedPtr<alure::Decoder> decoder;
+        try {
+            decoder = ctx.createDecoder(name);
+        }
+        catch(std::exception &e) {
+            std::cerr<< "Failed to open "<<name<<": "<<e.what() <<std::endl;
+            continue;
+        }
+        alure::ChannelConfig chans = decoder->getChannelConfig();
+        alure::SampleType type = decoder->getSampleType();
+        alure::Vector<char> data(alure::FramesToBytes(ChunkLen, chans, type));
+
+        // Decode the whole file at least once, and for at least a quarter of a
+        // second, restarting from the beginning as needed.
+        uint64_t frames = 0;
+        double elapsed = 0.0;
+        auto start = clock_type::now();
+        do {
+            ALuint got;
+            uint64_t pass_frames = 0;
+            while((got=decoder->read(data.data(), ChunkLen)) > 0)
+                pass_frames += got;
+            frames += pass_frames;
+            elapsed = ElapsedSec(start);
+            if(pass_frames == 0 || !decoder->seek(0))
+                break;
+        } while(elapsed < 0.25);
+
+        json.beginObject();
+        json.value("name", name);
+        json.value("sample_type", alure::GetSampleTypeName(type));
+        json.value("channels", alure::GetChannelConfigName(chans));
+        json.value("frequency", decoder->getFrequency());
+        json.value("frames", frames);
+        json.value("seconds", elapsed);
+        json.value("frames_per_sec", frames / elapsed);
+        json.endObject();
+    }
+    json.endArray();
+}
+
+void BenchBufferLoad(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Count = 32;
+
+    alure::Vector<alure::String> names;
+    for(ALuint i = 0;i < Count;++i)
+        names.push_back("bench:load-"+std::to_string(i)+".wav");
+
+    auto start = clock_type::now();
+    for(const alure::String &name : names)
+        ctx.getBuffer(name);
+    double cold = ElapsedSec(start);
+
+    start = clock_type::now();
+    for(ALuint pass = 0;pass < 100;++pass)
+    {
+        for(const alure::String &name : names)
+            ctx.getBuffer(name);
+    }
+    double warm = ElapsedSec(start) / 100.0;
+
+    for(const alure::String &name : names)
+        ctx.removeBuffer(name);
+
+    json.beginObject("buffer_load");
+    json.value("buffers", Count);
+    json.value("cold_us", cold / Count * 1e6);
+    json.value("warm_us", warm / Count * 1e6);
+    json.endObject();
+}
+
+void BenchPrecache(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Count = 64;
+    const ALuint buffer_bytes = BenchFrequency * 4;
+
+    ALuint max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    alure::Vector<ALuint> thread_counts{1};
+    if(max_threads > 1) thread_counts.push_back(max_threads);
+
+    json.beginArray("precache");
+    for(ALuint threads : thread_counts)
+    {
+        ctx.setAsyncDecodeThreadCount(threads);
+
+        alure::Vector<alure::String> names;
+        for(ALuint i = 0;i < Count;++i)
+            names.push_back("bench:precache-"+std::to_string(threads)+"-"+std::to_string(i)+".wav");
+        alure::Vector<alure::StringView> views(names.begin(), names.end());
+
+        alure::StagingPoolStats before = ctx.getStagingPoolStats();
+        auto start = clock_type::now();
+        ctx.precacheBuffersAsync(views);
+        for(const alure::String &name : names)
+            ctx.getBufferAsync(name).wait();
+        double elapsed = ElapsedSec(start);
+        alure::StagingPoolStats after = ctx.getStagingPoolStats();
+
+        for(const alure::String &name : names)
+            ctx.removeBuffer(name);
+
+        json.beginObject();
+        json.value("decode_threads", threads);
+        json.value("buffers", Count);
+        json.value("seconds", elapsed);
+        json.value("buffers_per_sec", Count / elapsed);
+        json.value("mb_per_sec", Count * buffer_bytes / elapsed / (1024.0*1024.0));
+        json.value("staging_allocations", after.mAllocations - before.mAllocations);
+        json.value("staging_allocations_avoided",
+                   after.mAllocationsAvoided - before.mAllocationsAvoided);
+        json.value("staging_reserved_bytes", static_cast<uint64_t>(after.mBytesReserved));
+        json.endObject();
+    }
+    json.endArray();
+    ctx.setAsyncDecodeThreadCount(0);
+}
+
+void BenchUploadBudget(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Count = 8;
+
+    alure::SharedPtr<alure::MessageHandler> prev_handler = ctx.getMessageHandler();
+
+    json.beginArray("upload_budget");
+    for(ALuint budget : {0u, 500u})
+    {
+        auto handler = alure::MakeShared<LoadTimingHandler>();
+        ctx.setMessageHandler(handler);
+        ctx.setAsyncUploadBudget(std::chrono::microseconds(budget));
+
+        alure::Vector<alure::String> names;
+        for(ALuint i = 0;i < Count;++i)
+            names.push_back("bench:long-"+std::to_string(budget)+"-"+std::to_string(i)+".wav");
+        alure::Vector<alure::StringView> views(names.begin(), names.end());
+
+        // Keep updating as an application would, until all are loaded.
+        double max_update = 0.0;
+        ALuint updates = 0;
+        auto start = clock_type::now();
+        ctx.precacheBuffersAsync(views);
+        for(const alure::String &name : names)
+        {
+            alure::SharedFuture<alure::Buffer> future = ctx.getBufferAsync(name);
+            while(future.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready)
+            {
+                auto update_start = clock_type::now();
+                ctx.update();
+                max_update = std::max(max_update, ElapsedSec(update_start));
+                ++updates;
+            }
+        }
+        double elapsed = ElapsedSec(start);
+
+        for(const alure::String &name : names)
+            ctx.removeBuffer(name);
+
+        json.beginObject();
+        json.value("budget_us", budget);
+        json.value("buffers", Count);
+        json.value("seconds", elapsed);
+        json.value("updates", updates);
+        json.value("max_update_us", max_update * 1e6);
+        json.value("upload_steps", handler->mSteps);
+        json.value("longest_upload_step_us",
+            std::chrono::duration<double,std::micro>(handler->mLongestStep).count());
+        json.value("mean_load_ms", handler->mLoaded ?
+            std::chrono::duration<double,std::milli>(handler->mTotalTime).count() / handler->mLoaded :
+            0.0);
+        json.endObject();
+    }
+    json.endArray();
+    ctx.setAsyncUploadBudget(std::chrono::microseconds::zero());
+    ctx.setMessageHandler(prev_handler);
+}
+
+void BenchStreaming(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Count = 32;
+    constexpr ALuint ChunkLen = 1024;
+    constexpr ALuint QueueSize = 4;
+    const auto duration = std::chrono::seconds(2);
+
+    alure::Vector<alure::Source> sources;
+    for(ALuint i = 0;i < Count;++i)
+        sources.push_back(ctx.createSource());
+
+    // The baseline plays the same number of static sources, to account for
+    // the device's own mixing.
+    alure::Buffer buffer = ctx.getBuffer("bench:loop.wav");
+    for(alure::Source &source : sources)
+    {
+        source.setLooping(true);
+        source.play(buffer);
+    }
+    double cpu_start = CpuSec();
+    std::this_thread::sleep_for(duration);
+    double static_cpu = CpuSec() - cpu_start;
+    for(alure::Source &source : sources)
+    {
+        source.stop();
+        source.setLooping(false);
+    }
+
+    std::atomic<uint64_t> reads{0};
+    for(alure::Source &source : sources)
+        source.play(alure::MakeShared<ToneDecoder>(reads), ChunkLen, QueueSize);
+    uint64_t start_reads = reads.load();
+    cpu_start = CpuSec();
+    std::this_thread::sleep_for(duration);
+    double stream_cpu = CpuSec() - cpu_start;
+    uint64_t refills = reads.load() - start_reads;
+
+    ALuint underruns = 0;
+    for(alure::Source &source : sources)
+    {
+        underruns += source.getUnderrunCount();
+        source.destroy();
+    }
+    ctx.update();
+    ctx.removeBuffer(buffer);
+
+    json.beginObject("streaming");
+    json.value("sources", Count);
+    json.value("chunk_frames", ChunkLen);
+    json.value("refills", refills);
+    json.value("underruns", underruns);
+    json.value("cpu_seconds", stream_cpu);
+    json.value("baseline_cpu_seconds", static_cpu);
+    json.value("cpu_us_per_refill", refills ?
+        std::max(stream_cpu - static_cpu, 0.0) / refills * 1e6 : 0.0);
+    json.endObject();
+}
+
+void BenchUpdate(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Iterations = 200;
+
+    alure::Buffer buffer = ctx.getBuffer("bench:loop.wav");
+
+    json.beginArray("update");
+    for(ALuint count : {64u, 256u, 1024u})
+    {
+        alure::Vector<alure::Source> sources;
+        try {
+            for(ALuint i = 0;i < count;++i)
+            {
+                sources.push_back(ctx.createSource());
+                sources.back().setLooping(true);
+                sources.back().play(buffer);
+            }
+        }
+        catch(std::exception &e) {
+            std::cerr<< "Failed to play "<<count<<" sources: "<<e.what() <<std::endl;
+        }
+        ctx.update();
+
+        uint64_t queries = 0;
+        auto start = clock_type::now();
+        for(ALuint i = 0;i < Iterations;++i)
+        {
+            ctx.update();
+            queries += ctx.getUpdateStats().mSourceQueries;
+        }
+        double elapsed = ElapsedSec(start);
+
+        ALuint playing = 0;
+        for(alure::Source &source : sources)
+        {
+            if(source.isPlaying()) ++playing;
+            source.destroy();
+        }
+
+        json.beginObject();
+        json.value("sources", count);
+        json.value("playing", playing);
+        json.value("us_per_update", elapsed / Iterations * 1e6);
+        json.value("queries_per_update", static_cast<double>(queries) / Iterations);
+        json.endObject();
+    }
+    json.endArray();
+    ctx.update();
+    ctx.removeBuffer(buffer);
+}
+
+void BenchBulkMove(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Count = 2000;
+    constexpr ALuint Iterations = 100;
+
+    alure::Buffer buffer = ctx.getBuffer("bench:loop.wav");
+    alure::Vector<alure::Source> sources;
+    try {
+        for(ALuint i = 0;i < Count;++i)
+        {
+            sources.push_back(ctx.createSource());
+            sources.back().setLooping(true);
+            sources.back().play(buffer);
+        }
+    }
+    catch(std::exception &e) {
+        std::cerr<< "Failed to play "<<Count<<" sources: "<<e.what() <<std::endl;
+    }
+    ctx.update();
+
+    alure::Vector<alure::Vector3> positions(sources.size());
+    alure::Vector<alure::Vector3> velocities(sources.size());
+    auto move = [&positions,&velocities](ALuint iter) -> void
+    {
+        for(size_t i = 0;i < positions.size();++i)
+        {
+            float angle = static_cast<float>(iter + i) * 0.01f;
+            positions[i] = alure::Vector3(std::cos(angle), 0.0f, std::sin(angle)) * 10.0f;
+            velocities[i] = alure::Vector3(-std::sin(angle), 0.0f, std::cos(angle));
+        }
+    };
+
+    auto start = clock_type::now();
+    for(ALuint iter = 0;iter < Iterations;++iter)
+    {
+        move(iter);
+        for(size_t i = 0;i < sources.size();++i)
+        {
+            sources[i].setPosition(positions[i]);
+            sources[i].setVelocity(velocities[i]);
+        }
+        ctx.update();
+    }
+    double single = ElapsedSec(start);
+
+    start = clock_type::now();
+    for(ALuint iter = 0;iter < Iterations;++iter)
+    {
+        move(iter);
+        ctx.setSourcePositions(sources, positions);
+        ctx.setSourceVelocities(sources, velocities);
+        ctx.update();
+    }
+    double bulk = ElapsedSec(start);
+
+    for(alure::Source &source : sources)
+        source.destroy();
+
+    json.beginObject("bulk_move");
+    json.value("sources", static_cast<ALuint>(sources.size()));
+    json.value("single_us_per_update", single / Iterations * 1e6);
+    json.value("bulk_us_per_update", bulk / Iterations * 1e6);
+    json.endObject();
+    ctx.update();
+    ctx.removeBuffer(buffer);
+}
+
+void BenchFades(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Count = 1000;
+    constexpr ALuint Iterations = 100;
+    // Long enough for the fades to still be going when the updates finish.
+    constexpr std::chrono::milliseconds Duration{60000};
+
+    alure::Buffer buffer = ctx.getBuffer("bench:loop.wav");
+    auto time_updates = [&ctx,buffer,Duration](ALuint fade) -> std::pair<double,ALuint>
+    {
+        alure::Vector<alure::Source> sources;
+        try {
+            for(ALuint i = 0;i < Count;++i)
+            {
+                sources.push_back(ctx.createSource());
+                sources.back().setLooping(true);
+                sources.back().play(buffer);
+            }
+        }
+        catch(std::exception &e) {
+            std::cerr<< "Failed to play "<<Count<<" sources: "<<e.what() <<std::endl;
+        }
+        ctx.update();
+
+        // 0 is no fading, 1 to 3 fade out with each curve, and 4 fades in.
+        for(alure::Source &source : sources)
+        {
+            if(fade == 4)
+                source.fadeIn(0.0f, Duration, alure::FadeCurve::EqualPower);
+            else if(fade > 0)
+                source.fadeOutToStop(0.0f, Duration, static_cast<alure::FadeCurve>(fade-1));
+        }
+
+        auto start = clock_type::now();
+        for(ALuint i = 0;i < Iterations;++i)
+            ctx.update();
+        double elapsed = ElapsedSec(start);
+
+        ALuint count = static_cast<ALuint>(sources.size());
+        for(alure::Source &source : sources)
+            source.destroy();
+        ctx.update();
+        return {elapsed, count};
+    };
+
+    json.beginObject("fades");
+    auto result = time_updates(0);
+    json.value("sources", result.second);
+    json.value("baseline_us_per_update", result.first / Iterations * 1e6);
+    static const char *names[] = {
+        "linear_us_per_update", "equal_power_us_per_update", "exponential_us_per_update",
+        "fade_in_us_per_update"
+    };
+    for(ALuint fade = 1;fade <= 4;++fade)
+        json.value(names[fade-1], time_updates(fade).first / Iterations * 1e6);
+    json.endObject();
+    ctx.removeBuffer(buffer);
+}
+
+void BenchLockContention(alure::Context &ctx, JsonWriter &json)
+{
+    constexpr ALuint Count = 32;
+
+    // Have the background thread load the buffers itself, while this thread
+    // keeps making the context current.
+    ctx.setAsyncDecodeThreadCount(0);
+    alure::Vector<alure::String> names;
+    for(ALuint i = 0;i < Count;++i)
+        names.push_back("bench:long-contention-"+std::to_string(i)+".wav");
+
+    uint64_t contention = alure::Context::GetLockContention();
+    double worst = 0.0, total = 0.0;
+    ALuint calls = 0;
+    alure::Vector<alure::SharedFuture<alure::Buffer>> futures;
+    for(const alure::String &name : names)
+        futures.push_back(ctx.getBufferAsync(name));
+    for(alure::SharedFuture<alure::Buffer> &future : futures)
+    {
+        while(future.wait_for(std::chrono::seconds::zero()) != std::future_status::ready)
+        {
+            auto start = clock_type::now();
+            alure::Context::MakeCurrent(ctx);
+            double elapsed = ElapsedSec(start);
+            worst = std::max(worst, elapsed);
+            total += elapsed;
+            ++calls;
+        }
+    }
+    contention = alure::Context::GetLockContention() - contention;
+
+    for(const alure::String &name : names)
+        ctx.removeBuffer(name);
+
+    json.beginObject("lock_contention");
+    json.value("thread_local_context",
+               ctx.getDevice().queryExtension("ALC_EXT_thread_local_context"));
+    json.value("make_current_calls", calls);
+    json.value("avg_make_current_us", calls ? total / calls * 1e6 : 0.0);
+    json.value("max_make_current_us", worst * 1e6);
+    json.value("lock_waits", contention);
+    json.endObject();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    alure::ArrayView<const char*> args(argv, argc);
+    args = args.slice(1);
+
+    const char *devname = nullptr;
+    const char *outname = nullptr;
+    alure::Vector<alure::String> files{"bench:tone.wav"};
+    while(!args.empty())
+    {
+        if(args[0] == alure::StringView("-device") && args.size() > 1)
+        {
+            devname = args[1];
+            args = args.slice(2);
+        }
+        else if(args[0] == alure::StringView("-o") && args.size() > 1)
+        {
+            outname = args[1];
+            args = args.slice(2);
+        }
+        else if(args[0][0] == '-')
+        {
+            std::cerr<< "Usage: "<<argv[0]<<" [-device \"name\"] [-o out.json] [files...]" <<std::endl;
+            return 1;
+        }
+        else
+        {
+            files.push_back(args[0]);
+            args = args.slice(1);
+        }
+    }
+
+    if(!devname)
+    {
+#ifdef _WIN32
+        if(!getenv("ALSOFT_DRIVERS"))
+            _putenv_s("ALSOFT_DRIVERS", "null");
+#else
+        setenv("ALSOFT_DRIVERS", "null", 0);
+#endif
+    }
+
+    // The previous factory (or the default) opens any files given.
+    alure::UniquePtr<alure::FileIOFactory> prev_io = alure::FileIOFactory::set(
+        alure::MakeUnique<BenchFileIOFactory>(alure::FileIOFactory::get())
+    );
+
+    alure::DeviceManager devMgr = alure::DeviceManager::getInstance();
+    alure::Device dev = devname ? devMgr.openPlayback(devname) : devMgr.openPlayback();
+
+    // Ask for enough sources for the largest update test.
+    alure::AttributePair attrs[] = {
+        {ALC_MONO_SOURCES, 2048},
+        alure::AttributesEnd()
+    };
+    alure::Context ctx = dev.createContext(attrs);
+    alure::Context::MakeCurrent(ctx);
+
+    std::ostringstream out;
+    JsonWriter json(out);
+    json.beginObject();
+    json.value("device", dev.getName(alure::PlaybackName::Full));
+    BenchDecoders(ctx, json, files);
+    BenchBufferLoad(ctx, json);
+    BenchPrecache(ctx, json);
+    BenchUploadBudget(ctx, json);
+    BenchStreaming(ctx, json);
+    BenchUpdate(ctx, json);
+    BenchBulkMove(ctx, json);
+    BenchFades(ctx, json);
+    BenchLockContention(ctx, json);
+    json.endObject();
+    out<< "\n";
+
+    alure::Context::MakeCurrent(nullptr);
+    ctx.destroy();
+    dev.close();
+    alure::FileIOFactory::set(std::move(prev_io));
+
+    if(!outname)
+        std::cout<< out.str();
+    else
+    {
+        std::ofstream outfile(outname);
+        outfile<< out.str();
+        if(!outfile.good())
+        {
+            std::cerr<< "Failed to write "<<outname <<std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
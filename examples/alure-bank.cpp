@@ -0,0 +1,230 @@
+/*
+ * An example tool for creating sound banks, for use with alure::OpenSoundBank.
+ * Sounds are stored by the file names given on the command line. WAVE files
+ * (and all files, with -pcm) are stored as decoded PCM samples, letting them
+ * be loaded straight from the bank's memory. Other files are stored as-is and
+ * decoded when loaded.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
+
+#include "alure2.h"
+
+namespace {
+
+struct BankSound {
+    alure::String mName;
+    uint64_t mNameHash;
+    alure::Vector<char> mData;
+    char mCodec[4];
+
+    ALuint mFrequency;
+    alure::ChannelConfig mChannelConfig;
+    alure::SampleType mSampleType;
+    uint64_t mLength;
+    std::pair<uint64_t,uint64_t> mLoopPts;
+};
+
+// Must match the library's name hash (64-bit FNV-1a).
+uint64_t NameHash(alure::StringView name)
+{
+    uint64_t val = 0xcbf29ce484222325;
+    for(auto ch : name)
+        val = (val^static_cast<unsigned char>(ch)) * 0x100000001b3;
+    return val;
+}
+
+void GetCodecTag(const alure::Vector<char> &data, char (&codec)[4])
+{
+    auto starts_with = [&data](size_t offset, const char *magic, size_t len) -> bool
+    { return data.size() >= offset+len && memcmp(data.data()+offset, magic, len) == 0; };
+
+    const char *tag = "FILE";
+    if(starts_with(0, "RIFF", 4) || starts_with(0, "RIFX", 4))
+        tag = "WAVE";
+    else if(starts_with(0, "OggS", 4) && starts_with(28, "OpusHead", 8))
+        tag = "OGGO";
+    else if(starts_with(0, "OggS", 4) && starts_with(28, "\x01vorbis", 7))
+        tag = "OGGV";
+    else if(starts_with(0, "fLaC", 4))
+        tag = "FLAC";
+    else if(starts_with(0, "ID3", 3) || (data.size() >= 2 &&
+            static_cast<unsigned char>(data[0]) == 0xff &&
+            (static_cast<unsigned char>(data[1])&0xe0) == 0xe0))
+        tag = "MP3 ";
+    memcpy(codec, tag, 4);
+}
+
+bool LoadSound(alure::Context &ctx, const char *fname, bool force_pcm, BankSound &sound)
+{
+    std::ifstream file(fname, std::ios::binary);
+    if(!file.is_open())
+    {
+        std::cerr<< "Failed to open "<<fname <<std::endl;
+        return false;
+    }
+    sound.mData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    sound.mName = fname;
+    sound.mNameHash = NameHash(sound.mName);
+    GetCodecTag(sound.mData, sound.mCodec);
+
+    alure::SharedPtr<alure::Decoder> decoder = ctx.createDecoder(fname);
+    sound.mFrequency = decoder->getFrequency();
+    sound.mChannelConfig = decoder->getChannelConfig();
+    sound.mSampleType = decoder->getSampleType();
+    sound.mLength = decoder->getLength();
+    sound.mLoopPts = decoder->getLoopPoints();
+    if(!force_pcm && memcmp(sound.mCodec, "WAVE", 4) != 0)
+        return true;
+
+    // Store the decoded samples, which are in native byte order.
+    ALuint frame_size = alure::FramesToBytes(1, sound.mChannelConfig, sound.mSampleType);
+    alure::Vector<char> samples;
+    alure::Vector<char> chunk(static_cast<size_t>(frame_size) * 4096);
+    ALuint got;
+    while((got=decoder->read(chunk.data(), 4096)) > 0)
+        samples.insert(samples.end(), chunk.begin(), chunk.begin()+got*frame_size);
+    if(samples.empty())
+    {
+        std::cerr<< "Failed to decode "<<fname <<std::endl;
+        return false;
+    }
+
+    const ALuint sample_size = alure::FramesToBytes(1, alure::ChannelConfig::Mono,
+                                                    sound.mSampleType);
+    const unsigned int test = 1;
+    if(*reinterpret_cast<const unsigned char*>(&test) != 1 && sample_size > 1)
+    {
+        for(size_t i = 0;i < samples.size();i += sample_size)
+            std::reverse(samples.begin()+i, samples.begin()+i+sample_size);
+    }
+
+    sound.mData = std::move(samples);
+    sound.mLength = sound.mData.size() / frame_size;
+    memcpy(sound.mCodec, "PCM ", 4);
+    return true;
+}
+
+void WriteLE(std::ostream &out, uint64_t val, size_t size)
+{
+    for(size_t i = 0;i < size;++i)
+        out.put(static_cast<char>((val>>(i*8)) & 0xff));
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    alure::ArrayView<const char*> args(argv, argc);
+
+    if(args.size() < 4)
+    {
+        std::cerr<< "Usage: "<<args.front()<<" [-pcm] -o out.bank files..." <<std::endl;
+        return 1;
+    }
+    args = args.slice(1);
+
+    bool force_pcm = false;
+    if(args[0] == alure::StringView("-pcm"))
+    {
+        force_pcm = true;
+        args = args.slice(1);
+    }
+    if(args.size() < 3 || args[0] != alure::StringView("-o"))
+    {
+        std::cerr<< "Missing output file" <<std::endl;
+        return 1;
+    }
+    const char *outname = args[1];
+    args = args.slice(2);
+
+    // Decoders need a current context to check the formats it supports.
+    alure::DeviceManager devMgr = alure::DeviceManager::getInstance();
+    alure::Device dev = devMgr.openPlayback();
+    alure::Context ctx = dev.createContext();
+    alure::Context::MakeCurrent(ctx);
+
+    alure::Vector<BankSound> sounds(args.size());
+    for(size_t i = 0;i < args.size();++i)
+    {
+        if(!LoadSound(ctx, args[i], force_pcm, sounds[i]))
+            return 1;
+        std::cout<< "Added "<<args[i]<<" ("<<alure::StringView(sounds[i].mCodec, 4)<<", "
+                 << alure::GetSampleTypeName(sounds[i].mSampleType)<<", "
+                 << alure::GetChannelConfigName(sounds[i].mChannelConfig)<<", "
+                 << sounds[i].mFrequency<<"hz)" <<std::endl;
+    }
+    std::sort(sounds.begin(), sounds.end(),
+        [](const BankSound &lhs, const BankSound &rhs) -> bool
+        { return lhs.mNameHash < rhs.mNameHash; }
+    );
+
+    // The names follow the directory, then the sound data, aligned to 16 bytes.
+    const uint64_t dir_end = 16 + uint64_t{72}*sounds.size();
+    uint64_t names_size = 0;
+    for(const BankSound &sound : sounds)
+        names_size += sound.mName.size();
+    uint64_t data_offset = (dir_end+names_size+15) & ~uint64_t{15};
+
+    std::ofstream out(outname, std::ios::binary);
+    if(!out.is_open())
+    {
+        std::cerr<< "Failed to create "<<outname <<std::endl;
+        return 1;
+    }
+    out.write("ALBK", 4);
+    WriteLE(out, 1, 4);
+    WriteLE(out, sounds.size(), 4);
+    WriteLE(out, 0, 4);
+
+    uint64_t name_offset = dir_end;
+    alure::Vector<uint64_t> data_offsets;
+    for(const BankSound &sound : sounds)
+    {
+        data_offsets.push_back(data_offset);
+
+        WriteLE(out, sound.mNameHash, 8);
+        WriteLE(out, data_offset, 8);
+        WriteLE(out, sound.mData.size(), 8);
+        WriteLE(out, sound.mLength, 8);
+        WriteLE(out, sound.mLoopPts.first, 8);
+        WriteLE(out, sound.mLoopPts.second, 8);
+        WriteLE(out, name_offset, 4);
+        WriteLE(out, sound.mName.size(), 4);
+        WriteLE(out, sound.mFrequency, 4);
+        out.write(sound.mCodec, 4);
+        WriteLE(out, static_cast<uint64_t>(sound.mChannelConfig), 1);
+        WriteLE(out, static_cast<uint64_t>(sound.mSampleType), 1);
+        WriteLE(out, 0, 2);
+        WriteLE(out, 0, 4);
+
+        name_offset += sound.mName.size();
+        data_offset = (data_offset+sound.mData.size()+15) & ~uint64_t{15};
+    }
+    for(const BankSound &sound : sounds)
+        out.write(sound.mName.data(), sound.mName.size());
+    for(size_t i = 0;i < sounds.size();++i)
+    {
+        while(static_cast<uint64_t>(out.tellp()) < data_offsets[i])
+            out.put(0);
+        out.write(sounds[i].mData.data(), sounds[i].mData.size());
+    }
+    if(!out.good())
+    {
+        std::cerr<< "Failed to write "<<outname <<std::endl;
+        return 1;
+    }
+    std::cout<< "Wrote "<<sounds.size()<<" sounds to "<<outname <<std::endl;
+
+    alure::Context::MakeCurrent(nullptr);
+    ctx.destroy();
+    dev.close();
+    return 0;
+}
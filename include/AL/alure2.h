@@ -266,6 +266,43 @@ ALURE_API const char *GetChannelConfigName(ChannelConfig cfg);
 ALURE_API ALuint FramesToBytes(ALuint frames, ChannelConfig chans, SampleType type);
 ALURE_API ALuint BytesToFrames(ALuint bytes, ChannelConfig chans, SampleType type) noexcept;
 
+/** A buffer's properties, as returned by Buffer::getInfo. */
+struct BufferInfo {
+    ALuint mLength; // In sample frames
+    ALuint mSize; // In bytes
+    ALuint mFrequency;
+    ChannelConfig mChannelConfig;
+    SampleType mSampleType;
+    std::pair<ALuint,ALuint> mLoopPoints;
+};
+
+/** Timings for loading a buffer, as given to MessageHandler::bufferLoaded. */
+struct BufferLoadTiming {
+    std::chrono::nanoseconds mDecodeTime; // Decoding the sample data
+    std::chrono::nanoseconds mUploadTime; // Giving the sample data to OpenAL
+    std::chrono::nanoseconds mLongestStep; // The longest single upload step
+    std::chrono::nanoseconds mTotalTime; // From the load request to it being ready
+    ALuint mUploadSteps;
+};
+
+/** Staging memory use, as returned by Context::getStagingPoolStats. */
+struct StagingPoolStats {
+    size_t mBytesReserved; // Held by the pool, in use or kept for reuse
+    size_t mBytesInUse; // Holding samples being loaded or streamed
+    uint64_t mAllocations; // Requests that needed new memory
+    uint64_t mAllocationsAvoided; // Requests that reused kept memory
+};
+
+/**
+ * Checks for stopped sources made by the last Context::update, as returned by
+ * Context::getUpdateStats.
+ */
+struct UpdateStats {
+    ALuint mSourceQueries; // OpenAL source queries made
+    ALuint mSourcesPolled; // Playing sources whose state was checked
+    ALuint mSourcesSkipped; // Playing sources not checked
+};
+
 
 /** Class for storing a major.minor version number. */
 class Version {
@@ -613,6 +650,24 @@ enum class DistanceModel {
     None = AL_NONE,
 };
 
+/** The shape of a source's gain over a fade. */
+enum class FadeCurve {
+    /** The gain changes by the same amount over time. */
+    Linear,
+    /**
+     * The power (squared gain) changes by the same amount over time, so a
+     * source fading out and another fading in over the same time keep the
+     * same total loudness.
+     */
+    EqualPower,
+    /**
+     * The gain changes by the same number of decibels over time. The gain
+     * can't reach 0 with this curve, so the quiet end is at least 0.0001
+     * (-80dB).
+     */
+    Exponential,
+};
+
 class ALURE_API Context {
     MAKE_PIMPL(Context, ContextImpl)
 
@@ -631,6 +686,15 @@ public:
     /** Retrieves the thread-specific context used for OpenAL operations. */
     static Context GetThreadCurrent();
 
+    /**
+     * Retrieves how many times a thread had to wait for another to release
+     * the global lock guarding the current context, since the library was
+     * loaded. It's taken to make a context current, to destroy a context,
+     * and by a context's background threads when the device lacks the
+     * ALC_EXT_thread_local_context extension.
+     */
+    static uint64_t GetLockContention();
+
     /**
      * Destroys the context. The context must not be current when this is
      * called.
@@ -660,18 +724,92 @@ public:
     SharedPtr<MessageHandler> getMessageHandler() const;
 
     /**
-     * Specifies the desired interval that the background thread will be woken
-     * up to process tasks, e.g. keeping streaming sources filled. An interval
-     * of 0 means the background thread will only be woken up manually with
-     * calls to update. The default is 0.
+     * Specifies the longest interval the streaming thread will sleep for. The
+     * streaming thread schedules itself to wake up shortly before the first
+     * streaming source would run out of queued audio (accounting for its
+     * pitch), so this only needs to be set if something else could make the
+     * schedule too late. An interval of 0 means no limit. The default is 0.
      */
     void setAsyncWakeInterval(std::chrono::milliseconds interval);
 
     /**
-     * Retrieves the current interval used for waking up the background thread.
+     * Retrieves the current interval used for waking up the streaming thread.
      */
     std::chrono::milliseconds getAsyncWakeInterval() const;
 
+    /**
+     * Specifies the number of worker threads used to decode asynchronously
+     * loading buffers (see getBufferAsync, precacheBuffersAsync, and
+     * createBufferAsyncFrom). The workers decode multiple buffers in parallel,
+     * while the background thread gives the decoded samples to OpenAL. A count of 0 means the background
+     * thread decodes each buffer itself, one at a time. The default is 0.
+     */
+    void setAsyncDecodeThreadCount(ALuint count);
+
+    /**
+     * Retrieves the number of worker threads used to decode asynchronously
+     * loading buffers.
+     */
+    ALuint getAsyncDecodeThreadCount() const;
+
+    /**
+     * Specifies how much time each call to update may spend giving
+     * asynchronously loaded buffers to OpenAL. With a non-zero budget, those
+     * buffers are decoded into staging blocks, and update gives them to
+     * OpenAL in slices sized to fit the budget (when the AL_SOFT_buffer_sub_data
+     * extension is available, otherwise each buffer is given at once). At
+     * least one slice is given per update, so a load always makes progress.
+     *
+     * Buffers loading this way are only ready after update finishes giving
+     * them to OpenAL, so waiting on their SharedFutures without calling update
+     * will not return. getBuffer, findBuffer, and removeBuffer finish loading
+     * the buffer they're given right away. A budget of 0, the default, means
+     * the background thread gives buffers to OpenAL as soon as they're
+     * decoded.
+     */
+    void setAsyncUploadBudget(std::chrono::microseconds budget);
+
+    /**
+     * Retrieves the time each update may spend giving asynchronously loaded
+     * buffers to OpenAL.
+     */
+    std::chrono::microseconds getAsyncUploadBudget() const;
+
+    /**
+     * Specifies the most memory, in bytes, the context keeps for staging
+     * decoded samples. Buffer loads and streams decode into memory from a
+     * pool the context owns, which is kept for reuse afterward as long as the
+     * pool holds no more than this, in use or not. Memory beyond that is freed
+     * as it's returned, and lowering the limit frees kept memory right away.
+     * The default is 64MiB. A limit of 0 keeps nothing for reuse.
+     */
+    void setStagingPoolLimit(size_t limit);
+
+    /**
+     * Retrieves the most memory, in bytes, the context keeps for staging
+     * decoded samples.
+     */
+    size_t getStagingPoolLimit() const;
+
+    /**
+     * Retrieves how much memory the staging pool holds and uses, and how many
+     * requests for it reused kept memory.
+     */
+    StagingPoolStats getStagingPoolStats() const;
+
+    /**
+     * Retrieves how many OpenAL queries the last call to update made to find
+     * sources playing buffers that stopped. Sources are only checked once
+     * they could have reached the end, going by their offset, length, and
+     * pitch, so looping sources and ones with plenty left to play are
+     * skipped. Sources whose pitch may be raised by the Doppler effect are
+     * checked every update.
+     *
+     * When the device supports AL_SOFT_events, OpenAL reports sources that
+     * stop as they do, and only those are checked.
+     */
+    UpdateStats getUpdateStats() const;
+
     // Functions below require the context to be current
 
     /**
@@ -793,6 +931,35 @@ public:
      */
     void removeBuffer(Buffer buffer);
 
+    /**
+     * Sets a memory budget, in bytes, for the buffer cache. When the cached
+     * buffers need more memory than the budget, the least recently used ones
+     * (as used by getBuffer, findBuffer, or Source::play) are removed as if
+     * by removeBuffer, until the cache fits within the budget again. Buffers
+     * that are playing on a source or still loading are never removed, so the
+     * cache may temporarily exceed the budget. MessageHandler::bufferEvicted
+     * is called for each buffer removed this way.
+     *
+     * Removed buffers invalidate their Buffer objects as with removeBuffer, so
+     * applications using a budget should get buffers by name when needed
+     * rather than holding on to them. A budget of 0, the default, means no
+     * limit.
+     */
+    void setBufferCacheBudget(size_t bytes);
+    /** Gets the memory budget, in bytes, for the buffer cache. */
+    size_t getBufferCacheBudget() const;
+    /**
+     * Gets the amount of memory, in bytes, used by the cached buffers
+     * (including ones still loading).
+     */
+    size_t getBufferCacheSize() const;
+
+    /**
+     * Retrieves the properties of each of the given buffers, in order. This is
+     * equivalent to calling Buffer::getInfo on each of them.
+     */
+    Vector<BufferInfo> getBufferInfo(ArrayView<Buffer> buffers) const;
+
     /**
      * Creates a new Source for playing audio. There is no practical limit to
      * the number of sources you may create. You must call Source::destroy when
@@ -800,6 +967,103 @@ public:
      */
     Source createSource();
 
+    /**
+     * Allocates OpenAL sources up front, so playing a Source doesn't need to
+     * allocate one. Sources play on OpenAL sources as needed, allocating more
+     * when none are free, and stopping the lowest priority playing Source when
+     * the context is out of them (see Source::setPriority). This allocates as
+     * many as count at once, up to the number the context allows.
+     *
+     * \return The number of OpenAL sources the context now holds, free or in
+     *         use.
+     */
+    ALuint reserveSources(ALuint count);
+
+    /**
+     * Enables or disables virtual voices. With them enabled, a Source playing
+     * a buffer that would be stopped to make room for a higher priority one,
+     * or that can't get an OpenAL source when played, is made virtual instead:
+     * it keeps track of where its playback would be without being mixed, and
+     * update gives it an OpenAL source at that offset again when one frees up,
+     * highest priority first. Virtual sources still count as playing, and are
+     * stopped when they reach the end. Sources playing streams aren't made
+     * virtual. Disabling virtual voices stops any virtual sources. Disabled by
+     * default.
+     *
+     * To mix only so many sources at once, set the ALC_MONO_SOURCES and
+     * ALC_STEREO_SOURCES attributes when creating the context.
+     */
+    void setVirtualVoices(bool enable);
+    /** Retrieves whether virtual voices are enabled. */
+    bool getVirtualVoices() const;
+
+    /**
+     * Sets the gain below which playing sources are culled, from 0 (the
+     * default, no culling) to 1. During update, the gain of each Source
+     * playing a buffer is estimated from the listener position and gain, the
+     * distance model, and the source's gain, gain range, distance range,
+     * rolloff factor, cone, and source group gain. Sources estimated to be
+     * quieter than the threshold are made virtual, so OpenAL doesn't spend
+     * time mixing them, and given an OpenAL source again once they're a bit
+     * louder than it. Estimates don't account for filters, effect sends, or
+     * air absorption.
+     *
+     * Sources are culled by making them virtual, so this only has an effect
+     * while virtual voices are enabled (see setVirtualVoices).
+     */
+    void setAudibilityThreshold(ALfloat gain);
+    /** Retrieves the gain below which playing sources are culled. */
+    ALfloat getAudibilityThreshold() const;
+
+    /**
+     * Enables or disables deferring calls made from other threads. While
+     * enabled, the following calls made from any thread other than the one
+     * that enabled it are queued, without locking, and made in the next
+     * update instead:
+     * - Source: play (with a Buffer), stop, pause, resume, fadeOutToStop,
+     *   fadeIn, setOffset, setLooping, setPitch, setGain, setPosition,
+     *   setVelocity, setDirection, setOrientation, and set3DParameters.
+     * - SourceGroup: setGain, setPitch, pauseAll, resumeAll, and stopAll.
+     * - Listener: setGain, setPosition, setVelocity, setOrientation, and
+     *   set3DParameters.
+     *
+     * Calls queued by one thread are made in the order they were queued, but
+     * there's no ordering between threads. Arguments are checked when the
+     * call is queued, while errors from making it are reported to stderr.
+     *
+     * Every other call, including update and getters, must be made from the
+     * thread that enabled it. Other calls that change the context or its
+     * objects throw a std::runtime_error when made from another thread, as
+     * do most getters. removeBuffer, and destroying a source or source group,
+     * first make any queued calls, and removeBuffer throws if the buffer was
+     * queued to play again meanwhile. Buffers queued to play aren't evicted
+     * from the buffer cache. Disabling it makes any queued calls.
+     */
+    void setDeferredCalls(bool enable);
+    /** Retrieves whether calls from other threads are deferred. */
+    bool getDeferredCalls() const;
+
+    /**
+     * Sets the position of each of the given sources, in order. Unlike
+     * Source::setPosition, the positions are held until the next call to
+     * update, which applies them all in one batch, so moving many sources
+     * each update avoids many separate OpenAL calls. Until then, the sources
+     * report their previous positions. Setting a source's position directly
+     * in between overrides the one set here.
+     */
+    void setSourcePositions(ArrayView<Source> sources, ArrayView<Vector3> positions);
+    /**
+     * Sets the velocity of each of the given sources, in order. Applied on
+     * the next call to update, as with setSourcePositions.
+     */
+    void setSourceVelocities(ArrayView<Source> sources, ArrayView<Vector3> velocities);
+    /**
+     * Sets the orientation (and so the direction) of each of the given
+     * sources, in order. Applied on the next call to update, as with
+     * setSourcePositions.
+     */
+    void setSourceOrientations(ArrayView<Source> sources, ArrayView<std::pair<Vector3,Vector3>> orientations);
+
     AuxiliaryEffectSlot createAuxiliaryEffectSlot();
 
     Effect createEffect();
@@ -918,6 +1182,13 @@ public:
     /** Retrieves the current loop points as a [start,end) pair. */
     std::pair<ALuint,ALuint> getLoopPoints() const;
 
+    /**
+     * Retrieves the buffer's length, size, format, and loop points at once.
+     * These are all recorded when the buffer is loaded, so this (like the
+     * individual queries) does not need to ask OpenAL.
+     */
+    BufferInfo getInfo() const;
+
     /** Retrieves the Source objects currently playing the buffer. */
     Vector<Source> getSources() const;
 
@@ -989,10 +1260,11 @@ public:
      * must be greater than 0 and less than 1. The duration must also be
      * greater than 0.
      *
-     * The fading is logarithmic. As a result, the initial drop-off may happen
-     * faster than expected but the fading is more perceptually consistant over
-     * the given duration. It will take just as much time to go from -6dB to
-     * -12dB as it will to go from -40dB to -46dB, for example.
+     * The fading is logarithmic by default. As a result, the initial drop-off
+     * may happen faster than expected but the fading is more perceptually
+     * consistant over the given duration. It will take just as much time to go
+     * from -6dB to -12dB as it will to go from -40dB to -46dB, for example.
+     * Other curves may be used instead.
      *
      * Pending playback from a future buffer is not immediately canceled, but
      * the fade timer starts with this call. If the future buffer then becomes
@@ -1001,9 +1273,25 @@ public:
      *
      * Fading is updated during calls to \c Context::update, which should be
      * called regularly (30 to 50 times per second) for the fading to be
-     * smooth.
+     * smooth. This replaces any fade the source already had, fading from its
+     * current fade gain.
+     */
+    void fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration,
+                       FadeCurve curve=FadeCurve::Exponential);
+
+    /**
+     * Fades the source in from the specified gain to its full gain over the
+     * given duration, as it continues playing. This gain is in addition to the
+     * base gain, and must be at least 0 and less than 1. The duration must be
+     * greater than 0.
+     *
+     * Playing the source again cancels the fade, so this should be called
+     * after starting playback. Like \c fadeOutToStop, it's updated during
+     * calls to \c Context::update, and replaces any fade the source already
+     * had.
      */
-    void fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration);
+    void fadeIn(ALfloat gain, std::chrono::milliseconds duration,
+                FadeCurve curve=FadeCurve::Exponential);
 
     /** Pauses the source if it is playing. */
     void pause();
@@ -1020,6 +1308,12 @@ public:
     /** Specifies if the source is currently paused. */
     bool isPaused() const;
 
+    /**
+     * Specifies if the source is currently virtual, playing or paused without
+     * an OpenAL source (see Context::setVirtualVoices).
+     */
+    bool isVirtual() const;
+
     /**
      * Specifies if the source is currently playing or waiting to play a future
      * buffer.
@@ -1041,13 +1335,32 @@ public:
 
     /**
      * Specifies the source's playback priority. The lowest priority sources
-     * will be forcefully stopped when no more mixing sources are available and
+     * will be forcefully stopped (or made virtual, see
+     * Context::setVirtualVoices) when no more mixing sources are available and
      * higher priority sources are played.
      */
     void setPriority(ALuint priority);
     /** Retrieves the source's priority. */
     ALuint getPriority() const;
 
+    /**
+     * Retrieves the number of times the source's stream underrun, i.e. it
+     * played all its queued audio before the streaming thread could refill
+     * it, since it was last played with a decoder.
+     */
+    ALuint getUnderrunCount() const;
+
+    /**
+     * Specifies how much audio, in seconds, is decoded ahead of time for
+     * streams played on this source. The audio is decoded on a separate
+     * thread, so refilling the stream only needs to give it to OpenAL, which
+     * avoids delays from slow decoders. A value of 0 (the default) decodes the
+     * audio when refilling. Takes effect the next time a stream is played.
+     */
+    void setStreamReadAhead(Seconds readahead);
+    /** Retrieves the amount of audio decoded ahead for streams. */
+    Seconds getStreamReadAhead() const;
+
     /**
      * Sets the source's offset, in sample frames. If the source is playing or
      * paused, it will go to that offset immediately, otherwise the source will
@@ -1463,6 +1776,18 @@ public:
      * indicates the end of the audio.
      */
     virtual ALuint read(ALvoid *ptr, ALuint count) noexcept = 0;
+
+    /**
+     * Retrieves up to count sample frames directly from the decoder's source
+     * data, without copying, and advances past them. Decoders whose source
+     * data is already in memory in the format they output, e.g. PCM data in
+     * a memory stream, may implement this to let buffers load straight from
+     * it. The returned view must remain valid as long as the decoder exists.
+     *
+     * Returning an empty view means read must be used instead, which is what
+     * the default implementation does.
+     */
+    virtual ArrayView<ALbyte> readDirect(ALuint count) noexcept;
 };
 
 /**
@@ -1482,8 +1807,24 @@ public:
      * \return nullptr if a decoder can't be created from the file.
      */
     virtual SharedPtr<Decoder> createDecoder(UniquePtr<std::istream> &file) noexcept = 0;
+
+    /**
+     * Checks if the start of a resource file has a signature (e.g. a magic
+     * number) of a format this factory decodes. Files are given to the first
+     * registered factory with a matching signature before the other registered
+     * factories are tried, and likewise for internal factories, so this should
+     * only return true for data the factory is very likely to decode. The
+     * default implementation returns false, leaving the factory to be tried in
+     * order with the others.
+     *
+     * \param header The start of the file, up to DecoderSignatureSize bytes.
+     */
+    virtual bool checkSignature(ArrayView<char> header) noexcept;
 };
 
+/** The maximum number of bytes given to DecoderFactory::checkSignature. */
+constexpr size_t DecoderSignatureSize = 64;
+
 /**
  * Registers a decoder factory for decoding audio. Registered factories are
  * used in lexicographical order, e.g. if Factory1 is registered with name1 and
@@ -1511,6 +1852,18 @@ ALURE_API void RegisterDecoder(StringView name, UniquePtr<DecoderFactory> factor
  */
 ALURE_API UniquePtr<DecoderFactory> UnregisterDecoder(StringView name) noexcept;
 
+/**
+ * Sets whether built-in decoders that can produce floating-point samples
+ * should, when the current context supports them (AL_EXT_FLOAT32). This
+ * currently applies to the Ogg Vorbis decoder, which otherwise decodes to
+ * 16-bit samples. Float32 keeps the full precision of the decoded audio and
+ * skips a conversion, but uses twice the memory. Only decoders created
+ * afterward are affected. Disabled by default.
+ */
+ALURE_API void SetDecoderFloatOutput(bool enable) noexcept;
+/** Retrieves whether built-in decoders produce floating-point samples. */
+ALURE_API bool GetDecoderFloatOutput() noexcept;
+
 
 /**
  * A file I/O factory interface. Applications may derive from this and set an
@@ -1538,6 +1891,50 @@ public:
     virtual UniquePtr<std::istream> openFile(const String &name) noexcept = 0;
 };
 
+/**
+ * Creates a FileIOFactory that memory-maps files instead of reading them with
+ * standard I/O. The streams it opens are memory streams (see
+ * CreateMemoryStream), so the built-in decoders read from the mapped files
+ * directly. Files that can't be mapped are opened with standard I/O.
+ */
+ALURE_API UniquePtr<FileIOFactory> CreateMappedFileIOFactory();
+
+/**
+ * Creates a read-only binary stream over a block of memory. The built-in
+ * decoders detect these streams and read from the memory directly, avoiding
+ * the copies and overhead of the stream interface, so a FileIOFactory serving
+ * files from memory should return them.
+ *
+ * \param data The memory to read. It must remain valid while the stream
+ * exists.
+ * \param owner An optional object to keep alive with the stream, e.g. one
+ * owning the memory.
+ */
+ALURE_API UniquePtr<std::istream> CreateMemoryStream(ArrayView<char> data, SharedPtr<void> owner=nullptr);
+
+/**
+ * Retrieves the memory a stream created by CreateMemoryStream reads from. The
+ * stream's read position is an offset into it. For other streams, an empty
+ * view is returned.
+ */
+ALURE_API ArrayView<char> GetStreamMemory(std::istream &stream) noexcept;
+
+/**
+ * Opens a sound bank, a single file packing many sounds with an indexed
+ * directory (see the alure-bank example for creating one). The bank is
+ * memory-mapped when possible, and the returned FileIOFactory serves its
+ * sounds by name without touching the filesystem. Sounds are decoded using
+ * the format stored in the bank, rather than by probing decoders.
+ *
+ * \param filename The sound bank file to open.
+ * \param fallback An optional FileIOFactory to open names that aren't in the
+ * bank. Without one, such names fail to open.
+ *
+ * \throws std::runtime_error If the file can't be opened or isn't a valid
+ * sound bank.
+ */
+ALURE_API UniquePtr<FileIOFactory> OpenSoundBank(StringView filename, UniquePtr<FileIOFactory> fallback=nullptr);
+
 
 /**
  * A message handler interface. Applications may derive from this and set an
@@ -1585,7 +1982,9 @@ public:
 
     /**
      * Called when a new buffer is about to be created and loaded. May be
-     * called asynchronously for buffers being loaded asynchronously.
+     * called asynchronously for buffers being loaded asynchronously. Buffers
+     * decoded into staging blocks (see Context::setAsyncUploadBudget) call
+     * this for each block, in order, each with the next part of the data.
      *
      * \param name The resource name, as passed to Context::getBuffer.
      * \param channels Channel configuration of the given audio data.
@@ -1595,6 +1994,17 @@ public:
      */
     virtual void bufferLoading(StringView name, ChannelConfig channels, SampleType type, ALuint samplerate, ArrayView<ALbyte> data) noexcept;
 
+    /**
+     * Called when a buffer has finished loading, with the time spent on it.
+     * May be called asynchronously for buffers being loaded asynchronously,
+     * or from Context::update for ones being given to OpenAL in slices (see
+     * Context::setAsyncUploadBudget).
+     *
+     * \param name The resource name, as passed to Context::getBuffer.
+     * \param timing How long the different parts of the load took.
+     */
+    virtual void bufferLoaded(StringView name, const BufferLoadTiming &timing) noexcept;
+
     /**
      * Called when a resource isn't found, allowing the app to substitute in a
      * different resource. For buffers being cached, the original name will
@@ -1608,6 +2018,28 @@ public:
      *         string means to stop trying.
      */
     virtual String resourceNotFound(StringView name) noexcept;
+
+    /**
+     * Called when a cached buffer is about to be removed to keep the buffer
+     * cache within the budget set by Context::setBufferCacheBudget. Buffer
+     * objects for it will be invalid after this returns.
+     *
+     * \param name The resource name of the buffer being removed.
+     * \param size The amount of memory, in bytes, the buffer was using.
+     */
+    virtual void bufferEvicted(StringView name, size_t size) noexcept;
+
+    /**
+     * Called after trying to create a decoder for a resource, with the number
+     * of decoder factories that were tried. Resources matching a factory's
+     * signature (see DecoderFactory::checkSignature) normally need only one
+     * attempt, plus one for each registered factory tried before it.
+     *
+     * \param name The name of the resource that was opened, after any
+     *        substitution by resourceNotFound.
+     * \param attempts The number of decoder factories tried.
+     */
+    virtual void decoderProbed(StringView name, ALuint attempts) noexcept;
 };
 
 #undef MAKE_PIMPL
@@ -0,0 +1,208 @@
+#include "config.h"
+
+#include "audibility.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "context.h"
+#include "source.h"
+
+namespace alure
+{
+
+namespace
+{
+
+// Attenuation for each distance model, given the distance to the listener and
+// the source's reference distance, max distance, and rolloff factor. Divisors
+// are kept from being 0 rather than branched around, so the loop using them
+// vectorizes.
+struct InverseAttn {
+    ALfloat operator()(ALfloat dist, ALfloat refdist, ALfloat, ALfloat rolloff) const
+    {
+        const ALfloat denom = refdist + rolloff*(dist - refdist);
+        const ALfloat attn = refdist / std::max(denom, std::numeric_limits<float>::min());
+        return (denom > 0.0f) ? attn : 1.0f;
+    }
+};
+struct LinearAttn {
+    ALfloat operator()(ALfloat dist, ALfloat refdist, ALfloat maxdist, ALfloat rolloff) const
+    {
+        const ALfloat range = maxdist - refdist;
+        const ALfloat attn = 1.0f - rolloff*(dist - refdist)/std::max(range, std::numeric_limits<float>::min());
+        return (range > 0.0f) ? std::max(attn, 0.0f) : 1.0f;
+    }
+};
+struct ExponentAttn {
+    ALfloat operator()(ALfloat dist, ALfloat refdist, ALfloat, ALfloat rolloff) const
+    {
+        return (dist > 0.0f && refdist > 0.0f) ? std::pow(dist/refdist, -rolloff) : 1.0f;
+    }
+};
+struct NoAttn {
+    ALfloat operator()(ALfloat, ALfloat, ALfloat, ALfloat) const { return 1.0f; }
+};
+
+// Kept free of branches that depend on the source, so it vectorizes. Only the
+// estimates are written, so they're marked as not aliasing the parameters to
+// save the compiler from checking each list for overlap.
+template<bool Clamped, typename Attn>
+void EstimateGains(size_t count, ALfloat *RESTRICT estimates, const Vector3 &listener_pos,
+    ALfloat listener_gain, const ALfloat *posx, const ALfloat *posy, const ALfloat *posz,
+    const ALfloat *dirx, const ALfloat *diry, const ALfloat *dirz, const ALfloat *lscale,
+    const ALfloat *gain, const ALfloat *mingain, const ALfloat *maxgain,
+    const ALfloat *refdist, const ALfloat *maxdist, const ALfloat *rolloff,
+    const ALfloat *coneinner, const ALfloat *conescale, const ALfloat *coneouter)
+{
+    const Attn attenuate{};
+    const ALfloat lx = listener_pos[0];
+    const ALfloat ly = listener_pos[1];
+    const ALfloat lz = listener_pos[2];
+    for(size_t i = 0;i < count;++i)
+    {
+        const ALfloat dx = posx[i] - lx*lscale[i];
+        const ALfloat dy = posy[i] - ly*lscale[i];
+        const ALfloat dz = posz[i] - lz*lscale[i];
+        const ALfloat dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+        // The cosine of the angle between the source's direction and the
+        // listener, used to go from the inner cone gain (1) to the outer.
+        const ALfloat cosang = -(dx*dirx[i] + dy*diry[i] + dz*dirz[i]) / std::max(dist, 1e-6f);
+        const ALfloat conefrac = std::min(std::max((coneinner[i]-cosang) * conescale[i], 0.0f), 1.0f);
+        const ALfloat conegain = 1.0f + conefrac*(coneouter[i] - 1.0f);
+
+        const ALfloat attndist = Clamped ? std::min(std::max(dist, refdist[i]), maxdist[i]) : dist;
+        const ALfloat attn = attenuate(attndist, refdist[i], maxdist[i], rolloff[i]);
+
+        const ALfloat srcgain = gain[i] * attn * conegain;
+        estimates[i] = std::min(std::max(srcgain, mingain[i]), maxgain[i]) * listener_gain;
+    }
+}
+
+} // namespace
+
+
+std::array<Vector<ALfloat>*,AudibilityTable::NumLists> AudibilityTable::getLists()
+{
+    return {{&mPosX, &mPosY, &mPosZ, &mDirX, &mDirY, &mDirZ, &mListenerScale, &mGain,
+             &mMinGain, &mMaxGain, &mRefDist, &mMaxDist, &mRolloff, &mConeInnerCos,
+             &mConeScale, &mConeOuterGain, &mEstimates}};
+}
+
+void AudibilityTable::store(size_t idx, const AudibilityParams &params)
+{
+    mPosX[idx] = params.mPosition[0];
+    mPosY[idx] = params.mPosition[1];
+    mPosZ[idx] = params.mPosition[2];
+
+    // Sources without a direction, or with a cone all the way around, are
+    // omnidirectional.
+    const Vector3 &dir = params.mDirection;
+    const ALfloat dirlen = std::sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+    if(dirlen > 0.0f && params.mConeInnerAngle < 360.0f)
+    {
+        mDirX[idx] = dir[0] / dirlen;
+        mDirY[idx] = dir[1] / dirlen;
+        mDirZ[idx] = dir[2] / dirlen;
+        const ALfloat innercos = std::cos(params.mConeInnerAngle * (F_PI/360.0f));
+        const ALfloat outercos = std::cos(params.mConeOuterAngle * (F_PI/360.0f));
+        mConeInnerCos[idx] = innercos;
+        mConeScale[idx] = 1.0f / std::max(innercos - outercos, 1e-6f);
+    }
+    else
+    {
+        mDirX[idx] = mDirY[idx] = mDirZ[idx] = 0.0f;
+        mConeInnerCos[idx] = -1.0f;
+        mConeScale[idx] = 1.0f;
+    }
+    mConeOuterGain[idx] = params.mConeOuterGain;
+
+    mListenerScale[idx] = params.mRelative ? 0.0f : 1.0f;
+    mGain[idx] = params.mGain;
+    mMinGain[idx] = params.mMinGain;
+    mMaxGain[idx] = params.mMaxGain;
+    mRefDist[idx] = params.mRefDist;
+    mMaxDist[idx] = params.mMaxDist;
+    mRolloff[idx] = params.mRolloffFactor;
+}
+
+void AudibilityTable::move(size_t dst, size_t src)
+{
+    mSources[dst] = mSources[src];
+    mSources[dst]->mAudibilityIndex = dst;
+    for(Vector<ALfloat> *list : getLists())
+        (*list)[dst] = (*list)[src];
+}
+
+
+void AudibilityTable::add(SourceImpl *source, const AudibilityParams &params)
+{
+    if(source->mAudibilityIndex != SourceImpl::NoAudibilityIndex)
+        return;
+
+    const size_t idx = mSources.size();
+    mSources.push_back(source);
+    for(Vector<ALfloat> *list : getLists())
+        list->emplace_back();
+    store(idx, params);
+    source->mAudibilityIndex = idx;
+}
+
+void AudibilityTable::update(SourceImpl *source, const AudibilityParams &params)
+{
+    const size_t idx = source->mAudibilityIndex;
+    if(idx < mSources.size() && mSources[idx] == source)
+        store(idx, params);
+}
+
+void AudibilityTable::remove(SourceImpl *source)
+{
+    const size_t idx = source->mAudibilityIndex;
+    if(idx >= mSources.size() || mSources[idx] != source)
+        return;
+    source->mAudibilityIndex = SourceImpl::NoAudibilityIndex;
+
+    const size_t last = mSources.size()-1;
+    if(idx < last) move(idx, last);
+    mSources.pop_back();
+    for(Vector<ALfloat> *list : getLists())
+        list->pop_back();
+}
+
+void AudibilityTable::clear()
+{
+    for(SourceImpl *source : mSources)
+        source->mAudibilityIndex = SourceImpl::NoAudibilityIndex;
+    mSources.clear();
+    for(Vector<ALfloat> *list : getLists())
+        list->clear();
+}
+
+
+ArrayView<ALfloat> AudibilityTable::estimate(const Vector3 &listener_pos, ALfloat listener_gain,
+                                             DistanceModel model)
+{
+    const size_t count = mSources.size();
+    ALfloat *estimates = mEstimates.data();
+#define ESTIMATE(clamped, attn) EstimateGains<clamped,attn>(count, estimates,          \
+    listener_pos, listener_gain, mPosX.data(), mPosY.data(), mPosZ.data(),             \
+    mDirX.data(), mDirY.data(), mDirZ.data(), mListenerScale.data(), mGain.data(),     \
+    mMinGain.data(), mMaxGain.data(), mRefDist.data(), mMaxDist.data(),                \
+    mRolloff.data(), mConeInnerCos.data(), mConeScale.data(), mConeOuterGain.data())
+    switch(model)
+    {
+        case DistanceModel::InverseClamped: ESTIMATE(true, InverseAttn); break;
+        case DistanceModel::LinearClamped: ESTIMATE(true, LinearAttn); break;
+        case DistanceModel::ExponentClamped: ESTIMATE(true, ExponentAttn); break;
+        case DistanceModel::Inverse: ESTIMATE(false, InverseAttn); break;
+        case DistanceModel::Linear: ESTIMATE(false, LinearAttn); break;
+        case DistanceModel::Exponent: ESTIMATE(false, ExponentAttn); break;
+        case DistanceModel::None: ESTIMATE(false, NoAttn); break;
+    }
+#undef ESTIMATE
+    return ArrayView<ALfloat>(estimates, count);
+}
+
+} // namespace alure
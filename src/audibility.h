@@ -0,0 +1,71 @@
+#ifndef AUDIBILITY_H
+#define AUDIBILITY_H
+
+#include <array>
+
+#include "main.h"
+
+namespace alure {
+
+// The properties of a source that decide how loud it is at the listener.
+struct AudibilityParams {
+    Vector3 mPosition;
+    Vector3 mDirection;
+    // The source gain, with its group's gain applied.
+    ALfloat mGain;
+    ALfloat mMinGain, mMaxGain;
+    ALfloat mRefDist, mMaxDist;
+    ALfloat mRolloffFactor;
+    ALfloat mConeInnerAngle, mConeOuterAngle;
+    ALfloat mConeOuterGain;
+    bool mRelative;
+};
+
+// The audibility parameters of playing sources, kept as parallel arrays so
+// the gains of thousands of sources can be estimated in one vectorizable pass
+// instead of visiting each source. Sources record their place in
+// mAudibilityIndex, and so may only be in one table.
+//
+// Estimates follow the OpenAL distance models and sound cones, without the
+// effects of air absorption, filters, or sends.
+class AudibilityTable {
+    Vector<SourceImpl*> mSources;
+    Vector<ALfloat> mPosX, mPosY, mPosZ;
+    // Normalized cone direction, or 0 for omnidirectional sources.
+    Vector<ALfloat> mDirX, mDirY, mDirZ;
+    // How much the listener position offsets the source; 0 when relative.
+    Vector<ALfloat> mListenerScale;
+    Vector<ALfloat> mGain, mMinGain, mMaxGain;
+    Vector<ALfloat> mRefDist, mMaxDist, mRolloff;
+    // Cosine of the inner half cone angle, and the scale for how far past it
+    // the listener is toward the outer cone.
+    Vector<ALfloat> mConeInnerCos, mConeScale, mConeOuterGain;
+    Vector<ALfloat> mEstimates;
+
+    static constexpr size_t NumLists = 17;
+    std::array<Vector<ALfloat>*,NumLists> getLists();
+    void store(size_t idx, const AudibilityParams &params);
+    void move(size_t dst, size_t src);
+
+public:
+    size_t size() const { return mSources.size(); }
+    SourceImpl *getSource(size_t idx) const { return mSources[idx]; }
+
+    // Adds the source, if it's not already in the table.
+    void add(SourceImpl *source, const AudibilityParams &params);
+    // Updates the source's parameters after they changed.
+    void update(SourceImpl *source, const AudibilityParams &params);
+    // Removes the source, if it's in the table. The last source takes its
+    // place.
+    void remove(SourceImpl *source);
+    void clear();
+
+    // Estimates the gain of each source, in table order, for the given
+    // listener position and gain.
+    ArrayView<ALfloat> estimate(const Vector3 &listener_pos, ALfloat listener_gain,
+                                DistanceModel model);
+};
+
+} // namespace alure
+
+#endif /* AUDIBILITY_H */
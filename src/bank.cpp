@@ -0,0 +1,382 @@
+#include "config.h"
+
+#include "bank.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "hashindex.h"
+
+#ifdef HAVE_WAVE
+#include "decoders/wave.hpp"
+#endif
+#ifdef HAVE_VORBISFILE
+#include "decoders/vorbisfile.hpp"
+#endif
+#ifdef HAVE_LIBFLAC
+#include "decoders/flac.hpp"
+#endif
+#ifdef HAVE_OPUSFILE
+#include "decoders/opusfile.hpp"
+#endif
+#ifdef HAVE_MPG123
+#include "decoders/mpg123.hpp"
+#endif
+
+namespace {
+
+ALuint read_le32(const char *ptr)
+{
+    const ALubyte *buf = reinterpret_cast<const ALubyte*>(ptr);
+    return ALuint(buf[0]) | (ALuint(buf[1])<<8) | (ALuint(buf[2])<<16) | (ALuint(buf[3])<<24);
+}
+
+uint64_t read_le64(const char *ptr)
+{ return uint64_t{read_le32(ptr)} | (uint64_t{read_le32(ptr+4)}<<32); }
+
+} // namespace
+
+namespace alure {
+
+struct BankEntry {
+    StringView mName;
+    ArrayView<char> mData;
+    StringView mCodec;
+
+    ALuint mFrequency;
+    ChannelConfig mChannelConfig;
+    SampleType mSampleType;
+    uint64_t mLength;
+    std::pair<uint64_t,uint64_t> mLoopPts;
+};
+
+struct BankEntryNameOf {
+    StringView operator()(const BankEntry *entry) const { return entry->mName; }
+};
+
+class BankData {
+public:
+    // Keeps the bank's memory alive.
+    SharedPtr<void> mOwner;
+    ArrayView<char> mMemory;
+
+    Vector<BankEntry> mEntries;
+    NameHashIndex<const BankEntry*,BankEntryNameOf> mIndex;
+    // Entries sorted by their data, to find the entry a stream is reading.
+    Vector<const BankEntry*> mDataIndex;
+
+    ~BankData();
+
+    const BankEntry *findData(ArrayView<char> data) const noexcept
+    {
+        auto iter = std::lower_bound(mDataIndex.begin(), mDataIndex.end(), data.data(),
+            [](const BankEntry *lhs, const char *rhs) -> bool
+            { return lhs->mData.data() < rhs; }
+        );
+        for(;iter != mDataIndex.end() && (*iter)->mData.data() == data.data();++iter)
+        {
+            if((*iter)->mData.size() == data.size())
+                return *iter;
+        }
+        return nullptr;
+    }
+};
+
+} // namespace alure
+
+namespace {
+
+// Banks that are currently open, to recognize streams of their entries.
+std::mutex gBankMutex;
+alure::Vector<alure::BankData*> gBanks;
+
+const alure::BankEntry *FindBankEntry(alure::ArrayView<char> data)
+{
+    std::lock_guard<std::mutex> lock(gBankMutex);
+    for(alure::BankData *bank : gBanks)
+    {
+        const char *start = bank->mMemory.data();
+        if(data.data() >= start && data.data() < start+bank->mMemory.size())
+            return bank->findData(data);
+    }
+    return nullptr;
+}
+
+alure::DecoderFactory *GetCodecFactory(alure::StringView codec)
+{
+#ifdef HAVE_WAVE
+    static alure::WaveDecoderFactory sWaveFactory;
+    if(codec == "WAVE") return &sWaveFactory;
+#endif
+#ifdef HAVE_VORBISFILE
+    static alure::VorbisFileDecoderFactory sVorbisFactory;
+    if(codec == "OGGV") return &sVorbisFactory;
+#endif
+#ifdef HAVE_LIBFLAC
+    static alure::FlacDecoderFactory sFlacFactory;
+    if(codec == "FLAC") return &sFlacFactory;
+#endif
+#ifdef HAVE_OPUSFILE
+    static alure::OpusFileDecoderFactory sOpusFactory;
+    if(codec == "OGGO") return &sOpusFactory;
+#endif
+#ifdef HAVE_MPG123
+    static alure::Mpg123DecoderFactory sMpg123Factory;
+    if(codec == "MP3 ") return &sMpg123Factory;
+#endif
+    return nullptr;
+}
+
+
+class BankFileIOFactory final : public alure::FileIOFactory {
+    alure::SharedPtr<alure::BankData> mBank;
+    alure::UniquePtr<alure::FileIOFactory> mFallback;
+
+public:
+    BankFileIOFactory(alure::SharedPtr<alure::BankData> bank,
+                      alure::UniquePtr<alure::FileIOFactory> fallback)
+      : mBank(std::move(bank)), mFallback(std::move(fallback))
+    { }
+
+    alure::UniquePtr<std::istream> openFile(const alure::String &name) noexcept override
+    {
+        size_t hash = static_cast<size_t>(alure::BankNameHash(name));
+        if(const alure::BankEntry *const *entry = mBank->mIndex.find(name, hash))
+            return alure::CreateMemoryStream((*entry)->mData, mBank);
+        if(mFallback)
+            return mFallback->openFile(name);
+        return nullptr;
+    }
+};
+
+} // namespace
+
+namespace alure {
+
+BankData::~BankData()
+{
+    std::lock_guard<std::mutex> lock(gBankMutex);
+    auto iter = std::find(gBanks.begin(), gBanks.end(), this);
+    if(iter != gBanks.end()) gBanks.erase(iter);
+}
+
+
+class BankPcmDecoder final : public Decoder {
+    // The entry's stream, which keeps the bank alive.
+    UniquePtr<std::istream> mFile;
+    const BankEntry &mEntry;
+    ALuint mFrameSize;
+
+    uint64_t mCurrentPos{0};
+
+public:
+    BankPcmDecoder(UniquePtr<std::istream> file, const BankEntry &entry) noexcept
+      : mFile(std::move(file)), mEntry(entry)
+      , mFrameSize(FramesToBytes(1, entry.mChannelConfig, entry.mSampleType))
+    { }
+    ~BankPcmDecoder() override { }
+
+    ALuint getFrequency() const noexcept override { return mEntry.mFrequency; }
+    ChannelConfig getChannelConfig() const noexcept override { return mEntry.mChannelConfig; }
+    SampleType getSampleType() const noexcept override { return mEntry.mSampleType; }
+
+    uint64_t getLength() const noexcept override { return mEntry.mLength; }
+    bool seek(uint64_t pos) noexcept override
+    {
+        if(pos > mEntry.mLength)
+            return false;
+        mCurrentPos = pos;
+        return true;
+    }
+
+    std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override
+    { return mEntry.mLoopPts; }
+
+    ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+    ArrayView<ALbyte> readDirect(ALuint count) noexcept override;
+};
+
+ALuint BankPcmDecoder::read(ALvoid *ptr, ALuint count) noexcept
+{
+    count = static_cast<ALuint>(std::min<uint64_t>(count, mEntry.mLength-mCurrentPos));
+    const char *src = mEntry.mData.data() + mCurrentPos*mFrameSize;
+    size_t len = size_t{count} * mFrameSize;
+#ifdef __BIG_ENDIAN__
+    if(mEntry.mSampleType == SampleType::Int16)
+    {
+        for(size_t i = 0;i < len;++i)
+            static_cast<char*>(ptr)[i] = src[i^1];
+    }
+    else if(mEntry.mSampleType == SampleType::Float32)
+    {
+        for(size_t i = 0;i < len;++i)
+            static_cast<char*>(ptr)[i] = src[i^3];
+    }
+    else
+#endif
+    if(len > 0)
+        memcpy(ptr, src, len);
+
+    mCurrentPos += count;
+    return count;
+}
+
+ArrayView<ALbyte> BankPcmDecoder::readDirect(ALuint count) noexcept
+{
+#ifdef __BIG_ENDIAN__
+    // Multi-byte samples need to be byte-swapped.
+    if(mEntry.mSampleType != SampleType::UInt8 && mEntry.mSampleType != SampleType::Mulaw)
+        return {};
+#endif
+    count = static_cast<ALuint>(std::min<uint64_t>(count, mEntry.mLength-mCurrentPos));
+    ArrayView<ALbyte> samples(
+        reinterpret_cast<const ALbyte*>(mEntry.mData.data()) + mCurrentPos*mFrameSize,
+        size_t{count} * mFrameSize
+    );
+    mCurrentPos += count;
+    return samples;
+}
+
+
+uint64_t BankNameHash(StringView name) noexcept
+{
+    using traits_type = StringView::traits_type;
+
+    // 64-bit FNV-1a, regardless of the size of size_t.
+    uint64_t val = 0xcbf29ce484222325;
+    for(auto ch : name)
+        val = (val^traits_type::to_int_type(ch)) * 0x100000001b3;
+    return val;
+}
+
+SharedPtr<Decoder> CreateBankDecoder(UniquePtr<std::istream> &file) noexcept
+{
+    ArrayView<char> memory = GetStreamMemory(*file);
+    if(memory.empty()) return nullptr;
+
+    const BankEntry *entry = FindBankEntry(memory);
+    if(!entry) return nullptr;
+
+    if(entry->mCodec == "PCM ")
+    {
+        // Without a usable context, leave the format to be checked when a
+        // buffer is made from it.
+        bool supported = true;
+        try {
+            Context ctx = Context::GetCurrent();
+            if(ctx && !ctx.isSupported(entry->mChannelConfig, entry->mSampleType))
+                supported = false;
+        }
+        catch(...) {
+        }
+        if(!supported) return nullptr;
+        return MakeShared<BankPcmDecoder>(std::move(file), *entry);
+    }
+
+    SharedPtr<Decoder> decoder;
+    if(DecoderFactory *factory = GetCodecFactory(entry->mCodec))
+        decoder = factory->createDecoder(file);
+    if(!decoder && file)
+    {
+        file->clear();
+        file->seekg(0);
+    }
+    return decoder;
+}
+
+
+UniquePtr<FileIOFactory> OpenSoundBank(StringView filename, UniquePtr<FileIOFactory> fallback)
+{
+    // Map the bank if possible, otherwise read it all into memory.
+    UniquePtr<std::istream> file = CreateMappedFileIOFactory()->openFile(String(filename));
+    if(!file) throw std::runtime_error("Failed to open sound bank");
+
+    auto bank = MakeShared<BankData>();
+    bank->mMemory = GetStreamMemory(*file);
+    if(!bank->mMemory.empty())
+        bank->mOwner = SharedPtr<std::istream>(std::move(file));
+    else
+    {
+        auto data = MakeShared<Vector<char>>();
+        char buf[4096];
+        while(file->read(buf, sizeof(buf)) || file->gcount() > 0)
+            data->insert(data->end(), buf, buf+file->gcount());
+        bank->mMemory = *data;
+        bank->mOwner = std::move(data);
+    }
+
+    ArrayView<char> memory = bank->mMemory;
+    if(memory.size() < BankHeaderSize || memcmp(memory.data(), BankMagic, 4) != 0)
+        throw std::runtime_error("Not a sound bank");
+    if(read_le32(memory.data()+4) != BankVersion)
+        throw std::runtime_error("Unsupported sound bank version");
+
+    ALuint count = read_le32(memory.data()+8);
+    if(count > (memory.size()-BankHeaderSize) / BankEntrySize)
+        throw std::runtime_error("Invalid sound bank directory");
+
+    auto in_range = [&memory](uint64_t offset, uint64_t length) -> bool
+    { return offset <= memory.size() && length <= memory.size()-offset; };
+
+    bank->mEntries.reserve(count);
+    const char *dir = memory.data() + BankHeaderSize;
+    for(ALuint i = 0;i < count;++i,dir += BankEntrySize)
+    {
+        uint64_t data_offset = read_le64(dir+8);
+        uint64_t data_length = read_le64(dir+16);
+        ALuint name_offset = read_le32(dir+48);
+        ALuint name_length = read_le32(dir+52);
+        if(!in_range(data_offset, data_length) || data_length == 0 ||
+           !in_range(name_offset, name_length))
+            throw std::runtime_error("Invalid sound bank entry");
+
+        BankEntry entry;
+        entry.mName = StringView(memory.data()+name_offset, name_length);
+        entry.mData = memory.slice(static_cast<size_t>(data_offset),
+                                   static_cast<size_t>(data_length));
+        entry.mCodec = StringView(dir+60, 4);
+        entry.mFrequency = read_le32(dir+56);
+        entry.mLength = read_le64(dir+24);
+        entry.mLoopPts = std::make_pair(read_le64(dir+32), read_le64(dir+40));
+
+        ALubyte chans = static_cast<ALubyte>(dir[64]);
+        ALubyte type = static_cast<ALubyte>(dir[65]);
+        if(chans > static_cast<ALubyte>(ChannelConfig::BFormat3D) ||
+           type > static_cast<ALubyte>(SampleType::Mulaw))
+            throw std::runtime_error("Invalid sound bank entry format");
+        entry.mChannelConfig = static_cast<ChannelConfig>(chans);
+        entry.mSampleType = static_cast<SampleType>(type);
+
+        if(entry.mCodec == "PCM ")
+        {
+            // Don't read past the entry's data.
+            ALuint frame_size = FramesToBytes(1, entry.mChannelConfig, entry.mSampleType);
+            entry.mLength = std::min<uint64_t>(entry.mLength, data_length / frame_size);
+            if(entry.mFrequency == 0 || entry.mLength == 0)
+                throw std::runtime_error("Invalid sound bank entry format");
+        }
+
+        bank->mEntries.push_back(entry);
+    }
+
+    bank->mDataIndex.reserve(count);
+    for(const BankEntry &entry : bank->mEntries)
+    {
+        bank->mIndex.insert(static_cast<size_t>(BankNameHash(entry.mName)), &entry);
+        bank->mDataIndex.push_back(&entry);
+    }
+    std::sort(bank->mDataIndex.begin(), bank->mDataIndex.end(),
+        [](const BankEntry *lhs, const BankEntry *rhs) -> bool
+        { return lhs->mData.data() < rhs->mData.data(); }
+    );
+
+    std::unique_lock<std::mutex> lock(gBankMutex);
+    gBanks.push_back(bank.get());
+    lock.unlock();
+
+    return MakeUnique<BankFileIOFactory>(std::move(bank), std::move(fallback));
+}
+
+} // namespace alure
@@ -0,0 +1,50 @@
+#ifndef BANK_H
+#define BANK_H
+
+#include "main.h"
+
+namespace alure {
+
+// Sound bank file layout. All values are little-endian.
+//
+// Header (16 bytes):
+//   char[4] magic, "ALBK"
+//   u32     version (1)
+//   u32     number of entries
+//   u32     reserved (0)
+//
+// Directory (72 bytes per entry), sorted by name hash:
+//   u64     name hash (64-bit FNV-1a of the name)
+//   u64     data offset, from the start of the file
+//   u64     data length, in bytes
+//   u64     length, in sample frames
+//   u64     loop start, in sample frames
+//   u64     loop end, in sample frames
+//   u32     name offset, from the start of the file
+//   u32     name length, in bytes
+//   u32     sample rate
+//   char[4] codec tag
+//   u8      channel config (ChannelConfig value)
+//   u8      sample type (SampleType value)
+//   u16     reserved (0)
+//   u32     reserved (0)
+//
+// The names and sound data follow the directory. For "PCM " entries, the
+// data is raw interleaved samples in the given format. For other codec tags
+// the data is a complete file for the given decoder: "WAVE", "OGGV" (Ogg
+// Vorbis), "OGGO" (Ogg Opus), "FLAC", "MP3 ", or "FILE" for anything else.
+constexpr char BankMagic[4]{'A','L','B','K'};
+constexpr ALuint BankVersion = 1;
+constexpr size_t BankHeaderSize = 16;
+constexpr size_t BankEntrySize = 72;
+
+uint64_t BankNameHash(StringView name) noexcept;
+
+// Creates a decoder for the given stream if it's a sound bank entry, using the
+// format stored in the bank's directory. Returns nullptr (with the stream
+// rewound) otherwise.
+SharedPtr<Decoder> CreateBankDecoder(UniquePtr<std::istream> &file) noexcept;
+
+} // namespace alure
+
+#endif /* BANK_H */
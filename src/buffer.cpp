@@ -76,6 +76,14 @@ const struct {
     { SampleType::Mulaw, AL::EXT_MULAW, MulawFormats },
 };
 
+
+ALbyte GetSilence(SampleType type)
+{
+    if(type == SampleType::UInt8) return -128;
+    if(type == SampleType::Mulaw) return 127;
+    return 0;
+}
+
 } // namespace
 
 namespace alure {
@@ -116,43 +124,190 @@ void BufferImpl::cleanup()
 }
 
 
-void BufferImpl::load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, ContextImpl *ctx)
+ArrayView<ALbyte> BufferImpl::decode(ALuint frames, Decoder &decoder, Vector<ALbyte> &data,
+                                     std::pair<uint64_t,uint64_t> &loop_pts) const
 {
-    Vector<ALbyte> data(FramesToBytes(frames, mChannelConfig, mSampleType));
-
-    ALuint got = decoder->read(data.data(), frames);
-    if(got > 0)
+    ArrayView<ALbyte> samples = decoder.readDirect(frames);
+    if(!samples.empty())
     {
-        frames = got;
-        data.resize(FramesToBytes(frames, mChannelConfig, mSampleType));
+        frames = BytesToFrames(static_cast<ALuint>(samples.size()), mChannelConfig, mSampleType);
+        samples = samples.slice(0, FramesToBytes(frames, mChannelConfig, mSampleType));
     }
-    else
+    if(samples.empty())
     {
-        ALbyte silence = 0;
-        if(mSampleType == SampleType::UInt8) silence = -128;
-        else if(mSampleType == SampleType::Mulaw) silence = 127;
-        std::fill(data.begin(), data.end(), silence);
-    }
+        data = mContext.getStagingPool().acquire(
+            FramesToBytes(frames, mChannelConfig, mSampleType)
+        );
 
-    std::pair<uint64_t,uint64_t> loop_pts = decoder->getLoopPoints();
-    if(loop_pts.first >= loop_pts.second)
-        loop_pts = std::make_pair(0, frames);
-    else
-    {
-        loop_pts.second = std::min<uint64_t>(loop_pts.second, frames);
-        loop_pts.first = std::min<uint64_t>(loop_pts.first, loop_pts.second-1);
+        ALuint got = decoder.read(data.data(), frames);
+        if(got > 0)
+        {
+            frames = got;
+            data.resize(FramesToBytes(frames, mChannelConfig, mSampleType));
+        }
+        else
+            std::fill(data.begin(), data.end(), GetSilence(mSampleType));
+        samples = data;
     }
 
+    loop_pts = ClampLoopPoints(decoder.getLoopPoints(), frames);
+    return samples;
+}
+
+void BufferImpl::upload(ALenum format, ArrayView<ALbyte> samples,
+                        std::pair<uint64_t,uint64_t> loop_pts, ContextImpl *ctx)
+{
     ctx->send(&MessageHandler::bufferLoading,
-        mName, mChannelConfig, mSampleType, mFrequency, data
+        mName, mChannelConfig, mSampleType, mFrequency, samples
     );
 
-    alBufferData(mId, format, data.data(), static_cast<ALsizei>(data.size()), mFrequency);
+    alBufferData(mId, format, samples.data(), static_cast<ALsizei>(samples.size()), mFrequency);
     if(ctx->hasExtension(AL::SOFT_loop_points))
     {
         ALint pts[2]{(ALint)loop_pts.first, (ALint)loop_pts.second};
         alBufferiv(mId, AL_LOOP_POINTS_SOFT, pts);
     }
+    setLoaded(BytesToFrames(static_cast<ALuint>(samples.size()), mChannelConfig, mSampleType),
+              samples.size(), loop_pts);
+}
+
+
+bool BufferImpl::canUploadSlices() const
+{
+    // Slices must be in the format the buffer stores its samples in, which
+    // mu-law samples may be converted from.
+    return mContext.hasExtension(AL::SOFT_buffer_sub_data) && mSampleType != SampleType::Mulaw;
+}
+
+void BufferImpl::decodeStaged(ALuint frames, Decoder &decoder, StagedSamples &staged,
+                              std::pair<uint64_t,uint64_t> &loop_pts) const
+{
+    const ALuint frame_size = FramesToBytes(1, mChannelConfig, mSampleType);
+    const ALuint block_frames = static_cast<ALuint>(StagingBlockSize / frame_size);
+    if(!canUploadSlices() || frames <= block_frames)
+    {
+        staged.mBlocks.emplace_back();
+        ArrayView<ALbyte> samples = decode(frames, decoder, staged.mBlocks.back(), loop_pts);
+        staged.mPieces.push_back(samples);
+        staged.mSize = samples.size();
+        return;
+    }
+
+    ArrayView<ALbyte> samples = decoder.readDirect(frames);
+    if(!samples.empty())
+    {
+        frames = BytesToFrames(static_cast<ALuint>(samples.size()), mChannelConfig, mSampleType);
+        samples = samples.slice(0, FramesToBytes(frames, mChannelConfig, mSampleType));
+        staged.mPieces.push_back(samples);
+        staged.mSize = samples.size();
+    }
+    else
+    {
+        bool silent = false;
+        ALuint total = 0;
+        while(total < frames)
+        {
+            ALuint todo = std::min(frames-total, block_frames);
+            Vector<ALbyte> block = mContext.getStagingPool().acquire(
+                static_cast<size_t>(todo) * frame_size
+            );
+
+            ALuint got = 0;
+            if(!silent)
+            {
+                got = decoder.read(block.data(), todo);
+                if(!got && total > 0)
+                {
+                    mContext.getStagingPool().release(std::move(block));
+                    break;
+                }
+                // If nothing could be decoded, fill the buffer with silence
+                // as decode does.
+                silent = !got;
+            }
+            if(silent)
+            {
+                std::fill(block.begin(), block.end(), GetSilence(mSampleType));
+                got = todo;
+            }
+
+            block.resize(static_cast<size_t>(got) * frame_size);
+            staged.mPieces.push_back(block);
+            staged.mBlocks.push_back(std::move(block));
+            staged.mSize += staged.mPieces.back().size();
+            total += got;
+            if(got < todo) break;
+        }
+        frames = total;
+    }
+
+    loop_pts = ClampLoopPoints(decoder.getLoopPoints(), frames);
+}
+
+bool BufferImpl::uploadStaged(ALenum format, StagedSamples &staged,
+                              std::pair<uint64_t,uint64_t> loop_pts, size_t maxbytes)
+{
+    if(!staged.mAllocated)
+    {
+        for(ArrayView<ALbyte> piece : staged.mPieces)
+            mContext.send(&MessageHandler::bufferLoading,
+                mName, mChannelConfig, mSampleType, mFrequency, piece
+            );
+
+        // Allocate the storage for the slices to go in, unless it can all be
+        // given now.
+        const ALbyte *data = nullptr;
+        if(!canUploadSlices() || (staged.mPieces.size() == 1 && staged.mSize <= maxbytes))
+        {
+            data = staged.mPieces.front().data();
+            staged.mPiece = staged.mPieces.size();
+            staged.mOffset = staged.mSize;
+        }
+        alBufferData(mId, format, data, static_cast<ALsizei>(staged.mSize), mFrequency);
+        if(mContext.hasExtension(AL::SOFT_loop_points))
+        {
+            ALint pts[2]{(ALint)loop_pts.first, (ALint)loop_pts.second};
+            alBufferiv(mId, AL_LOOP_POINTS_SOFT, pts);
+        }
+        staged.mAllocated = true;
+    }
+    else
+    {
+        ArrayView<ALbyte> piece = staged.mPieces[staged.mPiece].slice(staged.mPieceOffset);
+        const size_t frame_size = FramesToBytes(1, mChannelConfig, mSampleType);
+        size_t len = std::min(piece.size(), std::max<size_t>(maxbytes/frame_size, 1)*frame_size);
+        mContext.alBufferSubDataSOFT(mId, format, piece.data(), static_cast<ALsizei>(staged.mOffset),
+                                     static_cast<ALsizei>(len));
+        staged.mOffset += len;
+        staged.mPieceOffset += len;
+        if(len == piece.size())
+        {
+            ++staged.mPiece;
+            staged.mPieceOffset = 0;
+        }
+    }
+    if(staged.mPiece < staged.mPieces.size())
+        return false;
+
+    setLoaded(BytesToFrames(static_cast<ALuint>(staged.mSize), mChannelConfig, mSampleType),
+              staged.mSize, loop_pts);
+    return true;
+}
+
+
+void BufferImpl::setLoaded(ALuint frames, size_t bytes, std::pair<uint64_t,uint64_t> loop_pts)
+{
+    // The storage size may differ from the given data, so ask OpenAL for it
+    // once here.
+    ALint size = -1;
+    alGetBufferi(mId, AL_SIZE, &size);
+    mSize = (size >= 0) ? static_cast<ALuint>(size) : static_cast<ALuint>(bytes);
+    mLength = frames;
+    if(mContext.hasExtension(AL::SOFT_loop_points))
+        mLoopPts = std::make_pair(static_cast<ALuint>(loop_pts.first),
+                                  static_cast<ALuint>(loop_pts.second));
+    else
+        mLoopPts = std::make_pair(0u, frames);
 }
 
 
@@ -160,66 +315,53 @@ DECL_THUNK0(ALuint, Buffer, getLength, const)
 ALuint BufferImpl::getLength() const
 {
     CheckContext(mContext);
-
-    alGetError();
-    ALint size=-1, bits=-1, chans=-1;
-    alGetBufferi(mId, AL_SIZE, &size);
-    alGetBufferi(mId, AL_BITS, &bits);
-    alGetBufferi(mId, AL_CHANNELS, &chans);
-    throw_al_error("Buffer format error");
-    return size / chans * 8 / bits;
+    return mLength;
 }
 
 DECL_THUNK0(ALuint, Buffer, getSize, const)
 ALuint BufferImpl::getSize() const
 {
     CheckContext(mContext);
-
-    alGetError();
-    ALint size = -1;
-    alGetBufferi(mId, AL_SIZE, &size);
-    throw_al_error("Buffer size error");
-    return size;
+    return mSize;
 }
 
 DECL_THUNK2(void, Buffer, setLoopPoints,, ALuint, ALuint)
 void BufferImpl::setLoopPoints(ALuint start, ALuint end)
 {
-    ALuint length = getLength();
+    CheckContext(mContext);
 
     if(UNLIKELY(!mSources.empty()))
         throw std::runtime_error("Buffer is in use");
 
     if(!mContext.hasExtension(AL::SOFT_loop_points))
     {
-        if(start != 0 || end != length)
+        if(start != 0 || end != mLength)
             throw std::runtime_error("Loop points not supported");
         return;
     }
 
-    if(UNLIKELY(start >= end || end > length))
+    if(UNLIKELY(start >= end || end > mLength))
         throw std::out_of_range("Loop points out of range");
 
     alGetError();
     ALint pts[2]{(ALint)start, (ALint)end};
     alBufferiv(mId, AL_LOOP_POINTS_SOFT, pts);
     throw_al_error("Failed to set loop points");
+    mLoopPts = std::make_pair(start, end);
 }
 
 DECL_THUNK0(ALuintPair, Buffer, getLoopPoints, const)
 std::pair<ALuint,ALuint> BufferImpl::getLoopPoints() const
 {
     CheckContext(mContext);
+    return mLoopPts;
+}
 
-    if(!mContext.hasExtension(AL::SOFT_loop_points))
-        return std::make_pair(0, getLength());
-
-    alGetError();
-    ALint pts[2]{-1,-1};
-    alGetBufferiv(mId, AL_LOOP_POINTS_SOFT, pts);
-    throw_al_error("Failed to get loop points");
-
-    return std::make_pair(pts[0], pts[1]);
+DECL_THUNK0(BufferInfo, Buffer, getInfo, const)
+BufferInfo BufferImpl::getInfo() const
+{
+    CheckContext(mContext);
+    return BufferInfo{mLength, mSize, mFrequency, mChannelConfig, mSampleType, mLoopPts};
 }
 
 DECL_THUNK0(ALuint, Buffer, getFrequency, const)
@@ -313,6 +455,15 @@ ALURE_API ALuint BytesToFrames(ALuint bytes, ChannelConfig chans, SampleType typ
 }
 
 
+std::pair<uint64_t,uint64_t> ClampLoopPoints(std::pair<uint64_t,uint64_t> loop_pts, ALuint frames)
+{
+    if(loop_pts.first >= loop_pts.second)
+        return std::make_pair(0, frames);
+    loop_pts.second = std::min<uint64_t>(loop_pts.second, frames);
+    loop_pts.first = std::min<uint64_t>(loop_pts.first, loop_pts.second-1);
+    return loop_pts;
+}
+
 ALenum GetFormat(ChannelConfig chans, SampleType type)
 {
     ContextImpl *ctx = ContextImpl::GetCurrent();
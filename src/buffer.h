@@ -2,12 +2,32 @@
 #define BUFFER_H
 
 #include <algorithm>
+#include <atomic>
 
 #include "main.h"
 
 namespace alure {
 
 ALenum GetFormat(ChannelConfig chans, SampleType type);
+// Limits a decoder's loop points to the frames loaded, defaulting to all of
+// them if they're empty.
+std::pair<uint64_t,uint64_t> ClampLoopPoints(std::pair<uint64_t,uint64_t> loop_pts, ALuint frames);
+
+// Sample data decoded for a buffer, waiting to be given to OpenAL in slices.
+// The data is split into pieces, each either a staging block or a view of the
+// samples read directly from the decoder.
+struct StagedSamples {
+    Vector<Vector<ALbyte>> mBlocks;
+    Vector<ArrayView<ALbyte>> mPieces;
+    size_t mSize{0};
+
+    // How far the upload has gotten, as the piece being uploaded, the bytes
+    // of it already uploaded, and the bytes of all pieces already uploaded.
+    bool mAllocated{false};
+    size_t mPiece{0};
+    size_t mPieceOffset{0};
+    size_t mOffset{0};
+};
 
 class BufferImpl {
     ContextImpl &mContext;
@@ -17,7 +37,16 @@ class BufferImpl {
     ChannelConfig mChannelConfig;
     SampleType mSampleType;
 
+    // Recorded when the sample data is loaded, so queries don't need to go to
+    // OpenAL.
+    ALuint mLength{0};
+    ALuint mSize{0};
+    std::pair<ALuint,ALuint> mLoopPts{0, 0};
+
     Vector<Source> mSources;
+    // Plays queued from other threads, not yet made. The buffer can't be
+    // evicted or removed while there are any.
+    std::atomic<ALuint> mPendingUses{0};
 
     const String mName;
     size_t mNameHash;
@@ -41,7 +70,34 @@ public:
         if(iter != mSources.cend()) mSources.erase(iter);
     }
 
-    void load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, ContextImpl *ctx);
+    // Decodes the buffer's sample data, and returns a view of it. The samples
+    // are either decoded into data, a block from the context's staging pool
+    // to be released back to it, or (if data is left empty) read directly
+    // from the decoder, in which case they're only valid as long as the
+    // decoder is. This does not touch OpenAL, so it may be called from any
+    // thread.
+    ArrayView<ALbyte> decode(ALuint frames, Decoder &decoder, Vector<ALbyte> &data,
+                             std::pair<uint64_t,uint64_t> &loop_pts) const;
+    void upload(ALenum format, ArrayView<ALbyte> samples, std::pair<uint64_t,uint64_t> loop_pts,
+                ContextImpl *ctx);
+
+    // Whether the sample data can be given to OpenAL in slices.
+    bool canUploadSlices() const;
+    // Decodes the buffer's sample data for uploading in slices, into staging
+    // blocks from the context's pool (or as one piece if it can't be uploaded
+    // in slices). Like decode, this may be called from any thread.
+    void decodeStaged(ALuint frames, Decoder &decoder, StagedSamples &staged,
+                      std::pair<uint64_t,uint64_t> &loop_pts) const;
+    // Does one step of giving the staged sample data to OpenAL: allocating the
+    // buffer's storage, or uploading a slice of up to maxbytes (rounded to
+    // whole frames). Data that can't be uploaded in slices is given all at
+    // once, as is data that fits in one slice. Returns true once all of it
+    // has been given. Must be called with the context current.
+    bool uploadStaged(ALenum format, StagedSamples &staged, std::pair<uint64_t,uint64_t> loop_pts,
+                      size_t maxbytes);
+    // Records the length, size, and loop points of the buffer's newly loaded
+    // sample data. Must be called with the context current.
+    void setLoaded(ALuint frames, size_t bytes, std::pair<uint64_t,uint64_t> loop_pts);
 
     ALuint getLength() const;
 
@@ -50,17 +106,36 @@ public:
     SampleType getSampleType() const { return mSampleType; }
 
     ALuint getSize() const;
+    // The size recorded by setLoaded, without checking the context.
+    ALuint getLoadedSize() const { return mSize; }
 
     void setLoopPoints(ALuint start, ALuint end);
     std::pair<ALuint,ALuint> getLoopPoints() const;
 
+    BufferInfo getInfo() const;
+
     Vector<Source> getSources() const { return mSources; }
 
     StringView getName() const { return mName; }
 
     size_t getSourceCount() const { return mSources.size(); }
 
+    void addPendingUse() { mPendingUses.fetch_add(1, std::memory_order_acq_rel); }
+    void removePendingUse() { mPendingUses.fetch_sub(1, std::memory_order_acq_rel); }
+    bool hasPendingUses() const { return mPendingUses.load(std::memory_order_acquire) > 0; }
+
     size_t getNameHash() const { return mNameHash; }
+
+    // Links for the context's least-recently-used buffer list, and the amount
+    // of memory the buffer is accounted for in the cache. Managed by the
+    // context.
+    BufferImpl *mLruPrev{nullptr};
+    BufferImpl *mLruNext{nullptr};
+    size_t mCacheSize{0};
+
+    // Set while the buffer's sample data is being staged for update to
+    // upload. Managed by the context.
+    bool mStaged{false};
 };
 
 } // namespace alure
@@ -0,0 +1,117 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+
+#include "main.h"
+
+#include "ringbuffer.h"
+
+namespace alure {
+
+// A call on a source, source group, or the listener, queued by another thread
+// to be made during Context::update.
+struct Command {
+    enum Op : ALubyte {
+        SourcePlay,
+        SourceStop,
+        SourcePause,
+        SourceResume,
+        SourceFadeOut,
+        SourceFadeIn,
+        SourceOffset,
+        SourceLooping,
+        SourcePitch,
+        SourceGain,
+        SourcePosition,
+        SourceVelocity,
+        SourceDirection,
+        SourceOrientation,
+
+        GroupGain,
+        GroupPitch,
+        GroupPauseAll,
+        GroupResumeAll,
+        GroupStopAll,
+
+        ListenerGain,
+        ListenerPosition,
+        ListenerVelocity,
+        ListenerOrientation,
+    };
+    struct Fade {
+        ALfloat mGain;
+        FadeCurve mCurve;
+        std::chrono::milliseconds::rep mDuration;
+    };
+
+    Op mOp;
+    // The SourceImpl, SourceGroupImpl, or ListenerImpl called on.
+    void *mTarget;
+    union {
+        ALfloat mValues[6];
+        uint64_t mOffset;
+        BufferImpl *mBuffer;
+        Fade mFade;
+    };
+
+    Command() = default;
+    Command(Op op, void *target) : mOp(op), mTarget(target) { }
+    Command(Op op, void *target, const ALfloat *values, size_t count) : mOp(op), mTarget(target)
+    { std::copy(values, values+count, mValues); }
+};
+
+// The commands queued by one thread. Commands that don't fit in the ring
+// buffer go to a locked list, as do any after them until it's emptied, so
+// they're still made in order. The queue is retired when its thread exits, to
+// be freed once it's emptied.
+class CommandQueue {
+    static constexpr size_t QueueSize = 256;
+
+    RingBuffer<Command> mCommands{QueueSize};
+    std::atomic<bool> mOverflowed{false};
+    std::mutex mOverflowMutex;
+    Vector<Command> mOverflow;
+    std::atomic<bool> mRetired{false};
+
+public:
+    // Called by the queue's thread as it exits, after its last push.
+    void retire() { mRetired.store(true, std::memory_order_release); }
+    // Once retired, a queue that's empty stays empty, so check this first.
+    bool isRetired() const { return mRetired.load(std::memory_order_acquire); }
+
+    bool empty() const
+    { return mCommands.empty() && !mOverflowed.load(std::memory_order_acquire); }
+
+    // Called by the queue's thread.
+    void push(const Command &cmd)
+    {
+        if(LIKELY(!mOverflowed.load(std::memory_order_acquire)) && mCommands.push(cmd))
+            return;
+        std::lock_guard<std::mutex> lock(mOverflowMutex);
+        mOverflow.push_back(cmd);
+        mOverflowed.store(true, std::memory_order_release);
+    }
+
+    // Called by the thread making the calls. Gets the next queued command.
+    // Once the ring buffer is empty, any that overflowed are moved to
+    // overflow, which should be empty, to be made before popping more.
+    bool pop(Command &cmd, Vector<Command> &overflow)
+    {
+        if(mCommands.pop(cmd))
+            return true;
+        if(!mOverflowed.load(std::memory_order_acquire))
+            return false;
+        std::lock_guard<std::mutex> lock(mOverflowMutex);
+        std::swap(overflow, mOverflow);
+        mOverflowed.store(false, std::memory_order_release);
+        return false;
+    }
+};
+
+} // namespace alure
+
+#endif /* COMMAND_H */
@@ -6,6 +6,7 @@
 #include <stdexcept>
 #include <algorithm>
 #include <functional>
+#include <iterator>
 #include <memory>
 #include <iostream>
 #include <fstream>
@@ -41,55 +42,44 @@
 #include "auxeffectslot.h"
 #include "effect.h"
 #include "sourcegroup.h"
+#include "hashindex.h"
+#include "bank.h"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
-namespace std {
-
-// Implements a FNV-1a hash for StringView. NOTE: This is *NOT* guaranteed
-// compatible with std::hash<String>! The standard does not give any specific
-// hash implementation, nor a way for applications to access the same hash
-// function as std::string (short of copying into a string and hashing that).
-// So if you need Strings and StringViews to result in the same hash for the
-// same set of characters, hash StringViews created from the Strings.
-template<>
-struct hash<alure::StringView> {
-    size_t operator()(const alure::StringView &str) const noexcept
-    {
-        using traits_type = alure::StringView::traits_type;
-
-        if /*constexpr*/ (sizeof(size_t) == 8)
-        {
-            static constexpr size_t hash_offset = 0xcbf29ce484222325;
-            static constexpr size_t hash_prime = 0x100000001b3;
+namespace {
 
-            size_t val = hash_offset;
-            for(auto ch : str)
-                val = (val^traits_type::to_int_type(ch)) * hash_prime;
-            return val;
-        }
-        else
-        {
-            static constexpr size_t hash_offset = 0x811c9dc5;
-            static constexpr size_t hash_prime = 0x1000193;
+// Global mutex to protect global context changes
+std::mutex gGlobalCtxMutex;
+// How many times a thread found it already held.
+std::atomic<uint64_t> gGlobalCtxContention{0};
 
-            size_t val = hash_offset;
-            for(auto ch : str)
-                val = (val^traits_type::to_int_type(ch)) * hash_prime;
-            return val;
-        }
+void LockCounted(std::unique_lock<std::mutex> &lock)
+{
+    if(UNLIKELY(!lock.try_lock()))
+    {
+        gGlobalCtxContention.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
     }
-};
-
 }
 
-namespace {
+std::unique_lock<std::mutex> LockGlobalCtx()
+{
+    std::unique_lock<std::mutex> lock(gGlobalCtxMutex, std::defer_lock);
+    LockCounted(lock);
+    return lock;
+}
 
-// Global mutex to protect global context changes
-std::mutex gGlobalCtxMutex;
+// The smallest slice staged buffers are uploaded in.
+constexpr size_t MinUploadSlice = 16*1024;
 
 #ifdef _WIN32
 // Windows' std::ifstream fails with non-ANSI paths since the standard only
@@ -225,6 +215,72 @@ public:
 };
 #endif
 
+// A streambuf for reading a block of memory. The whole block is the get area,
+// so reading is a simple copy and seeking just moves the read pointer.
+class MemoryStreamBuf final : public std::streambuf {
+    alure::SharedPtr<void> mOwner;
+
+    pos_type seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode) override
+    {
+        if((mode&std::ios_base::out) || !(mode&std::ios_base::in))
+            return traits_type::eof();
+
+        switch(whence)
+        {
+            case std::ios_base::beg:
+                break;
+            case std::ios_base::cur:
+                offset += gptr() - eback();
+                break;
+            case std::ios_base::end:
+                offset += egptr() - eback();
+                break;
+            default:
+                return traits_type::eof();
+        }
+        if(offset < 0 || offset > egptr()-eback())
+            return traits_type::eof();
+
+        setg(eback(), eback()+offset, egptr());
+        return offset;
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode mode) override
+    { return seekoff(pos, std::ios_base::beg, mode); }
+
+public:
+    MemoryStreamBuf(alure::ArrayView<char> data, alure::SharedPtr<void> owner)
+      : mOwner(std::move(owner))
+    {
+        // The get area takes non-const pointers, but is never written to.
+        char *start = const_cast<char*>(data.data());
+        setg(start, start, start+data.size());
+    }
+
+    alure::ArrayView<char> getMemory() const noexcept
+    { return alure::ArrayView<char>(eback(), egptr()-eback()); }
+};
+
+// Memory streams are identified by a stream word pointing to their streambuf,
+// since RTTI may not be available to check the type.
+int GetMemoryStreamIndex()
+{
+    static const int index = std::ios_base::xalloc();
+    return index;
+}
+
+class MemoryStream final : public std::istream {
+    MemoryStreamBuf mStreamBuf;
+
+public:
+    MemoryStream(alure::ArrayView<char> data, alure::SharedPtr<void> owner)
+      : std::istream(nullptr), mStreamBuf(data, std::move(owner))
+    {
+        init(&mStreamBuf);
+        pword(GetMemoryStreamIndex()) = &mStreamBuf;
+    }
+};
+
 using DecoderEntryPair = std::pair<alure::String,alure::UniquePtr<alure::DecoderFactory>>;
 const DecoderEntryPair sDefaultDecoders[] = {
 #ifdef HAVE_WAVE
@@ -247,14 +303,20 @@ const DecoderEntryPair sDefaultDecoders[] = {
 #endif
 };
 alure::Vector<DecoderEntryPair> sDecoders;
+std::atomic<bool> sDecoderFloatOutput{false};
 
 
 alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> &file,
-                                   alure::ArrayView<DecoderEntryPair> decoders)
+                                   alure::ArrayView<DecoderEntryPair> decoders,
+                                   alure::DecoderFactory *skip, ALuint &attempts)
 {
     while(!decoders.empty())
     {
         alure::DecoderFactory *factory = decoders.front().second.get();
+        decoders = decoders.slice(1);
+        if(factory == skip) continue;
+
+        ++attempts;
         auto decoder = factory->createDecoder(file);
         if(decoder) return std::move(decoder);
 
@@ -262,19 +324,68 @@ alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> &file,
             return std::make_exception_ptr(
                 std::runtime_error("Failed to rewind file for the next decoder factory")
             );
-
-        decoders = decoders.slice(1);
     }
 
     return alure::SharedPtr<alure::Decoder>(nullptr);
 }
 
-static alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> file)
+alure::DecoderFactory *FindSignatureFactory(alure::ArrayView<DecoderEntryPair> decoders,
+                                            alure::ArrayView<char> header)
+{
+    for(const DecoderEntryPair &entry : decoders)
+    {
+        if(entry.second->checkSignature(header))
+            return entry.second.get();
+    }
+    return nullptr;
+}
+
+// Gives the file to the first of the decoders that recognizes its signature,
+// then tries the rest in turn.
+alure::DecoderOrExceptT GetSignatureDecoder(alure::UniquePtr<std::istream> &file,
+                                            alure::ArrayView<DecoderEntryPair> decoders,
+                                            alure::ArrayView<char> header, ALuint &attempts)
+{
+    alure::DecoderFactory *factory = FindSignatureFactory(decoders, header);
+    if(factory)
+    {
+        ++attempts;
+        if(auto decoder = factory->createDecoder(file))
+            return decoder;
+        if(!file || !(file->clear(),file->seekg(0)))
+            return std::make_exception_ptr(
+                std::runtime_error("Failed to rewind file for the next decoder factory")
+            );
+    }
+    return GetDecoder(file, decoders, factory, attempts);
+}
+
+static alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> file, ALuint &attempts)
 {
-    auto decoder = GetDecoder(file, sDecoders);
+    // Sound bank entries have their format stored with them, so check for them
+    // before trying the decoder factories.
+    if(auto bankdec = alure::CreateBankDecoder(file))
+    {
+        ++attempts;
+        return bankdec;
+    }
+    if(!file)
+        return std::make_exception_ptr(std::runtime_error("Failed to decode sound bank entry"));
+
+    // Read the start of the file once to check signatures with. Registered
+    // factories all get a chance before the internal ones, so an internal
+    // factory recognizing the file can't take it from a registered one.
+    char header[alure::DecoderSignatureSize];
+    file->read(header, sizeof(header));
+    size_t header_len = static_cast<size_t>(file->gcount());
+    if(!(file->clear(),file->seekg(0)))
+        return std::make_exception_ptr(std::runtime_error("Failed to rewind file"));
+
+    alure::ArrayView<char> headerview(header, header_len);
+    auto decoder = GetSignatureDecoder(file, sDecoders, headerview, attempts);
     if(std::holds_alternative<std::exception_ptr>(decoder)) return decoder;
     if(std::get<alure::SharedPtr<alure::Decoder>>(decoder)) return decoder;
-    decoder = GetDecoder(file, sDefaultDecoders);
+    decoder = GetSignatureDecoder(file, sDefaultDecoders, headerview, attempts);
     if(std::holds_alternative<std::exception_ptr>(decoder)) return decoder;
     if(std::get<alure::SharedPtr<alure::Decoder>>(decoder)) return decoder;
     return (decoder = std::make_exception_ptr(std::runtime_error("No decoder found")));
@@ -294,13 +405,83 @@ class DefaultFileIOFactory final : public alure::FileIOFactory {
 };
 DefaultFileIOFactory sDefaultFileFactory;
 
+class MappedFileIOFactory final : public alure::FileIOFactory {
+    // Files that can't be mapped are opened with standard I/O.
+    static alure::UniquePtr<std::istream> openFallback(const alure::String &name) noexcept
+    { return static_cast<alure::FileIOFactory&>(sDefaultFileFactory).openFile(name); }
+
+    alure::UniquePtr<std::istream> openFile(const alure::String &name) noexcept override
+    {
+#ifdef _WIN32
+        alure::Vector<wchar_t> wname;
+        int wnamelen = MultiByteToWideChar(CP_UTF8, 0, name.c_str(), -1, NULL, 0);
+        if(wnamelen <= 0) return nullptr;
+        wname.resize(wnamelen);
+        MultiByteToWideChar(CP_UTF8, 0, name.c_str(), -1, wname.data(), wnamelen);
+
+        HANDLE file = CreateFileW(wname.data(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return nullptr;
+
+        LARGE_INTEGER fsize;
+        if(!GetFileSizeEx(file, &fsize) || static_cast<uint64_t>(fsize.QuadPart) >
+                                           std::numeric_limits<size_t>::max())
+        {
+            CloseHandle(file);
+            return openFallback(name);
+        }
+        size_t size = static_cast<size_t>(fsize.QuadPart);
+        if(size == 0)
+        {
+            CloseHandle(file);
+            return alure::MakeUnique<MemoryStream>(alure::ArrayView<char>(), nullptr);
+        }
+
+        HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if(!mapping) return openFallback(name);
+        void *ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if(!ptr) return openFallback(name);
+
+        alure::SharedPtr<void> owner(ptr, [](void *p) { UnmapViewOfFile(p); });
+#else
+        int fd = open(name.c_str(), O_RDONLY);
+        if(fd == -1) return nullptr;
+
+        // Only regular files can be mapped.
+        struct stat st;
+        if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+           static_cast<uint64_t>(st.st_size) > std::numeric_limits<size_t>::max())
+        {
+            close(fd);
+            return openFallback(name);
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        if(size == 0)
+        {
+            close(fd);
+            return alure::MakeUnique<MemoryStream>(alure::ArrayView<char>(), nullptr);
+        }
+
+        void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(ptr == MAP_FAILED) return openFallback(name);
+
+        alure::SharedPtr<void> owner(ptr, [size](void *p) { munmap(p, size); });
+#endif
+        alure::ArrayView<char> data(static_cast<const char*>(ptr), size);
+        return alure::MakeUnique<MemoryStream>(data, std::move(owner));
+    }
+};
+
 alure::UniquePtr<alure::FileIOFactory> sFileFactory;
 
 }
 
 namespace alure {
 
-static inline void CheckContext(const ContextImpl *ctx)
+static inline void CheckCurrentContext(const ContextImpl *ctx)
 {
     auto count = ContextImpl::sContextSetCount.load(std::memory_order_acquire);
     if(UNLIKELY(count != ctx->mContextSetCounter))
@@ -311,6 +492,12 @@ static inline void CheckContext(const ContextImpl *ctx)
     }
 }
 
+static inline void CheckContext(const ContextImpl *ctx)
+{
+    CheckCurrentContext(ctx);
+    ctx->checkCallThread();
+}
+
 std::variant<std::monostate,uint64_t> ParseTimeval(StringView strval, double srate) noexcept
 {
     try {
@@ -380,7 +567,9 @@ std::variant<std::monostate,uint64_t> ParseTimeval(StringView strval, double sra
 
 
 Decoder::~Decoder() { }
+ArrayView<ALbyte> Decoder::readDirect(ALuint) noexcept { return {}; }
 DecoderFactory::~DecoderFactory() { }
+bool DecoderFactory::checkSignature(ArrayView<char>) noexcept { return false; }
 
 void RegisterDecoder(StringView name, UniquePtr<DecoderFactory> factory)
 {
@@ -409,6 +598,12 @@ UniquePtr<DecoderFactory> UnregisterDecoder(StringView name) noexcept
     return factory;
 }
 
+void SetDecoderFloatOutput(bool enable) noexcept
+{ sDecoderFloatOutput.store(enable, std::memory_order_relaxed); }
+
+bool GetDecoderFloatOutput() noexcept
+{ return sDecoderFloatOutput.load(std::memory_order_relaxed); }
+
 
 FileIOFactory::~FileIOFactory() { }
 
@@ -425,6 +620,20 @@ FileIOFactory &FileIOFactory::get() noexcept
     return sDefaultFileFactory;
 }
 
+UniquePtr<FileIOFactory> CreateMappedFileIOFactory()
+{ return MakeUnique<MappedFileIOFactory>(); }
+
+UniquePtr<std::istream> CreateMemoryStream(ArrayView<char> data, SharedPtr<void> owner)
+{ return MakeUnique<MemoryStream>(data, std::move(owner)); }
+
+ArrayView<char> GetStreamMemory(std::istream &stream) noexcept
+{
+    void *buf = stream.pword(GetMemoryStreamIndex());
+    if(!buf || buf != stream.rdbuf())
+        return {};
+    return static_cast<MemoryStreamBuf*>(buf)->getMemory();
+}
+
 
 // Default message handler methods are no-ops.
 MessageHandler::~MessageHandler()
@@ -447,11 +656,23 @@ void MessageHandler::bufferLoading(StringView, ChannelConfig, SampleType, ALuint
 {
 }
 
+void MessageHandler::bufferLoaded(StringView, const BufferLoadTiming&) noexcept
+{
+}
+
 String MessageHandler::resourceNotFound(StringView) noexcept
 {
     return String();
 }
 
+void MessageHandler::bufferEvicted(StringView, size_t) noexcept
+{
+}
+
+void MessageHandler::decoderProbed(StringView, ALuint) noexcept
+{
+}
+
 
 template<typename T>
 static inline void LoadALFunc(T **func, const char *name)
@@ -509,6 +730,17 @@ static void LoadSourceLatency(ContextImpl *ctx)
     LoadALFunc(&ctx->alGetSourcedvSOFT, "alGetSourcedvSOFT");
 }
 
+static void LoadBufferSubData(ContextImpl *ctx)
+{
+    LoadALFunc(&ctx->alBufferSubDataSOFT, "alBufferSubDataSOFT");
+}
+
+static void LoadEvents(ContextImpl *ctx)
+{
+    LoadALFunc(&ctx->alEventControlSOFT, "alEventControlSOFT");
+    LoadALFunc(&ctx->alEventCallbackSOFT, "alEventCallbackSOFT");
+}
+
 static const struct {
     AL extension;
     const char name[32];
@@ -528,6 +760,8 @@ static const struct {
     { AL::SOFT_source_latency,    "AL_SOFT_source_latency",    LoadSourceLatency },
     { AL::SOFT_source_resampler,  "AL_SOFT_source_resampler",  LoadSourceResampler },
     { AL::SOFT_source_spatialize, "AL_SOFT_source_spatialize", LoadNothing },
+    { AL::SOFT_buffer_sub_data,   "AL_SOFT_buffer_sub_data",   LoadBufferSubData },
+    { AL::SOFT_events,            "AL_SOFT_events",            LoadEvents },
 
     { AL::EXT_disconnect, "ALC_EXT_disconnect", LoadNothing },
 
@@ -540,10 +774,11 @@ ContextImpl *ContextImpl::sCurrentCtx = nullptr;
 thread_local ContextImpl *ContextImpl::sThreadCurrentCtx = nullptr;
 
 std::atomic<uint64_t> ContextImpl::sContextSetCount{0};
+std::atomic<uint64_t> ContextImpl::sNextSerial{1};
 
 void ContextImpl::MakeCurrent(ContextImpl *context)
 {
-    std::unique_lock<std::mutex> ctxlock(gGlobalCtxMutex);
+    std::unique_lock<std::mutex> ctxlock(LockGlobalCtx());
 
     if(alcMakeContextCurrent(context ? context->getALCcontext() : nullptr) == ALC_FALSE)
         throw std::runtime_error("Call to alcMakeContextCurrent failed");
@@ -564,9 +799,13 @@ void ContextImpl::MakeCurrent(ContextImpl *context)
     {
         ctxlock.unlock();
         context->mWakeThread.notify_all();
+        context->mWakeStream.notify_all();
     }
 }
 
+uint64_t ContextImpl::GetLockContention()
+{ return gGlobalCtxContention.load(std::memory_order_relaxed); }
+
 void ContextImpl::MakeThreadCurrent(ContextImpl *context)
 {
     if(!DeviceManagerImpl::SetThreadContext)
@@ -596,66 +835,206 @@ void ContextImpl::setupExts()
             entry.loader(this);
         }
     }
+
+    // Have OpenAL say when sources stop, instead of asking each update.
+    if(hasExtension(AL::SOFT_events) && alEventControlSOFT && alEventCallbackSOFT)
+    {
+        static const ALenum types[] = { AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT };
+        alGetError();
+        alEventCallbackSOFT(&ContextImpl::EventCallback, this);
+        alEventControlSOFT(1, types, AL_TRUE);
+        mStopEventsEnabled = (alGetError() == AL_NO_ERROR);
+    }
+}
+
+void AL_APIENTRY ContextImpl::EventCallback(ALenum eventType, ALuint object, ALuint param,
+    ALsizei, const ALchar*, void *userParam) noexcept
+{
+    if(eventType != AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT || param != AL_STOPPED)
+        return;
+    auto self = static_cast<ContextImpl*>(userParam);
+    if(!self->mStopEvents.push(object))
+        self->mStopEventsMissed.store(true, std::memory_order_release);
+}
+
+
+bool ContextImpl::waitForCurrent(std::unique_lock<std::mutex> &ctxlock,
+                                 std::condition_variable &cond)
+{
+    while(!mQuitThread.load(std::memory_order_acquire) &&
+          alcGetCurrentContext() != getALCcontext())
+        cond.wait(ctxlock);
+    return alcGetCurrentContext() == getALCcontext();
 }
 
+std::mutex &ContextImpl::setBackgroundContext(std::mutex &private_mutex)
+{
+    // With a thread-local context, the thread doesn't depend on which context
+    // is current, so it only needs to guard against itself. Otherwise it has
+    // to hold the global lock while the context is current.
+    if(DeviceManagerImpl::SetThreadContext && mDevice.hasExtension(ALC::EXT_thread_local_context) &&
+       DeviceManagerImpl::SetThreadContext(getALCcontext()) == ALC_TRUE)
+        return private_mutex;
+    return gGlobalCtxMutex;
+}
 
 void ContextImpl::backgroundProc()
 {
-    if(DeviceManagerImpl::SetThreadContext && mDevice.hasExtension(ALC::EXT_thread_local_context))
-        DeviceManagerImpl::SetThreadContext(getALCcontext());
+    std::mutex threadmutex;
+    std::unique_lock<std::mutex> ctxlock(setBackgroundContext(threadmutex), std::defer_lock);
+    LockCounted(ctxlock);
+    while(!mQuitThread.load(std::memory_order_acquire))
+    {
+        // Upload one decoded buffer at a time. If the decode workers were all
+        // stopped, decode any jobs they left behind here.
+        std::unique_lock<std::mutex> decodelock(mDecodeMutex);
+        if(!mDecodedJobs.empty() || (mDecodeThreadCount == 0 && !mDecodeJobs.empty()))
+        {
+            bool decoded = !mDecodedJobs.empty();
+            auto &jobs = decoded ? mDecodedJobs : mDecodeJobs;
+            DecodeJob job = std::move(jobs.front());
+            jobs.pop_front();
+            decodelock.unlock();
+
+            if(!decoded)
+            {
+                // Decoding doesn't need the context, so don't hold the global
+                // context lock while doing it. Staged jobs don't need it
+                // after, either.
+                ctxlock.unlock();
+                decodeJob(job);
+                if(job.mStaged) finishJob(job);
+                LockCounted(ctxlock);
+                if(!waitForCurrent(ctxlock, mWakeThread))
+                    break;
+                if(job.mStaged) continue;
+            }
+            finishJob(job);
+            continue;
+        }
+
+        // With decode workers available, hand off all pending buffers to them
+        // at once. Only the upload needs to happen on this thread.
+        PendingPromise *lastpb = mPendingCurrent.load(std::memory_order_acquire);
+        if(mDecodeThreadCount > 0)
+        {
+            if(PendingPromise *pb = lastpb->mNext.load(std::memory_order_acquire))
+            {
+                do {
+                    mDecodeJobs.emplace_back(*pb);
+                    lastpb = pb;
+                } while((pb=lastpb->mNext.load(std::memory_order_acquire)) != nullptr);
+                mPendingCurrent.store(lastpb, std::memory_order_release);
+                decodelock.unlock();
+                mDecodeCond.notify_all();
+                continue;
+            }
+        }
+        decodelock.unlock();
+
+        // Only do one pending buffer at a time, so decoded buffers from the
+        // workers don't wait behind several large buffers being loaded here.
+        if(PendingPromise *pb = lastpb->mNext.load(std::memory_order_relaxed))
+        {
+            DecodeJob job(*pb);
+            mPendingCurrent.store(pb, std::memory_order_release);
+
+            ctxlock.unlock();
+            decodeJob(job);
+            if(job.mStaged) finishJob(job);
+            LockCounted(ctxlock);
+            if(!waitForCurrent(ctxlock, mWakeThread))
+                break;
+
+            if(!job.mStaged) finishJob(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> wakelock(mWakeMutex);
+        decodelock.lock();
+        bool decode_idle = mDecodedJobs.empty() && (mDecodeThreadCount > 0 || mDecodeJobs.empty());
+        decodelock.unlock();
+        if(!mQuitThread.load(std::memory_order_acquire) && decode_idle &&
+           lastpb->mNext.load(std::memory_order_acquire) == nullptr)
+        {
+            ctxlock.unlock();
+            mWakeThread.wait(wakelock);
+            wakelock.unlock();
+
+            LockCounted(ctxlock);
+            waitForCurrent(ctxlock, mWakeThread);
+        }
+    }
+    ctxlock.unlock();
+
+    if(DeviceManagerImpl::SetThreadContext)
+        DeviceManagerImpl::SetThreadContext(nullptr);
+}
+
+void ContextImpl::streamProc()
+{
+    std::mutex threadmutex;
+    std::unique_lock<std::mutex> ctxlock(setBackgroundContext(threadmutex), std::defer_lock);
 
     std::chrono::steady_clock::time_point basetime = std::chrono::steady_clock::now();
     std::chrono::milliseconds waketime(0);
-    std::unique_lock<std::mutex> ctxlock(gGlobalCtxMutex);
+    LockCounted(ctxlock);
     while(!mQuitThread.load(std::memory_order_acquire))
     {
+        // Sleep until the earliest stream needs refilling, as determined by
+        // how much it has left to play.
+        auto refill_delay = std::chrono::nanoseconds::max();
         {
             std::lock_guard<std::mutex> srclock(mSourceStreamMutex);
             mStreamingSources.erase(
                 std::remove_if(mStreamingSources.begin(), mStreamingSources.end(),
-                    [](SourceImpl *source) -> bool
-                    { return !source->updateAsync(); }
+                    [&refill_delay](SourceImpl *source) -> bool
+                    {
+                        std::chrono::nanoseconds delay;
+                        if(!source->updateAsync(delay)) return true;
+                        refill_delay = std::min(refill_delay, delay);
+                        return false;
+                    }
                 ), mStreamingSources.end()
             );
         }
 
-        // Only do one pending buffer at a time. In case there's several large
-        // buffers to load, we still need to process streaming sources so they
-        // don't underrun.
-        PendingPromise *lastpb = mPendingCurrent.load(std::memory_order_acquire);
-        if(PendingPromise *pb = lastpb->mNext.load(std::memory_order_relaxed))
-        {
-            pb->mBuffer->load(pb->mFrames, pb->mFormat, std::move(pb->mDecoder), this);
-            pb->mPromise.set_value(Buffer(pb->mBuffer));
-            Promise<Buffer>().swap(pb->mPromise);
-            mPendingCurrent.store(pb, std::memory_order_release);
-            continue;
-        }
-
         std::unique_lock<std::mutex> wakelock(mWakeMutex);
-        if(!mQuitThread.load(std::memory_order_acquire) && lastpb->mNext.load(std::memory_order_acquire) == nullptr)
+        if(!mQuitThread.load(std::memory_order_acquire))
         {
             ctxlock.unlock();
 
+            auto now = std::chrono::steady_clock::now() - basetime;
+            auto deadline = std::chrono::steady_clock::time_point::max();
+            if(refill_delay != std::chrono::nanoseconds::max())
+            {
+                // Don't spin on streams that are about to run out.
+                refill_delay = std::max<std::chrono::nanoseconds>(refill_delay,
+                                                                  std::chrono::milliseconds(1));
+                deadline = basetime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    now + refill_delay
+                );
+            }
+
             std::chrono::milliseconds interval = mWakeInterval.load(std::memory_order_relaxed);
-            if(interval.count() == 0)
-                mWakeThread.wait(wakelock);
-            else
+            if(interval.count() != 0)
             {
-                auto now = std::chrono::steady_clock::now() - basetime;
                 if(now > waketime)
                 {
                     auto mult = (now-waketime + interval-std::chrono::milliseconds(1)) / interval;
                     waketime += interval * mult;
                 }
-                mWakeThread.wait_until(wakelock, waketime + basetime);
+                deadline = std::min(deadline, waketime + basetime);
             }
+
+            if(deadline == std::chrono::steady_clock::time_point::max())
+                mWakeStream.wait(wakelock);
+            else
+                mWakeStream.wait_until(wakelock, deadline);
             wakelock.unlock();
 
-            ctxlock.lock();
-            while(!mQuitThread.load(std::memory_order_acquire) &&
-                  alcGetCurrentContext() != getALCcontext())
-                mWakeThread.wait(ctxlock);
+            LockCounted(ctxlock);
+            waitForCurrent(ctxlock, mWakeStream);
         }
     }
     ctxlock.unlock();
@@ -665,55 +1044,334 @@ void ContextImpl::backgroundProc()
 }
 
 
-ContextImpl::ContextImpl(DeviceImpl &device, ArrayView<AttributePair> attrs)
-  : mListener(this), mDevice(device), mIsConnected(true), mIsBatching(false)
+void ContextImpl::readAheadProc()
 {
-    ALCdevice *alcdev = mDevice.getALCdevice();
-    if(attrs.empty()) /* No explicit attributes. */
-        mContext.reset(alcCreateContext(alcdev, nullptr));
-    else
-        mContext.reset(alcCreateContext(alcdev, &attrs.front().mAttribute));
-    if(!mContext) throw alc_error(alcGetError(alcdev), "alcCreateContext failed");
+    Vector<SharedPtr<StreamReader>> readers;
+    std::unique_lock<std::mutex> lock(mReadAheadMutex);
+    while(!mQuitReadAhead.load(std::memory_order_acquire))
+    {
+        mReadAheads.erase(
+            std::remove_if(mReadAheads.begin(), mReadAheads.end(),
+                [](const SharedPtr<StreamReader> &reader) -> bool
+                { return reader->isDetached(); }
+            ), mReadAheads.end()
+        );
+        readers.assign(mReadAheads.begin(), mReadAheads.end());
+        uint64_t signal = mReadAheadSignal;
+        lock.unlock();
 
-    mSourceIds.reserve(256);
-    mPendingTail = mPendingHead = new PendingPromise();
-    mPendingCurrent.store(mPendingHead, std::memory_order_relaxed);
+        // Decode a chunk at a time for each stream, so they all stay ahead.
+        bool more;
+        do {
+            more = false;
+            for(const SharedPtr<StreamReader> &reader : readers)
+                more |= reader->fill();
+        } while(more && !mQuitReadAhead.load(std::memory_order_acquire));
+        readers.clear();
+
+        lock.lock();
+        if(signal == mReadAheadSignal && !mQuitReadAhead.load(std::memory_order_acquire))
+            mReadAheadCond.wait(lock);
+    }
 }
 
-ContextImpl::~ContextImpl()
+void ContextImpl::decodeProc()
 {
-    if(mThread.joinable())
+    std::unique_lock<std::mutex> lock(mDecodeMutex);
+    while(1)
     {
-        std::unique_lock<std::mutex> lock(mWakeMutex);
-        mQuitThread.store(true, std::memory_order_relaxed);
+        while(!mQuitDecode && mDecodeJobs.empty())
+            mDecodeCond.wait(lock);
+        if(mQuitDecode) break;
+
+        DecodeJob job = std::move(mDecodeJobs.front());
+        mDecodeJobs.pop_front();
+        lock.unlock();
+
+        decodeJob(job);
+        if(job.mStaged)
+        {
+            finishJob(job);
+            lock.lock();
+            continue;
+        }
+
+        lock.lock();
+        mDecodedJobs.push_back(std::move(job));
         lock.unlock();
+
+        mWakeMutex.lock(); mWakeMutex.unlock();
         mWakeThread.notify_all();
-        mThread.join();
+
+        lock.lock();
     }
+}
 
-    PendingPromise *pb = mPendingTail;
-    while(pb)
-    {
-        PendingPromise *next = pb->mNext.load(std::memory_order_relaxed);
-        delete pb;
-        pb = next;
+void ContextImpl::decodeJob(DecodeJob &job)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool direct;
+    try {
+        if(job.mStaged)
+        {
+            job.mBuffer->decodeStaged(job.mFrames, *job.mDecoder, job.mStaging, job.mLoopPts);
+            direct = job.mStaging.mBlocks.empty() || job.mStaging.mBlocks.front().empty();
+        }
+        else
+        {
+            job.mSamples = job.mBuffer->decode(job.mFrames, *job.mDecoder, job.mData,
+                                               job.mLoopPts);
+            direct = job.mData.empty();
+        }
     }
-    mPendingCurrent.store(nullptr, std::memory_order_relaxed);
-    mPendingTail = mPendingHead = nullptr;
+    catch(...) {
+        // Leave the failure for whoever finishes the job to report.
+        job.mError = std::current_exception();
+        job.mDecoder = nullptr;
+        return;
+    }
+    job.mTiming.mDecodeTime = std::chrono::steady_clock::now() - start;
 
-    mEffectSlots.clear();
-    mEffects.clear();
+    // Samples read directly from the decoder need it kept until uploaded.
+    if(!direct) job.mDecoder = nullptr;
+}
 
-    std::lock_guard<std::mutex> ctxlock(gGlobalCtxMutex);
-    if(sCurrentCtx == this)
+void ContextImpl::finishJob(DecodeJob &job)
+{
+    if(job.mStaged)
     {
-        sCurrentCtx = nullptr;
-        sContextSetCount.fetch_add(1, std::memory_order_release);
+        // Staged jobs are left for update to upload.
+        std::lock_guard<std::mutex> lock(mDecodeMutex);
+        mStagedJobs.push_back(std::move(job));
+        mStagedCond.notify_all();
+        return;
     }
-    if(sThreadCurrentCtx == this)
+    if(job.mError)
     {
-        sThreadCurrentCtx = nullptr;
-        sContextSetCount.fetch_add(1, std::memory_order_release);
+        mStagingPool.release(std::move(job.mData));
+        addLoadedSize(job.mBuffer, 0);
+        job.mPromise.set_exception(job.mError);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    job.mBuffer->upload(job.mFormat, job.mSamples, job.mLoopPts, this);
+    auto end = std::chrono::steady_clock::now();
+    addLoadedSize(job.mBuffer, job.mBuffer->getLoadedSize());
+    mStagingPool.release(std::move(job.mData));
+    job.mTiming.mUploadTime = job.mTiming.mLongestStep = end - start;
+    job.mTiming.mUploadSteps = 1;
+    job.mTiming.mTotalTime = end - job.mStartTime;
+    send(&MessageHandler::bufferLoaded, job.mBuffer->getName(), job.mTiming);
+    job.mPromise.set_value(Buffer(job.mBuffer));
+}
+
+
+bool ContextImpl::uploadStagedStep(DecodeJob &job, size_t maxbytes)
+{
+    if(job.mError)
+    {
+        for(Vector<ALbyte> &block : job.mStaging.mBlocks)
+            mStagingPool.release(std::move(block));
+        job.mBuffer->mStaged = false;
+        --mStagedLoads;
+        resizeCachedBuffer(job.mBuffer, 0);
+        job.mPromise.set_exception(job.mError);
+        return true;
+    }
+
+    const size_t offset = job.mStaging.mOffset;
+    auto start = std::chrono::steady_clock::now();
+    bool done = job.mBuffer->uploadStaged(job.mFormat, job.mStaging, job.mLoopPts, maxbytes);
+    auto end = std::chrono::steady_clock::now();
+
+    std::chrono::nanoseconds elapsed = end - start;
+    job.mTiming.mUploadTime += elapsed;
+    job.mTiming.mLongestStep = std::max(job.mTiming.mLongestStep, elapsed);
+    ++job.mTiming.mUploadSteps;
+    if(job.mStaging.mOffset > offset && elapsed.count() > 0)
+    {
+        double rate = static_cast<double>(job.mStaging.mOffset - offset) /
+                      static_cast<double>(elapsed.count());
+        mUploadRate = (mUploadRate > 0.0) ? (mUploadRate*3.0 + rate) / 4.0 : rate;
+    }
+    if(!done) return false;
+
+    job.mTiming.mTotalTime = end - job.mStartTime;
+    send(&MessageHandler::bufferLoaded, job.mBuffer->getName(), job.mTiming);
+    for(Vector<ALbyte> &block : job.mStaging.mBlocks)
+        mStagingPool.release(std::move(block));
+    job.mBuffer->mStaged = false;
+    --mStagedLoads;
+    resizeCachedBuffer(job.mBuffer, job.mBuffer->getLoadedSize());
+    job.mPromise.set_value(Buffer(job.mBuffer));
+    return true;
+}
+
+void ContextImpl::uploadStagedBuffers()
+{
+    std::unique_lock<std::mutex> lock(mDecodeMutex);
+    std::move(mStagedJobs.begin(), mStagedJobs.end(), std::back_inserter(mUploadJobs));
+    mStagedJobs.clear();
+    lock.unlock();
+
+    // Do at least one step, so loads progress even with a tiny budget, then
+    // size each slice to what's left of the budget at the rate seen so far.
+    auto now = std::chrono::steady_clock::now();
+    const auto deadline = now + mUploadBudget;
+    while(!mUploadJobs.empty())
+    {
+        size_t maxbytes = MinUploadSlice;
+        auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now);
+        if(mUploadRate > 0.0 && remaining.count() > 0)
+            maxbytes = std::max(maxbytes,
+                static_cast<size_t>(mUploadRate * static_cast<double>(remaining.count())));
+
+        if(uploadStagedStep(mUploadJobs.front(), maxbytes))
+            mUploadJobs.pop_front();
+
+        now = std::chrono::steady_clock::now();
+        if(now >= deadline) break;
+    }
+}
+
+void ContextImpl::finishStagedBuffer(BufferImpl *buffer)
+{
+    if(!buffer->mStaged)
+        return;
+
+    auto is_buffer = [buffer](const DecodeJob &job) -> bool { return job.mBuffer == buffer; };
+    auto iter = std::find_if(mUploadJobs.begin(), mUploadJobs.end(), is_buffer);
+    if(iter == mUploadJobs.end())
+    {
+        // Wait for it to finish decoding, unless the threads are stopping and
+        // won't get to it.
+        std::unique_lock<std::mutex> lock(mDecodeMutex);
+        auto staged = std::find_if(mStagedJobs.begin(), mStagedJobs.end(), is_buffer);
+        while(staged == mStagedJobs.end())
+        {
+            if(mQuitThread.load(std::memory_order_acquire))
+                throw std::runtime_error("Buffer load was stopped");
+            mStagedCond.wait(lock);
+            staged = std::find_if(mStagedJobs.begin(), mStagedJobs.end(), is_buffer);
+        }
+        mUploadJobs.push_back(std::move(*staged));
+        mStagedJobs.erase(staged);
+        iter = mUploadJobs.end()-1;
+    }
+
+    while(!uploadStagedStep(*iter, std::numeric_limits<size_t>::max())) {
+    }
+    mUploadJobs.erase(iter);
+}
+
+
+void ContextImpl::stopDecodeThreads()
+{
+    std::unique_lock<std::mutex> lock(mDecodeMutex);
+    mQuitDecode = true;
+    mDecodeThreadCount = 0;
+    lock.unlock();
+    mDecodeCond.notify_all();
+
+    for(std::thread &thrd : mDecodeThreads)
+        thrd.join();
+    mDecodeThreads.clear();
+
+    lock.lock();
+    mQuitDecode = false;
+}
+
+void ContextImpl::stopThreads()
+{
+    stopDecodeThreads();
+
+    std::unique_lock<std::mutex> lock(mWakeMutex);
+    mQuitThread.store(true, std::memory_order_release);
+    lock.unlock();
+    mWakeThread.notify_all();
+    mWakeStream.notify_all();
+    mDecodeMutex.lock(); mDecodeMutex.unlock();
+    mStagedCond.notify_all();
+
+    if(mThread.joinable())
+        mThread.join();
+    if(mStreamThread.joinable())
+        mStreamThread.join();
+
+    lock = std::unique_lock<std::mutex>(mReadAheadMutex);
+    mQuitReadAhead.store(true, std::memory_order_release);
+    lock.unlock();
+    mReadAheadCond.notify_all();
+    if(mReadAheadThread.joinable())
+        mReadAheadThread.join();
+    mReadAheads.clear();
+}
+
+
+ContextImpl::ContextImpl(DeviceImpl &device, ArrayView<AttributePair> attrs)
+  : mListener(this), mDevice(device), mIsConnected(true), mIsBatching(false)
+{
+    ALCdevice *alcdev = mDevice.getALCdevice();
+    if(attrs.empty()) /* No explicit attributes. */
+        mContext.reset(alcCreateContext(alcdev, nullptr));
+    else
+        mContext.reset(alcCreateContext(alcdev, &attrs.front().mAttribute));
+    if(!mContext) throw alc_error(alcGetError(alcdev), "alcCreateContext failed");
+
+    // Find how many sources the context can have from the device's mono and
+    // stereo source counts, so running out doesn't need a failed alGenSources
+    // call to find out.
+    ALCint attrsize = 0;
+    alcGetIntegerv(alcdev, ALC_ATTRIBUTES_SIZE, 1, &attrsize);
+    if(attrsize > 0)
+    {
+        Vector<ALCint> alcattrs(attrsize);
+        alcGetIntegerv(alcdev, ALC_ALL_ATTRIBUTES, attrsize, alcattrs.data());
+        for(ALCint i = 0;i+1 < attrsize && alcattrs[i];i += 2)
+        {
+            if(alcattrs[i] == ALC_MONO_SOURCES || alcattrs[i] == ALC_STEREO_SOURCES)
+                mSourceLimit += static_cast<ALuint>(std::max(alcattrs[i+1], 0));
+        }
+    }
+    alcGetError(alcdev);
+
+    mSourceIds.reserve(256);
+    mPendingTail = mPendingHead = new PendingPromise();
+    mPendingCurrent.store(mPendingHead, std::memory_order_relaxed);
+}
+
+ContextImpl::~ContextImpl()
+{
+    stopThreads();
+
+    PendingPromise *pb = mPendingTail;
+    while(pb)
+    {
+        PendingPromise *next = pb->mNext.load(std::memory_order_relaxed);
+        delete pb;
+        pb = next;
+    }
+    mPendingCurrent.store(nullptr, std::memory_order_relaxed);
+    mPendingTail = mPendingHead = nullptr;
+    mDecodeJobs.clear();
+    mDecodedJobs.clear();
+    mStagedJobs.clear();
+    mUploadJobs.clear();
+
+    mEffectSlots.clear();
+    mEffects.clear();
+
+    std::unique_lock<std::mutex> ctxlock(LockGlobalCtx());
+    if(sCurrentCtx == this)
+    {
+        sCurrentCtx = nullptr;
+        sContextSetCount.fetch_add(1, std::memory_order_release);
+    }
+    if(sThreadCurrentCtx == this)
+    {
+        sThreadCurrentCtx = nullptr;
+        sContextSetCount.fetch_add(1, std::memory_order_release);
     }
 }
 
@@ -728,7 +1386,7 @@ void ContextImpl::destroy()
 {
     if(mRefs != 0)
     {
-        std::lock_guard<std::mutex> ctxlock(gGlobalCtxMutex);
+        std::unique_lock<std::mutex> ctxlock(LockGlobalCtx());
         if(!(mRefs == 1 && sCurrentCtx == this))
             throw std::runtime_error("Context is in use");
         decRef();
@@ -736,27 +1394,46 @@ void ContextImpl::destroy()
         sContextSetCount.fetch_add(1, std::memory_order_release);
     }
 
-    if(mThread.joinable())
+    mDeferCalls.store(false, std::memory_order_release);
     {
-        std::unique_lock<std::mutex> lock(mWakeMutex);
-        mQuitThread.store(true, std::memory_order_release);
-        lock.unlock();
-        mWakeThread.notify_all();
-        mThread.join();
+        std::lock_guard<std::mutex> lock(mCommandQueueMutex);
+        mCommandQueues.clear();
     }
 
-    std::unique_lock<std::mutex> lock(gGlobalCtxMutex);
+    stopThreads();
+    mDecodeJobs.clear();
+    mDecodedJobs.clear();
+    mStagedJobs.clear();
+    mUploadJobs.clear();
+    mStagedLoads = 0;
+
+    std::unique_lock<std::mutex> lock(LockGlobalCtx());
     if(UNLIKELY(alcMakeContextCurrent(getALCcontext()) == ALC_FALSE))
         std::cerr<< "Failed to cleanup context!" <<std::endl;
     else
     {
+        if(mStopEventsEnabled)
+        {
+            static const ALenum types[] = { AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT };
+            alEventControlSOFT(1, types, AL_FALSE);
+            alEventCallbackSOFT(nullptr, nullptr);
+            mStopEventsEnabled = false;
+        }
+
         mSourceGroups.clear();
+        mPriorityHeap.clear();
+        mVirtualHeap.clear();
+        mVirtualSources.clear();
+        mAudibility.clear();
+        mFades.clear();
+        mBulkProps.clear();
         mFreeSources.clear();
         mAllSources.clear();
 
         if(!mSourceIds.empty())
             alDeleteSources(static_cast<ALsizei>(mSourceIds.size()), mSourceIds.data());
         mSourceIds.clear();
+        mSourceCount = 0;
 
         for(auto &bufptr : mBuffers)
         {
@@ -764,6 +1441,9 @@ void ContextImpl::destroy()
             alDeleteBuffers(1, &id);
         }
         mBuffers.clear();
+        mLruHead = mLruTail = nullptr;
+        mBufferCacheSize = 0;
+        mLoadedSizes.clear();
 
         mEffectSlots.clear();
         mEffects.clear();
@@ -804,7 +1484,7 @@ void ContextImpl::endBatch()
 DECL_THUNK1(SharedPtr<MessageHandler>, Context, setMessageHandler,, SharedPtr<MessageHandler>)
 SharedPtr<MessageHandler> ContextImpl::setMessageHandler(SharedPtr<MessageHandler>&& handler)
 {
-    std::lock_guard<std::mutex> lock(gGlobalCtxMutex);
+    std::lock_guard<std::mutex> lock(mMessageMutex);
     mMessage.swap(handler);
     return handler;
 }
@@ -817,9 +1497,40 @@ void ContextImpl::setAsyncWakeInterval(std::chrono::milliseconds interval)
         throw std::out_of_range("Async wake interval out of range");
     mWakeInterval.store(interval);
     mWakeMutex.lock(); mWakeMutex.unlock();
+    mWakeStream.notify_all();
+}
+
+
+DECL_THUNK1(void, Context, setAsyncDecodeThreadCount,, ALuint)
+void ContextImpl::setAsyncDecodeThreadCount(ALuint count)
+{
+    if(count > 64)
+        throw std::out_of_range("Async decode thread count out of range");
+    if(count == mDecodeThreads.size())
+        return;
+
+    stopDecodeThreads();
+    mDecodeThreads.reserve(count);
+    while(mDecodeThreads.size() < count)
+        mDecodeThreads.emplace_back(std::mem_fn(&ContextImpl::decodeProc), this);
+    mDecodeMutex.lock();
+    mDecodeThreadCount = count;
+    mDecodeMutex.unlock();
+
+    // Wake the background thread, in case it has jobs to hand off or it needs
+    // to take over ones the old workers left behind.
+    mWakeMutex.lock(); mWakeMutex.unlock();
     mWakeThread.notify_all();
 }
 
+DECL_THUNK1(void, Context, setAsyncUploadBudget,, std::chrono::microseconds)
+void ContextImpl::setAsyncUploadBudget(std::chrono::microseconds budget)
+{
+    if(budget < std::chrono::microseconds::zero())
+        throw std::out_of_range("Async upload budget out of range");
+    mUploadBudget = budget;
+}
+
 
 DecoderOrExceptT ContextImpl::findDecoder(StringView name)
 {
@@ -828,17 +1539,21 @@ DecoderOrExceptT ContextImpl::findDecoder(StringView name)
     if(UNLIKELY(!file))
     {
         // Resource not found. Try to find a substitute.
-        if(!mMessage.get())
+        SharedPtr<MessageHandler> handler = getMessageHandler();
+        if(!handler.get())
             return std::make_exception_ptr(std::runtime_error("Failed to open file"));
         do {
-            String newname(mMessage->resourceNotFound(oldname));
+            String newname(handler->resourceNotFound(oldname));
             if(newname.empty())
                 return std::make_exception_ptr(std::runtime_error("Failed to open file"));
             file = FileIOFactory::get().openFile(newname);
             oldname = std::move(newname);
         } while(!file);
     }
-    return GetDecoder(std::move(file));
+    ALuint attempts = 0;
+    DecoderOrExceptT ret = GetDecoder(std::move(file), attempts);
+    send(&MessageHandler::decoderProbed, oldname, attempts);
+    return ret;
 }
 
 DECL_THUNK1(SharedPtr<Decoder>, Context, createDecoder,, StringView)
@@ -855,7 +1570,9 @@ SharedPtr<Decoder> ContextImpl::createDecoder(StringView name)
 DECL_THUNK2(bool, Context, isSupported, const, ChannelConfig, SampleType)
 bool ContextImpl::isSupported(ChannelConfig channels, SampleType type) const
 {
-    CheckContext(this);
+    // Supported formats don't change, so decoders made on background threads
+    // can check them while calls are deferred.
+    CheckCurrentContext(this);
     return GetFormat(channels, type) != AL_NONE;
 }
 
@@ -886,32 +1603,14 @@ ALsizei ContextImpl::getDefaultResamplerIndex() const
 }
 
 
-ContextImpl::FutureBufferListT::const_iterator ContextImpl::findFutureBufferName(StringView name, size_t name_hash) const
-{
-    auto iter = std::lower_bound(mFutureBuffers.begin(), mFutureBuffers.end(), name_hash,
-        [](const PendingBuffer &lhs, size_t rhs) -> bool
-        { return lhs.mBuffer->getNameHash() < rhs; }
-    );
-    while(iter != mFutureBuffers.end() && iter->mBuffer->getNameHash() == name_hash &&
-          iter->mBuffer->getName() != name)
-        ++iter;
-    return iter;
-}
+StringView ContextImpl::BufferNameOf::operator()(const UniquePtr<BufferImpl> &buffer) const
+{ return buffer->getName(); }
+StringView ContextImpl::BufferNameOf::operator()(const PendingBuffer &entry) const
+{ return entry.mBuffer->getName(); }
 
-ContextImpl::BufferListT::const_iterator ContextImpl::findBufferName(StringView name, size_t name_hash) const
-{
-    auto iter = std::lower_bound(mBuffers.begin(), mBuffers.end(), name_hash,
-        [](const UniquePtr<BufferImpl> &lhs, size_t rhs) -> bool
-        { return lhs->getNameHash() < rhs; }
-    );
-    while(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash &&
-          (*iter)->getName() != name)
-        ++iter;
-    return iter;
-}
-
-BufferOrExceptT ContextImpl::doCreateBuffer(StringView name, size_t name_hash, BufferListT::const_iterator iter, SharedPtr<Decoder> decoder)
+BufferOrExceptT ContextImpl::doCreateBuffer(StringView name, size_t name_hash, SharedPtr<Decoder> decoder)
 {
+    auto start = std::chrono::steady_clock::now();
     ALuint srate = decoder->getFrequency();
     ChannelConfig chans = decoder->getChannelConfig();
     SampleType type = decoder->getSampleType();
@@ -919,20 +1618,27 @@ BufferOrExceptT ContextImpl::doCreateBuffer(StringView name, size_t name_hash, B
         std::min<uint64_t>(decoder->getLength(), std::numeric_limits<ALuint>::max())
     );
 
-    Vector<ALbyte> data(FramesToBytes(frames, chans, type));
-    frames = decoder->read(data.data(), frames);
-    if(!frames)
-        return std::make_exception_ptr(std::runtime_error("No samples for buffer"));
-    data.resize(FramesToBytes(frames, chans, type));
-
-    std::pair<uint64_t,uint64_t> loop_pts = decoder->getLoopPoints();
-    if(loop_pts.first >= loop_pts.second)
-        loop_pts = std::make_pair(0, frames);
-    else
+    // Use the decoder's sample data directly if it can provide it, otherwise
+    // decode a copy.
+    Vector<ALbyte> data;
+    StagingGuard data_guard(mStagingPool, data);
+    ArrayView<ALbyte> samples = decoder->readDirect(frames);
+    if(!samples.empty())
     {
-        loop_pts.second = std::min<uint64_t>(loop_pts.second, frames);
-        loop_pts.first = std::min<uint64_t>(loop_pts.first, loop_pts.second-1);
+        frames = BytesToFrames(static_cast<ALuint>(samples.size()), chans, type);
+        samples = samples.slice(0, FramesToBytes(frames, chans, type));
     }
+    if(samples.empty())
+    {
+        data = mStagingPool.acquire(FramesToBytes(frames, chans, type));
+        frames = decoder->read(data.data(), frames);
+        if(!frames)
+            return std::make_exception_ptr(std::runtime_error("No samples for buffer"));
+        data.resize(FramesToBytes(frames, chans, type));
+        samples = data;
+    }
+
+    std::pair<uint64_t,uint64_t> loop_pts = ClampLoopPoints(decoder->getLoopPoints(), frames);
 
     // Get the format before calling the bufferLoading message handler, to
     // ensure it's something OpenAL can handle.
@@ -944,13 +1650,16 @@ BufferOrExceptT ContextImpl::doCreateBuffer(StringView name, size_t name_hash, B
         return std::make_exception_ptr(std::runtime_error(str));
     }
 
-    if(mMessage.get())
-        mMessage->bufferLoading(name, chans, type, srate, data);
+    send(&MessageHandler::bufferLoading, name, chans, type, srate, samples);
+
+    BufferLoadTiming timing{};
+    auto upload_start = std::chrono::steady_clock::now();
+    timing.mDecodeTime = upload_start - start;
 
     alGetError();
     ALuint bid = 0;
     alGenBuffers(1, &bid);
-    alBufferData(bid, format, data.data(), static_cast<ALsizei>(data.size()), srate);
+    alBufferData(bid, format, samples.data(), static_cast<ALsizei>(samples.size()), srate);
     if(hasExtension(AL::SOFT_loop_points))
     {
         ALint pts[2]{(ALint)loop_pts.first, (ALint)loop_pts.second};
@@ -962,12 +1671,21 @@ BufferOrExceptT ContextImpl::doCreateBuffer(StringView name, size_t name_hash, B
         return std::make_exception_ptr(al_error(err, "Failed to buffer data"));
     }
 
-    return mBuffers.insert(iter,
+    BufferImpl *buffer = mBuffers.insert(name_hash,
         MakeUnique<BufferImpl>(*this, bid, srate, chans, type, name, name_hash)
-    )->get();
+    ).get();
+    buffer->setLoaded(frames, samples.size(), loop_pts);
+    addCachedBuffer(buffer, samples.size());
+
+    auto end = std::chrono::steady_clock::now();
+    timing.mUploadTime = timing.mLongestStep = end - upload_start;
+    timing.mUploadSteps = 1;
+    timing.mTotalTime = end - start;
+    send(&MessageHandler::bufferLoaded, buffer->getName(), timing);
+    return buffer;
 }
 
-BufferOrExceptT ContextImpl::doCreateBufferAsync(StringView name, size_t name_hash, BufferListT::const_iterator iter, SharedPtr<Decoder> decoder, Promise<Buffer> promise)
+BufferOrExceptT ContextImpl::doCreateBufferAsync(StringView name, size_t name_hash, SharedPtr<Decoder> decoder, Promise<Buffer> promise)
 {
     ALuint srate = decoder->getFrequency();
     ChannelConfig chans = decoder->getChannelConfig();
@@ -997,10 +1715,15 @@ BufferOrExceptT ContextImpl::doCreateBufferAsync(StringView name, size_t name_ha
     if(mThread.get_id() == std::thread::id())
         mThread = std::thread(std::mem_fn(&ContextImpl::backgroundProc), this);
 
+    // With an upload budget, the buffer is staged for update to upload.
+    const bool staged = (mUploadBudget.count() > 0);
+    buffer->mStaged = staged;
+    if(staged) ++mStagedLoads;
+
     PendingPromise *pf = nullptr;
     if(mPendingTail == mPendingCurrent.load(std::memory_order_acquire))
         pf = new PendingPromise(buffer.get(), std::move(decoder), format, frames,
-                                std::move(promise));
+                                std::move(promise), staged);
     else
     {
         pf = mPendingTail;
@@ -1009,13 +1732,19 @@ BufferOrExceptT ContextImpl::doCreateBufferAsync(StringView name, size_t name_ha
         pf->mFormat = format;
         pf->mFrames = frames;
         pf->mPromise = std::move(promise);
+        pf->mStaged = staged;
+        pf->mStartTime = std::chrono::steady_clock::now();
         mPendingTail = pf->mNext.exchange(nullptr, std::memory_order_relaxed);
     }
 
     mPendingHead->mNext.store(pf, std::memory_order_release);
     mPendingHead = pf;
 
-    return mBuffers.insert(iter, std::move(buffer))->get();
+    // The data isn't decoded yet, so account for the size it's expected to
+    // have. Avoid FramesToBytes, which throws if it overflows.
+    BufferImpl *bufptr = mBuffers.insert(name_hash, std::move(buffer)).get();
+    addCachedBuffer(bufptr, static_cast<size_t>(frames) * FramesToBytes(1, chans, type));
+    return bufptr;
 }
 
 DECL_THUNK1(Buffer, Context, getBuffer,, StringView)
@@ -1030,30 +1759,34 @@ Buffer ContextImpl::getBuffer(StringView name)
         Buffer buffer;
 
         // If the buffer is already pending for the future, wait for it
-        auto iter = findFutureBufferName(name, name_hash);
-        if(iter != mFutureBuffers.end() && iter->mBuffer->getNameHash() == name_hash)
+        if(PendingBuffer *entry = mFutureBuffers.find(name, name_hash))
         {
-            buffer = iter->mFuture.get();
-            mFutureBuffers.erase(iter);
+            finishStagedBuffer(entry->mBuffer);
+            buffer = entry->mFuture.get();
+            mFutureBuffers.erase(name, name_hash);
         }
 
         // Clear out any completed futures.
-        mFutureBuffers.erase(
-            std::remove_if(mFutureBuffers.begin(), mFutureBuffers.end(),
-                [](const PendingBuffer &entry) -> bool
-                { return GetFutureState(entry.mFuture) == std::future_status::ready; }
-            ), mFutureBuffers.end()
+        mFutureBuffers.eraseIf(
+            [](const PendingBuffer &entry) -> bool
+            { return GetFutureState(entry.mFuture) == std::future_status::ready; }
         );
 
         // If we got the buffer, return it. Otherwise, go load it normally.
-        if(buffer) return buffer;
+        if(buffer)
+        {
+            touchBuffer(buffer.getHandle());
+            return buffer;
+        }
     }
 
-    auto iter = findBufferName(name, name_hash);
-    if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
-        return Buffer(iter->get());
+    if(UniquePtr<BufferImpl> *bufptr = mBuffers.find(name, name_hash))
+    {
+        touchBuffer(bufptr->get());
+        return Buffer(bufptr->get());
+    }
 
-    BufferOrExceptT ret = doCreateBuffer(name, name_hash, iter, createDecoder(name));
+    BufferOrExceptT ret = doCreateBuffer(name, name_hash, createDecoder(name));
     Buffer *buffer = std::get_if<Buffer>(&ret);
     if(UNLIKELY(!buffer))
         std::rethrow_exception(std::get<std::exception_ptr>(ret));
@@ -1071,32 +1804,28 @@ SharedFuture<Buffer> ContextImpl::getBufferAsync(StringView name)
     if(UNLIKELY(!mFutureBuffers.empty()))
     {
         // Check if the future that's being created already exists
-        auto iter = findFutureBufferName(name, name_hash);
-        if(iter != mFutureBuffers.end() && iter->mBuffer->getNameHash() == name_hash)
+        if(PendingBuffer *entry = mFutureBuffers.find(name, name_hash))
         {
-            future = iter->mFuture;
+            future = entry->mFuture;
             if(GetFutureState(future) == std::future_status::ready)
-                mFutureBuffers.erase(iter);
+                mFutureBuffers.erase(name, name_hash);
             return future;
         }
 
         // Clear out any fulfilled futures.
-        mFutureBuffers.erase(
-            std::remove_if(mFutureBuffers.begin(), mFutureBuffers.end(),
-                [](const PendingBuffer &entry) -> bool
-                { return GetFutureState(entry.mFuture) == std::future_status::ready; }
-            ), mFutureBuffers.end()
+        mFutureBuffers.eraseIf(
+            [](const PendingBuffer &entry) -> bool
+            { return GetFutureState(entry.mFuture) == std::future_status::ready; }
         );
     }
 
-    auto iter = findBufferName(name, name_hash);
-    if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
+    if(UniquePtr<BufferImpl> *bufptr = mBuffers.find(name, name_hash))
     {
         // User asked to create a future buffer that's already loaded. Just
         // construct a promise, fulfill the promise immediately, then return a
         // shared future that's already set.
         Promise<Buffer> promise;
-        promise.set_value(Buffer(iter->get()));
+        promise.set_value(Buffer(bufptr->get()));
         future = promise.get_future().share();
         return future;
     }
@@ -1104,19 +1833,14 @@ SharedFuture<Buffer> ContextImpl::getBufferAsync(StringView name)
     Promise<Buffer> promise;
     future = promise.get_future().share();
 
-    BufferOrExceptT ret = doCreateBufferAsync(name, name_hash, iter, createDecoder(name), std::move(promise));
+    BufferOrExceptT ret = doCreateBufferAsync(name, name_hash, createDecoder(name), std::move(promise));
     Buffer *buffer = std::get_if<Buffer>(&ret);
     if(UNLIKELY(!buffer))
         std::rethrow_exception(std::get<std::exception_ptr>(ret));
     mWakeMutex.lock(); mWakeMutex.unlock();
     mWakeThread.notify_all();
 
-    mFutureBuffers.insert(
-        std::lower_bound(mFutureBuffers.begin(), mFutureBuffers.end(), name_hash,
-            [](const PendingBuffer &lhs, size_t rhs) -> bool
-            { return lhs.mBuffer->getNameHash() < rhs; }
-        ), { buffer->getHandle(), future }
-    );
+    mFutureBuffers.insert(name_hash, { buffer->getHandle(), future });
 
     return future;
 }
@@ -1129,11 +1853,9 @@ void ContextImpl::precacheBuffersAsync(ArrayView<StringView> names)
     if(UNLIKELY(!mFutureBuffers.empty()))
     {
         // Clear out any fulfilled futures.
-        mFutureBuffers.erase(
-            std::remove_if(mFutureBuffers.begin(), mFutureBuffers.end(),
-                [](const PendingBuffer &entry) -> bool
-                { return GetFutureState(entry.mFuture) == std::future_status::ready; }
-            ), mFutureBuffers.end()
+        mFutureBuffers.eraseIf(
+            [](const PendingBuffer &entry) -> bool
+            { return GetFutureState(entry.mFuture) == std::future_status::ready; }
         );
     }
 
@@ -1143,8 +1865,7 @@ void ContextImpl::precacheBuffersAsync(ArrayView<StringView> names)
         size_t name_hash = hasher(name);
 
         // Check if the buffer that's being created already exists
-        auto iter = findBufferName(name, name_hash);
-        if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
+        if(mBuffers.find(name, name_hash))
             continue;
 
         DecoderOrExceptT dec = findDecoder(name);
@@ -1154,17 +1875,12 @@ void ContextImpl::precacheBuffersAsync(ArrayView<StringView> names)
         Promise<Buffer> promise;
         SharedFuture<Buffer> future = promise.get_future().share();
 
-        BufferOrExceptT buf = doCreateBufferAsync(name, name_hash, iter, std::move(*decoder),
+        BufferOrExceptT buf = doCreateBufferAsync(name, name_hash, std::move(*decoder),
                                                   std::move(promise));
         Buffer *buffer = std::get_if<Buffer>(&buf);
         if(UNLIKELY(!buffer)) continue;
 
-        mFutureBuffers.insert(
-            std::lower_bound(mFutureBuffers.begin(), mFutureBuffers.end(), name_hash,
-                [](const PendingBuffer &lhs, size_t rhs) -> bool
-                { return lhs.mBuffer->getNameHash() < rhs; }
-            ), { buffer->getHandle(), future }
-        );
+        mFutureBuffers.insert(name_hash, { buffer->getHandle(), future });
     }
     mWakeMutex.lock(); mWakeMutex.unlock();
     mWakeThread.notify_all();
@@ -1177,11 +1893,10 @@ Buffer ContextImpl::createBufferFrom(StringView name, SharedPtr<Decoder>&& decod
 
     auto hasher = std::hash<StringView>();
     size_t name_hash = hasher(name);
-    auto iter = findBufferName(name, name_hash);
-    if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
+    if(mBuffers.find(name, name_hash))
         throw std::runtime_error("Buffer already exists");
 
-    BufferOrExceptT ret = doCreateBuffer(name, name_hash, iter, std::move(decoder));
+    BufferOrExceptT ret = doCreateBuffer(name, name_hash, std::move(decoder));
     Buffer *buffer = std::get_if<Buffer>(&ret);
     if(UNLIKELY(!buffer))
         std::rethrow_exception(std::get<std::exception_ptr>(ret));
@@ -1197,36 +1912,28 @@ SharedFuture<Buffer> ContextImpl::createBufferAsyncFrom(StringView name, SharedP
     if(UNLIKELY(!mFutureBuffers.empty()))
     {
         // Clear out any fulfilled futures.
-        mFutureBuffers.erase(
-            std::remove_if(mFutureBuffers.begin(), mFutureBuffers.end(),
-                [](const PendingBuffer &entry) -> bool
-                { return GetFutureState(entry.mFuture) == std::future_status::ready; }
-            ), mFutureBuffers.end()
+        mFutureBuffers.eraseIf(
+            [](const PendingBuffer &entry) -> bool
+            { return GetFutureState(entry.mFuture) == std::future_status::ready; }
         );
     }
 
     auto hasher = std::hash<StringView>();
     size_t name_hash = hasher(name);
-    auto iter = findBufferName(name, name_hash);
-    if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
+    if(mBuffers.find(name, name_hash))
         throw std::runtime_error("Buffer already exists");
 
     Promise<Buffer> promise;
     future = promise.get_future().share();
 
-    BufferOrExceptT ret = doCreateBufferAsync(name, name_hash, iter, std::move(decoder), std::move(promise));
+    BufferOrExceptT ret = doCreateBufferAsync(name, name_hash, std::move(decoder), std::move(promise));
     Buffer *buffer = std::get_if<Buffer>(&ret);
     if(UNLIKELY(!buffer))
         std::rethrow_exception(std::get<std::exception_ptr>(ret));
     mWakeMutex.lock(); mWakeMutex.unlock();
     mWakeThread.notify_all();
 
-    mFutureBuffers.insert(
-        std::lower_bound(mFutureBuffers.begin(), mFutureBuffers.end(), name_hash,
-            [](const PendingBuffer &lhs, size_t rhs) -> bool
-            { return lhs.mBuffer->getNameHash() < rhs; }
-        ), { buffer->getHandle(), future }
-    );
+    mFutureBuffers.insert(name_hash, { buffer->getHandle(), future });
 
     return future;
 }
@@ -1243,28 +1950,27 @@ Buffer ContextImpl::findBuffer(StringView name)
     if(UNLIKELY(!mFutureBuffers.empty()))
     {
         // If the buffer is already pending for the future, wait for it
-        auto iter = findFutureBufferName(name, name_hash);
-        if(iter != mFutureBuffers.end() && iter->mBuffer->getNameHash() == name_hash)
+        if(PendingBuffer *entry = mFutureBuffers.find(name, name_hash))
         {
-            buffer = iter->mFuture.get();
-            mFutureBuffers.erase(iter);
+            finishStagedBuffer(entry->mBuffer);
+            buffer = entry->mFuture.get();
+            mFutureBuffers.erase(name, name_hash);
         }
 
         // Clear out any completed futures.
-        mFutureBuffers.erase(
-            std::remove_if(mFutureBuffers.begin(), mFutureBuffers.end(),
-                [](const PendingBuffer &entry) -> bool
-                { return GetFutureState(entry.mFuture) == std::future_status::ready; }
-            ), mFutureBuffers.end()
+        mFutureBuffers.eraseIf(
+            [](const PendingBuffer &entry) -> bool
+            { return GetFutureState(entry.mFuture) == std::future_status::ready; }
         );
     }
 
     if(LIKELY(!buffer))
     {
-        auto iter = findBufferName(name, name_hash);
-        if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
-            buffer = Buffer(iter->get());
+        if(UniquePtr<BufferImpl> *bufptr = mBuffers.find(name, name_hash))
+            buffer = Buffer(bufptr->get());
     }
+    if(buffer)
+        touchBuffer(buffer.getHandle());
     return buffer;
 }
 
@@ -1279,32 +1985,28 @@ SharedFuture<Buffer> ContextImpl::findBufferAsync(StringView name)
     if(UNLIKELY(!mFutureBuffers.empty()))
     {
         // Check if the future that's being created already exists
-        auto iter = findFutureBufferName(name, name_hash);
-        if(iter != mFutureBuffers.end() && iter->mBuffer->getNameHash() == name_hash)
+        if(PendingBuffer *entry = mFutureBuffers.find(name, name_hash))
         {
-            future = iter->mFuture;
+            future = entry->mFuture;
             if(GetFutureState(future) == std::future_status::ready)
-                mFutureBuffers.erase(iter);
+                mFutureBuffers.erase(name, name_hash);
             return future;
         }
 
         // Clear out any fulfilled futures.
-        mFutureBuffers.erase(
-            std::remove_if(mFutureBuffers.begin(), mFutureBuffers.end(),
-                [](const PendingBuffer &entry) -> bool
-                { return GetFutureState(entry.mFuture) == std::future_status::ready; }
-            ), mFutureBuffers.end()
+        mFutureBuffers.eraseIf(
+            [](const PendingBuffer &entry) -> bool
+            { return GetFutureState(entry.mFuture) == std::future_status::ready; }
         );
     }
 
-    auto iter = findBufferName(name, name_hash);
-    if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
+    if(UniquePtr<BufferImpl> *bufptr = mBuffers.find(name, name_hash))
     {
         // User asked to create a future buffer that's already loaded. Just
         // construct a promise, fulfill the promise immediately, then return a
         // shared future that's already set.
         Promise<Buffer> promise;
-        promise.set_value(Buffer(iter->get()));
+        promise.set_value(Buffer(bufptr->get()));
         future = promise.get_future().share();
     }
     return future;
@@ -1316,6 +2018,8 @@ DECL_THUNK1(void, Context, removeBuffer,, StringView)
 void ContextImpl::removeBuffer(StringView name)
 {
     CheckContext(this);
+    // Queued calls may play it.
+    applyCommands();
 
     auto hasher = std::hash<StringView>();
     size_t name_hash = hasher(name);
@@ -1323,27 +2027,29 @@ void ContextImpl::removeBuffer(StringView name)
     {
         // If the buffer is already pending for the future, wait for it to
         // finish before continuing.
-        auto iter = findFutureBufferName(name, name_hash);
-        if(iter != mFutureBuffers.end() && iter->mBuffer->getNameHash() == name_hash)
+        if(PendingBuffer *entry = mFutureBuffers.find(name, name_hash))
         {
-            iter->mFuture.wait();
-            mFutureBuffers.erase(iter);
+            finishStagedBuffer(entry->mBuffer);
+            entry->mFuture.wait();
+            mFutureBuffers.erase(name, name_hash);
         }
 
         // Clear out any completed futures.
-        mFutureBuffers.erase(
-            std::remove_if(mFutureBuffers.begin(), mFutureBuffers.end(),
-                [](const PendingBuffer &entry) -> bool
-                { return GetFutureState(entry.mFuture) == std::future_status::ready; }
-            ), mFutureBuffers.end()
+        mFutureBuffers.eraseIf(
+            [](const PendingBuffer &entry) -> bool
+            { return GetFutureState(entry.mFuture) == std::future_status::ready; }
         );
     }
 
-    auto iter = findBufferName(name, name_hash);
-    if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
+    if(UniquePtr<BufferImpl> *bufptr = mBuffers.find(name, name_hash))
     {
+        // A play queued since the calls were made would be left with a
+        // deleted buffer.
+        BufferImpl *buffer = bufptr->get();
+        if(UNLIKELY(buffer->hasPendingUses()))
+            throw std::runtime_error("Buffer is being played from another thread");
+
         // Remove pending sources whose future was waiting for this buffer.
-        BufferImpl *buffer = iter->get();
         mPendingSources.erase(
             std::remove_if(mPendingSources.begin(), mPendingSources.end(),
                 [buffer](PendingSource &entry) -> bool
@@ -1353,49 +2059,219 @@ void ContextImpl::removeBuffer(StringView name)
                 }
             ), mPendingSources.end()
         );
-        (*iter)->cleanup();
-        mBuffers.erase(iter);
+        removeCachedBuffer(buffer);
+        buffer->cleanup();
+        mBuffers.erase(name, name_hash);
     }
 }
 
 
-ALuint ContextImpl::getSourceId(ALuint maxprio)
+DECL_THUNK1(void, Context, setBufferCacheBudget,, size_t)
+void ContextImpl::setBufferCacheBudget(size_t bytes)
 {
-    ALuint id = 0;
-    if(mSourceIds.empty())
+    CheckContext(this);
+    mBufferCacheBudget = bytes;
+    evictBuffers();
+}
+DECL_THUNK0(size_t, Context, getBufferCacheBudget, const)
+DECL_THUNK0(size_t, Context, getBufferCacheSize, const)
+size_t ContextImpl::getBufferCacheSize() const
+{
+    // Buffers that finished loading since the sizes were last corrected count
+    // at their real size.
+    size_t size = mBufferCacheSize;
+    std::lock_guard<std::mutex> lock(mLoadedSizeMutex);
+    for(const std::pair<BufferImpl*,size_t> &entry : mLoadedSizes)
+        size = size - entry.first->mCacheSize + entry.second;
+    return size;
+}
+
+DECL_THUNK1(Vector<BufferInfo>, Context, getBufferInfo, const, ArrayView<Buffer>)
+Vector<BufferInfo> ContextImpl::getBufferInfo(ArrayView<Buffer> buffers) const
+{
+    CheckContext(this);
+    Vector<BufferInfo> infos;
+    infos.reserve(buffers.size());
+    for(const Buffer &buffer : buffers)
     {
-        alGetError();
-        alGenSources(1, &id);
-        if(alGetError() == AL_NO_ERROR)
-            return id;
+        BufferImpl *albuf = buffer.getHandle();
+        if(UNLIKELY(!albuf)) throw std::invalid_argument("Buffer is not valid");
+        CheckContexts(*this, albuf->getContext());
+        infos.push_back(albuf->getInfo());
+    }
+    return infos;
+}
+
+void ContextImpl::addCachedBuffer(BufferImpl *buffer, size_t size)
+{
+    buffer->mCacheSize = size;
+    buffer->mLruPrev = nullptr;
+    buffer->mLruNext = mLruHead;
+    if(mLruHead) mLruHead->mLruPrev = buffer;
+    else mLruTail = buffer;
+    mLruHead = buffer;
+    mBufferCacheSize += size;
+
+    evictBuffers(buffer);
+}
+
+void ContextImpl::removeCachedBuffer(BufferImpl *buffer)
+{
+    // Don't leave a correction for the buffer after it's gone.
+    updateCachedSizes();
+
+    if(buffer->mLruPrev) buffer->mLruPrev->mLruNext = buffer->mLruNext;
+    else mLruHead = buffer->mLruNext;
+    if(buffer->mLruNext) buffer->mLruNext->mLruPrev = buffer->mLruPrev;
+    else mLruTail = buffer->mLruPrev;
+    buffer->mLruPrev = buffer->mLruNext = nullptr;
+    mBufferCacheSize -= buffer->mCacheSize;
+}
+
+void ContextImpl::resizeCachedBuffer(BufferImpl *buffer, size_t size)
+{
+    mBufferCacheSize = mBufferCacheSize - buffer->mCacheSize + size;
+    buffer->mCacheSize = size;
+}
+
+void ContextImpl::addLoadedSize(BufferImpl *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mLoadedSizeMutex);
+    mLoadedSizes.emplace_back(buffer, size);
+}
+
+void ContextImpl::updateCachedSizes()
+{
+    std::unique_lock<std::mutex> lock(mLoadedSizeMutex);
+    if(LIKELY(mLoadedSizes.empty()))
+        return;
+    Vector<std::pair<BufferImpl*,size_t>> sizes;
+    std::swap(sizes, mLoadedSizes);
+    lock.unlock();
+
+    for(const std::pair<BufferImpl*,size_t> &entry : sizes)
+        resizeCachedBuffer(entry.first, entry.second);
+}
+
+void ContextImpl::touchBuffer(BufferImpl *buffer)
+{
+    if(buffer == mLruHead)
+        return;
+
+    // Move the buffer to the front of the list. It's not the head, so it must
+    // have a previous entry.
+    buffer->mLruPrev->mLruNext = buffer->mLruNext;
+    if(buffer->mLruNext) buffer->mLruNext->mLruPrev = buffer->mLruPrev;
+    else mLruTail = buffer->mLruPrev;
+
+    buffer->mLruPrev = nullptr;
+    buffer->mLruNext = mLruHead;
+    mLruHead->mLruPrev = buffer;
+    mLruHead = buffer;
+}
+
+void ContextImpl::evictBuffers(BufferImpl *keep)
+{
+    updateCachedSizes();
+    if(!mBufferCacheBudget)
+        return;
 
-        SourceImpl *lowest = nullptr;
-        for(SourceBufferUpdateEntry &entry : mPlaySources)
+    BufferImpl *buffer = mLruTail;
+    while(buffer && mBufferCacheSize > mBufferCacheBudget)
+    {
+        BufferImpl *prev = buffer->mLruPrev;
+        StringView name = buffer->getName();
+        size_t name_hash = buffer->getNameHash();
+
+        // Skip buffers that are in use, either being played or about to be,
+        // or still loading.
+        if(buffer == keep || buffer->getSourceCount() > 0 || buffer->hasPendingUses())
         {
-            if(!lowest || entry.mSource->getPriority() < lowest->getPriority())
-                lowest = entry.mSource;
+            buffer = prev;
+            continue;
         }
-        for(SourceStreamUpdateEntry &entry : mStreamSources)
+        if(PendingBuffer *entry = mFutureBuffers.find(name, name_hash))
         {
-            if(!lowest || entry.mSource->getPriority() < lowest->getPriority())
-                lowest = entry.mSource;
+            if(GetFutureState(entry->mFuture) != std::future_status::ready)
+            {
+                buffer = prev;
+                continue;
+            }
+            mFutureBuffers.erase(name, name_hash);
         }
-        if(lowest && lowest->getPriority() < maxprio)
+        auto pending_src = std::find_if(mPendingSources.begin(), mPendingSources.end(),
+            [buffer](PendingSource &entry) -> bool
+            {
+                return (GetFutureState(entry.mFuture) == std::future_status::ready &&
+                        entry.mFuture.get().getHandle() == buffer);
+            }
+        );
+        if(pending_src != mPendingSources.end())
         {
-            lowest->stop();
-            if(mMessage.get())
-                mMessage->sourceForceStopped(lowest);
+            buffer = prev;
+            continue;
+        }
+
+        send(&MessageHandler::bufferEvicted, name, buffer->mCacheSize);
+        removeCachedBuffer(buffer);
+        buffer->cleanup();
+        mBuffers.erase(name, name_hash);
+
+        buffer = prev;
+    }
+}
+
+
+bool ContextImpl::genSourceIds(ALuint count)
+{
+    size_t oldsize = mSourceIds.size();
+    mSourceIds.resize(oldsize + count);
+
+    alGetError();
+    alGenSources(static_cast<ALsizei>(count), &mSourceIds[oldsize]);
+    if(alGetError() != AL_NO_ERROR)
+    {
+        mSourceIds.resize(oldsize);
+        return false;
+    }
+    mSourceCount += count;
+    return true;
+}
+
+ALuint ContextImpl::getSourceId(ALuint maxprio, bool can_virtualize)
+{
+    if(mSourceIds.empty() && (!mSourceLimit || mSourceCount < mSourceLimit))
+    {
+        // Failing to make another means the limit has been reached.
+        if(!genSourceIds(1))
+            mSourceLimit = mSourceCount;
+    }
+    if(mSourceIds.empty() && !mPriorityHeap.empty())
+    {
+        SourceImpl *lowest = mPriorityHeap.top();
+        if(lowest->getPriority() < maxprio)
+        {
+            if(mVirtualVoices && lowest->canVirtualize())
+                virtualizeSource(lowest);
+            else
+            {
+                lowest->stop();
+                send(&MessageHandler::sourceForceStopped, lowest);
+            }
         }
     }
     if(mSourceIds.empty())
+    {
+        if(can_virtualize && mVirtualVoices)
+            return 0;
         throw std::runtime_error("No available sources");
+    }
 
-    id = mSourceIds.back();
+    ALuint id = mSourceIds.back();
     mSourceIds.pop_back();
     return id;
 }
 
-
 DECL_THUNK0(Source, Context, createSource,)
 Source ContextImpl::createSource()
 {
@@ -1416,6 +2292,33 @@ Source ContextImpl::createSource()
 }
 
 
+DECL_THUNK1(ALuint, Context, reserveSources,, ALuint)
+ALuint ContextImpl::reserveSources(ALuint count)
+{
+    CheckContext(this);
+    if(mSourceLimit)
+        count = std::min(count, mSourceLimit);
+    if(count > mSourceCount)
+    {
+        // Make them all at once if possible, otherwise one at a time until
+        // the limit is found.
+        ALuint todo = count - mSourceCount;
+        if(!genSourceIds(todo))
+        {
+            while(mSourceCount < count)
+            {
+                if(!genSourceIds(1))
+                {
+                    mSourceLimit = mSourceCount;
+                    break;
+                }
+            }
+        }
+    }
+    return mSourceCount;
+}
+
+
 void ContextImpl::addPendingSource(SourceImpl *source, SharedFuture<Buffer> future)
 {
     auto iter = std::lower_bound(mPendingSources.begin(), mPendingSources.end(), source,
@@ -1450,27 +2353,54 @@ bool ContextImpl::isPendingSource(const SourceImpl *source) const
     return (iter != mPendingSources.end() && iter->mSource == source);
 }
 
-void ContextImpl::addFadingSource(SourceImpl *source, std::chrono::nanoseconds duration, ALfloat gain)
+void ContextImpl::addFadingSource(SourceImpl *source, std::chrono::nanoseconds duration,
+                                  ALfloat gain, FadeCurve curve, bool fade_in)
 {
-    auto iter = std::lower_bound(mFadingSources.begin(), mFadingSources.end(), source,
-        [](const SourceFadeUpdateEntry &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter == mFadingSources.end() || iter->mSource != source)
-    {
-        auto now = mDevice.getClockTime();
-        mFadingSources.emplace(iter, SourceFadeUpdateEntry{source, now, now+duration, true, gain});
-    }
+    mFades.add(source, mDevice.getClockTime(), duration, gain, source->getFadeGain(), curve,
+               fade_in);
+    // Fades in start quiet right away.
+    if(fade_in)
+        source->setFadeGain(mFades.getGains()[source->mFadeIndex]);
 }
 
 void ContextImpl::removeFadingSource(SourceImpl *source)
 {
-    auto iter = std::lower_bound(mFadingSources.begin(), mFadingSources.end(), source,
-        [](const SourceFadeUpdateEntry &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter != mFadingSources.end() && iter->mSource == source)
-        mFadingSources.erase(iter);
+    if(source->mFadeIndex == SourceImpl::NoFadeIndex)
+        return;
+    mFades.remove(source);
+    source->setFadeGain(1.0f);
+}
+
+void ContextImpl::updateFades()
+{
+    mFades.update(mDevice.getClockTime());
+
+    Batcher batcher = getBatcher();
+    ArrayView<ALfloat> gains = mFades.getGains();
+    ArrayView<ALfloat> progress = mFades.getProgress();
+    mFadesDone.clear();
+    for(size_t i = 0;i < mFades.size();++i)
+    {
+        if(progress[i] < 1.0f)
+            mFades.getSource(i)->setFadeGain(gains[i]);
+        else
+            mFadesDone.push_back(mFades.getSource(i));
+    }
+    // Finished fades in leave their sources at full gain, while fades out
+    // stop them.
+    for(SourceImpl *source : mFadesDone)
+    {
+        const bool fade_in = mFades.isFadeIn(source->mFadeIndex);
+        mFades.remove(source);
+        if(fade_in)
+            source->setFadeGain(1.0f);
+        else
+        {
+            removePendingSource(source);
+            removePlayingSource(source);
+            source->makeStopped(true);
+        }
+    }
 }
 
 void ContextImpl::addPlayingSource(SourceImpl *source, ALuint id)
@@ -1480,7 +2410,14 @@ void ContextImpl::addPlayingSource(SourceImpl *source, ALuint id)
         { return lhs.mSource < rhs; }
     );
     if(iter == mPlaySources.end() || iter->mSource != source)
-        mPlaySources.insert(iter, {source,id});
+    {
+        mPlaySources.insert(iter, {source, id, std::chrono::nanoseconds::zero()});
+        mPriorityHeap.push(source);
+    }
+    else
+        iter->mStopTime = std::chrono::nanoseconds::zero();
+    if(mAudibilityThreshold > 0.0f)
+        mAudibility.add(source, source->getAudibilityParams());
 }
 
 void ContextImpl::addPlayingSource(SourceImpl *source)
@@ -1490,17 +2427,37 @@ void ContextImpl::addPlayingSource(SourceImpl *source)
         { return lhs.mSource < rhs; }
     );
     if(iter == mStreamSources.end() || iter->mSource != source)
+    {
         mStreamSources.insert(iter, {source});
+        mPriorityHeap.push(source);
+    }
 }
 
 void ContextImpl::removePlayingSource(SourceImpl *source)
 {
+    if(source->isVirtual())
+    {
+        auto iter = std::find(mVirtualSources.begin(), mVirtualSources.end(), source);
+        if(iter != mVirtualSources.end())
+        {
+            *iter = mVirtualSources.back();
+            mVirtualSources.pop_back();
+        }
+        mVirtualHeap.erase(source);
+        mAudibility.remove(source);
+        source->mCulled = false;
+        return;
+    }
+
     auto iter0 = std::lower_bound(mPlaySources.begin(), mPlaySources.end(), source,
         [](const SourceBufferUpdateEntry &lhs, SourceImpl *rhs) -> bool
         { return lhs.mSource < rhs; }
     );
     if(iter0 != mPlaySources.end() && iter0->mSource == source)
+    {
         mPlaySources.erase(iter0);
+        mAudibility.remove(source);
+    }
     else
     {
         auto iter1 = std::lower_bound(mStreamSources.begin(), mStreamSources.end(), source,
@@ -1510,17 +2467,497 @@ void ContextImpl::removePlayingSource(SourceImpl *source)
         if(iter1 != mStreamSources.end() && iter1->mSource == source)
             mStreamSources.erase(iter1);
     }
+    mPriorityHeap.erase(source);
+}
+
+void ContextImpl::resetStopTime(SourceImpl *source)
+{
+    auto iter = std::lower_bound(mPlaySources.begin(), mPlaySources.end(), source,
+        [](const SourceBufferUpdateEntry &lhs, SourceImpl *rhs) -> bool
+        { return lhs.mSource < rhs; }
+    );
+    if(iter != mPlaySources.end() && iter->mSource == source)
+        iter->mStopTime = std::chrono::nanoseconds::zero();
+}
+
+void ContextImpl::resetStopTimes()
+{
+    for(SourceBufferUpdateEntry &entry : mPlaySources)
+        entry.mStopTime = std::chrono::nanoseconds::zero();
+}
+
+void ContextImpl::updatePlayingSources()
+{
+    auto cur_time = mDevice.getClockTime();
+
+    // With stop events, only check the sources OpenAL said stopped, as they
+    // may have been played again since. Otherwise, check the sources that
+    // could have stopped by now. Either way, get all their states in one go.
+    mEventIds.clear();
+    bool use_events = mStopEventsEnabled;
+    if(use_events)
+    {
+        ALuint id;
+        while(mStopEvents.pop(id))
+            mEventIds.push_back(id);
+        std::sort(mEventIds.begin(), mEventIds.end());
+        // Some events were dropped, so check the old way this once.
+        if(UNLIKELY(mStopEventsMissed.exchange(false, std::memory_order_acquire)))
+            use_events = false;
+    }
+    auto should_poll = [this,use_events,cur_time](const SourceBufferUpdateEntry &entry) -> bool
+    {
+        if(use_events)
+            return std::binary_search(mEventIds.begin(), mEventIds.end(), entry.mId);
+        return entry.mStopTime <= cur_time;
+    };
+
+    mPollIds.clear();
+    for(const SourceBufferUpdateEntry &entry : mPlaySources)
+    {
+        if(should_poll(entry))
+            mPollIds.push_back(entry.mId);
+    }
+    mPollStates.resize(mPollIds.size());
+    for(size_t i = 0;i < mPollIds.size();++i)
+        alGetSourcei(mPollIds[i], AL_SOURCE_STATE, &mPollStates[i]);
+
+    UpdateStats stats{};
+    stats.mSourceQueries = static_cast<ALuint>(mPollIds.size());
+    stats.mSourcesPolled = static_cast<ALuint>(mPollIds.size());
+    stats.mSourcesSkipped = static_cast<ALuint>(mPlaySources.size() - mPollIds.size());
+
+    // Sources still playing get a new time to check them by.
+    const bool doppler = mDopplerFactor > 0.0f;
+    const Vector3 &lvel = mListener.getVelocity();
+    const bool listener_moving = lvel[0] != 0.0f || lvel[1] != 0.0f || lvel[2] != 0.0f;
+    Vector<SourceImpl*> stopped;
+    size_t idx = 0;
+    mPlaySources.erase(
+        std::remove_if(mPlaySources.begin(), mPlaySources.end(),
+            [&](SourceBufferUpdateEntry &entry) -> bool
+            {
+                if(!should_poll(entry))
+                    return false;
+                ALint state = mPollStates[idx++];
+                if(LIKELY(state == AL_PLAYING || state == AL_PAUSED))
+                {
+                    if(!mStopEventsEnabled)
+                        entry.mStopTime = entry.mSource->getStopTime(cur_time, doppler,
+                            listener_moving, stats.mSourceQueries);
+                    return false;
+                }
+                mPriorityHeap.erase(entry.mSource);
+                mAudibility.remove(entry.mSource);
+                stopped.push_back(entry.mSource);
+                return true;
+            }
+        ), mPlaySources.end()
+    );
+    mUpdateStats = stats;
+
+    // Stop them all before sending messages, as the handler may play them
+    // again.
+    for(SourceImpl *source : stopped)
+        source->makeStopped();
+    for(SourceImpl *source : stopped)
+        send(&MessageHandler::sourceStopped, Source(source));
+}
+
+void ContextImpl::updatePlayingPriority(SourceImpl *source)
+{
+    if(source->mPriorityIndex == SourceImpl::NoPriorityIndex)
+        return;
+    if(source->isVirtual())
+        mVirtualHeap.update(source);
+    else
+        mPriorityHeap.update(source);
+}
+
+
+void ContextImpl::addVirtualSource(SourceImpl *source)
+{
+    mVirtualSources.push_back(source);
+    if(!source->isPaused() && !source->mCulled)
+        mVirtualHeap.push(source);
+    if(mAudibilityThreshold > 0.0f)
+        mAudibility.add(source, source->getAudibilityParams());
+}
+
+void ContextImpl::virtualizeSource(SourceImpl *source)
+{
+    removePlayingSource(source);
+    source->makeVirtual(mDevice.getClockTime());
+    addVirtualSource(source);
+}
+
+void ContextImpl::setVirtualPaused(SourceImpl *source, bool paused)
+{
+    // Paused virtual sources don't need a source id until resumed.
+    if(paused && source->mPriorityIndex != SourceImpl::NoPriorityIndex)
+        mVirtualHeap.erase(source);
+    else if(!paused && !source->mCulled && source->mPriorityIndex == SourceImpl::NoPriorityIndex)
+        mVirtualHeap.push(source);
+}
+
+void ContextImpl::updateVirtualSources()
+{
+    auto cur_time = mDevice.getClockTime();
+    for(size_t i = mVirtualSources.size();i > 0;)
+    {
+        SourceImpl *source = mVirtualSources[--i];
+        if(source->virtualUpdate(cur_time))
+            continue;
+
+        // Stopping it calls the message handler, which may start or stop
+        // other sources.
+        source->stop();
+        send(&MessageHandler::sourceStopped, Source(source));
+        i = std::min(i, mVirtualSources.size());
+    }
+
+    // Give source ids to the highest priority virtual sources, as long as
+    // there are free ones or lower priority sources to take them from.
+    while(!mVirtualHeap.empty())
+    {
+        SourceImpl *source = mVirtualHeap.top();
+        ALuint id = getSourceId(source->getPriority(), true);
+        if(!id) break;
+
+        mVirtualHeap.erase(source);
+        auto iter = std::find(mVirtualSources.begin(), mVirtualSources.end(), source);
+        *iter = mVirtualSources.back();
+        mVirtualSources.pop_back();
+        source->bindVirtual(id, cur_time);
+    }
+}
+
+DECL_THUNK1(void, Context, setVirtualVoices,, bool)
+void ContextImpl::setVirtualVoices(bool enable)
+{
+    CheckContext(this);
+    mVirtualVoices = enable;
+    if(enable) return;
+
+    // Without virtual voices, sources that are virtual can't keep playing.
+    while(!mVirtualSources.empty())
+    {
+        SourceImpl *source = mVirtualSources.back();
+        source->stop();
+        send(&MessageHandler::sourceForceStopped, source);
+    }
+}
+
+
+void ContextImpl::cullInaudibleSources()
+{
+    // Culled sources need to get a bit louder than the threshold to play
+    // again, so sources near it don't go back and forth every update.
+    static constexpr ALfloat AudibleHysteresis = 1.25f;
+    const ALfloat audible = mAudibilityThreshold * AudibleHysteresis;
+
+    // Making sources virtual moves them around in the table, so find the
+    // ones to change first.
+    ArrayView<ALfloat> gains = mAudibility.estimate(mListener.getPosition(), mListener.getGain(),
+                                                    mDistanceModel);
+    mCullChanges.clear();
+    for(size_t i = 0;i < gains.size();++i)
+    {
+        SourceImpl *source = mAudibility.getSource(i);
+        if(!source->mCulled)
+        {
+            if(gains[i] < mAudibilityThreshold)
+                mCullChanges.emplace_back(source, true);
+        }
+        else if(gains[i] >= audible)
+            mCullChanges.emplace_back(source, false);
+    }
+
+    for(const auto &change : mCullChanges)
+    {
+        SourceImpl *source = change.first;
+        source->mCulled = change.second;
+        if(!change.second)
+        {
+            // Audible again, so it can be given a source id.
+            if(!source->isPaused())
+                mVirtualHeap.push(source);
+        }
+        else if(source->isVirtual())
+            mVirtualHeap.erase(source);
+        else if(source->canVirtualize())
+            virtualizeSource(source);
+        else
+            source->mCulled = false;
+    }
+}
+
+void ContextImpl::checkBulkSources(ArrayView<Source> sources, size_t count) const
+{
+    if(sources.size() != count)
+        throw std::invalid_argument("Mismatched source and property counts");
+    for(const Source &source : sources)
+    {
+        SourceImpl *alsrc = source.getHandle();
+        if(UNLIKELY(!alsrc)) throw std::invalid_argument("Source is not valid");
+        CheckContexts(*this, alsrc->getContext());
+    }
+}
+
+DECL_THUNK2(void, Context, setSourcePositions,, ArrayView<Source>, ArrayView<Vector3>)
+void ContextImpl::setSourcePositions(ArrayView<Source> sources, ArrayView<Vector3> positions)
+{
+    CheckContext(this);
+    checkBulkSources(sources, positions.size());
+    for(size_t i = 0;i < sources.size();++i)
+        mBulkProps.setPosition(sources[i].getHandle(), positions[i]);
+}
+
+DECL_THUNK2(void, Context, setSourceVelocities,, ArrayView<Source>, ArrayView<Vector3>)
+void ContextImpl::setSourceVelocities(ArrayView<Source> sources, ArrayView<Vector3> velocities)
+{
+    CheckContext(this);
+    checkBulkSources(sources, velocities.size());
+    for(size_t i = 0;i < sources.size();++i)
+        mBulkProps.setVelocity(sources[i].getHandle(), velocities[i]);
+}
+
+DECL_THUNK2(void, Context, setSourceOrientations,, ArrayView<Source>, ArrayView<Vector3Pair>)
+void ContextImpl::setSourceOrientations(ArrayView<Source> sources, ArrayView<Vector3Pair> orientations)
+{
+    CheckContext(this);
+    checkBulkSources(sources, orientations.size());
+    for(size_t i = 0;i < sources.size();++i)
+        mBulkProps.setOrientation(sources[i].getHandle(), orientations[i]);
+}
+
+
+DECL_THUNK1(void, Context, setAudibilityThreshold,, ALfloat)
+void ContextImpl::setAudibilityThreshold(ALfloat gain)
+{
+    if(!(gain >= 0.0f && gain <= 1.0f))
+        throw std::out_of_range("Audibility threshold out of range");
+    CheckContext(this);
+
+    if(gain > 0.0f && !(mAudibilityThreshold > 0.0f))
+    {
+        for(const SourceBufferUpdateEntry &entry : mPlaySources)
+            mAudibility.add(entry.mSource, entry.mSource->getAudibilityParams());
+        for(SourceImpl *source : mVirtualSources)
+            mAudibility.add(source, source->getAudibilityParams());
+    }
+    else if(!(gain > 0.0f) && mAudibilityThreshold > 0.0f)
+    {
+        for(SourceImpl *source : mVirtualSources)
+        {
+            if(!source->mCulled) continue;
+            source->mCulled = false;
+            if(!source->isPaused())
+                mVirtualHeap.push(source);
+        }
+        mAudibility.clear();
+    }
+    mAudibilityThreshold = gain;
+}
+
+DECL_THUNK1(void, Context, setDeferredCalls,, bool)
+void ContextImpl::setDeferredCalls(bool enable)
+{
+    CheckContext(this);
+    if(enable)
+    {
+        mDeferThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        mDeferCalls.store(true, std::memory_order_release);
+    }
+    else
+    {
+        mDeferCalls.store(false, std::memory_order_release);
+        applyCommands();
+    }
+}
+DECL_THUNK0(bool, Context, getDeferredCalls, const)
+
+
+namespace {
+
+// The command queues of the calling thread, one for each context it's queued
+// calls for. They're retired when the thread exits, so contexts don't keep
+// queues for every thread that ever queued a call.
+struct ThreadCommandQueues {
+    Vector<std::pair<uint64_t,SharedPtr<CommandQueue>>> mQueues;
+
+    ~ThreadCommandQueues()
+    {
+        for(auto &entry : mQueues)
+            entry.second->retire();
+    }
+};
+
+} // namespace
+
+CommandQueue *ContextImpl::getCommandQueue()
+{
+    // Contexts are told apart by serial rather than address, since a new
+    // context can take the place of a destroyed one.
+    static thread_local std::pair<uint64_t,CommandQueue*> cache{0, nullptr};
+    if(LIKELY(cache.first == mSerial))
+        return cache.second;
+
+    static thread_local ThreadCommandQueues queues;
+    auto iter = std::find_if(queues.mQueues.begin(), queues.mQueues.end(),
+        [this](const std::pair<uint64_t,SharedPtr<CommandQueue>> &entry) -> bool
+        { return entry.first == mSerial; }
+    );
+    if(iter == queues.mQueues.end())
+    {
+        // Drop the queues of destroyed contexts, which only this thread still
+        // holds.
+        queues.mQueues.erase(
+            std::remove_if(queues.mQueues.begin(), queues.mQueues.end(),
+                [](const std::pair<uint64_t,SharedPtr<CommandQueue>> &entry) -> bool
+                { return entry.second.use_count() == 1; }
+            ), queues.mQueues.end()
+        );
+
+        auto queue = MakeShared<CommandQueue>();
+        {
+            std::lock_guard<std::mutex> lock(mCommandQueueMutex);
+            mCommandQueues.emplace_back(queue);
+        }
+        queues.mQueues.emplace_back(mSerial, std::move(queue));
+        iter = queues.mQueues.end()-1;
+    }
+    cache = std::make_pair(mSerial, iter->second.get());
+    return cache.second;
+}
+
+void ContextImpl::applyCommands()
+{
+    std::unique_lock<std::mutex> lock(mCommandQueueMutex);
+    // Free the queues of threads that have exited once they're emptied.
+    mCommandQueues.erase(
+        std::remove_if(mCommandQueues.begin(), mCommandQueues.end(),
+            [](const SharedPtr<CommandQueue> &queue) -> bool
+            { return queue->isRetired() && queue->empty(); }
+        ), mCommandQueues.end()
+    );
+    if(std::all_of(mCommandQueues.begin(), mCommandQueues.end(),
+        [](const SharedPtr<CommandQueue> &queue) -> bool { return queue->empty(); }))
+        return;
+    lock.unlock();
+
+    Batcher batcher = getBatcher();
+    Vector<Command> overflow;
+    Command cmd;
+    for(size_t i = 0;;++i)
+    {
+        // Queues are only removed above and on destruction, so they stay valid
+        // without holding the lock while new threads add theirs.
+        lock.lock();
+        if(i >= mCommandQueues.size()) break;
+        CommandQueue *queue = mCommandQueues[i].get();
+        lock.unlock();
+
+        while(1)
+        {
+            while(queue->pop(cmd, overflow))
+                applyCommand(cmd);
+            if(overflow.empty()) break;
+            for(const Command &oflow : overflow)
+                applyCommand(oflow);
+            overflow.clear();
+        }
+    }
+}
+
+void ContextImpl::applyCommand(const Command &cmd)
+{
+    // There's no caller to throw to, so report failures instead.
+    try {
+        auto source = static_cast<SourceImpl*>(cmd.mTarget);
+        auto group = static_cast<SourceGroupImpl*>(cmd.mTarget);
+        auto listener = static_cast<ListenerImpl*>(cmd.mTarget);
+        switch(cmd.mOp)
+        {
+        case Command::SourcePlay:
+            // Nothing else can run on this thread before play holds the buffer.
+            cmd.mBuffer->removePendingUse();
+            source->play(Buffer(cmd.mBuffer));
+            break;
+        case Command::SourceStop: source->stop(); break;
+        case Command::SourcePause: source->pause(); break;
+        case Command::SourceResume: source->resume(); break;
+        case Command::SourceFadeOut:
+            source->fadeOutToStop(cmd.mFade.mGain, std::chrono::milliseconds(cmd.mFade.mDuration),
+                                  cmd.mFade.mCurve);
+            break;
+        case Command::SourceFadeIn:
+            source->fadeIn(cmd.mFade.mGain, std::chrono::milliseconds(cmd.mFade.mDuration),
+                           cmd.mFade.mCurve);
+            break;
+        case Command::SourceOffset: source->setOffset(cmd.mOffset); break;
+        case Command::SourceLooping: source->setLooping(cmd.mValues[0] != 0.0f); break;
+        case Command::SourcePitch: source->setPitch(cmd.mValues[0]); break;
+        case Command::SourceGain: source->setGain(cmd.mValues[0]); break;
+        case Command::SourcePosition: source->setPosition(cmd.mValues); break;
+        case Command::SourceVelocity: source->setVelocity(cmd.mValues); break;
+        case Command::SourceDirection: source->setDirection(cmd.mValues); break;
+        case Command::SourceOrientation: source->setOrientation(cmd.mValues); break;
+
+        case Command::GroupGain: group->setGain(cmd.mValues[0]); break;
+        case Command::GroupPitch: group->setPitch(cmd.mValues[0]); break;
+        case Command::GroupPauseAll: group->pauseAll(); break;
+        case Command::GroupResumeAll: group->resumeAll(); break;
+        case Command::GroupStopAll: group->stopAll(); break;
+
+        case Command::ListenerGain: listener->setGain(cmd.mValues[0]); break;
+        case Command::ListenerPosition: listener->setPosition(cmd.mValues); break;
+        case Command::ListenerVelocity: listener->setVelocity(cmd.mValues); break;
+        case Command::ListenerOrientation: listener->setOrientation(cmd.mValues); break;
+        }
+    }
+    catch(std::exception &e) {
+        std::cerr<< "Failed to make deferred call: "<<e.what() <<std::endl;
+    }
 }
 
 
 void ContextImpl::addStream(SourceImpl *source)
 {
-    std::lock_guard<std::mutex> lock(mSourceStreamMutex);
-    if(mThread.get_id() == std::thread::id())
-        mThread = std::thread(std::mem_fn(&ContextImpl::backgroundProc), this);
+    std::unique_lock<std::mutex> lock(mSourceStreamMutex);
+    if(mStreamThread.get_id() == std::thread::id())
+        mStreamThread = std::thread(std::mem_fn(&ContextImpl::streamProc), this);
     auto iter = std::lower_bound(mStreamingSources.begin(), mStreamingSources.end(), source);
     if(iter == mStreamingSources.end() || *iter != source)
         mStreamingSources.insert(iter, source);
+    lock.unlock();
+
+    // Wake the streaming thread so it can schedule a refill for the new
+    // stream.
+    wakeStreamThread();
+}
+
+void ContextImpl::wakeStreamThread()
+{
+    mWakeMutex.lock(); mWakeMutex.unlock();
+    mWakeStream.notify_all();
+}
+
+void ContextImpl::addReadAhead(SharedPtr<StreamReader> reader)
+{
+    std::lock_guard<std::mutex> lock(mReadAheadMutex);
+    if(mReadAheadThread.get_id() == std::thread::id())
+        mReadAheadThread = std::thread(std::mem_fn(&ContextImpl::readAheadProc), this);
+    mReadAheads.push_back(std::move(reader));
+    ++mReadAheadSignal;
+    mReadAheadCond.notify_all();
+}
+
+void ContextImpl::wakeReadAhead()
+{
+    std::lock_guard<std::mutex> lock(mReadAheadMutex);
+    ++mReadAheadSignal;
+    mReadAheadCond.notify_all();
 }
 
 void ContextImpl::removeStream(SourceImpl *source)
@@ -1613,6 +3050,8 @@ void ContextImpl::setDopplerFactor(ALfloat factor)
         throw std::out_of_range("Doppler factor out of range");
     CheckContext(this);
     alDopplerFactor(factor);
+    mDopplerFactor = factor;
+    resetStopTimes();
 }
 
 
@@ -1631,6 +3070,7 @@ void ContextImpl::setDistanceModel(DistanceModel model)
 {
     CheckContext(this);
     alDistanceModel((ALenum)model);
+    mDistanceModel = model;
 }
 
 
@@ -1638,54 +3078,66 @@ DECL_THUNK0(void, Context, update,)
 void ContextImpl::update()
 {
     CheckContext(this);
+    applyCommands();
+    if(mBulkProps.hasPending())
+    {
+        Batcher batcher = getBatcher();
+        mBulkProps.apply();
+    }
+    if(mStagedLoads > 0)
+        uploadStagedBuffers();
     mPendingSources.erase(
         std::remove_if(mPendingSources.begin(), mPendingSources.end(),
             [](PendingSource &entry) -> bool
             { return !entry.mSource->checkPending(entry.mFuture); }
         ), mPendingSources.end()
     );
-    if(!mFadingSources.empty())
-    {
-        auto cur_time = mDevice.getClockTime();
-        mFadingSources.erase(
-            std::remove_if(mFadingSources.begin(), mFadingSources.end(),
-                [cur_time](SourceFadeUpdateEntry &entry) -> bool
-                { return !entry.mSource->fadeUpdate(cur_time, entry); }
-            ), mFadingSources.end()
-        );
-    }
-    mPlaySources.erase(
-        std::remove_if(mPlaySources.begin(), mPlaySources.end(),
-            [](const SourceBufferUpdateEntry &entry) -> bool
-            { return !entry.mSource->playUpdate(entry.mId); }
-        ), mPlaySources.end()
-    );
+    if(!mFades.empty())
+        updateFades();
+    updatePlayingSources();
     mStreamSources.erase(
         std::remove_if(mStreamSources.begin(), mStreamSources.end(),
-            [](const SourceStreamUpdateEntry &entry) -> bool
-            { return !entry.mSource->playUpdate(); }
+            [this](const SourceStreamUpdateEntry &entry) -> bool
+            {
+                if(entry.mSource->playUpdate())
+                    return false;
+                mPriorityHeap.erase(entry.mSource);
+                return true;
+            }
         ), mStreamSources.end()
     );
+    if(mAudibilityThreshold > 0.0f && mVirtualVoices && mAudibility.size() > 0)
+        cullInaudibleSources();
+    if(!mVirtualSources.empty())
+        updateVirtualSources();
 
-    if(!mWakeInterval.load(std::memory_order_relaxed).count())
-    {
-        // For performance reasons, don't wait for the thread's mutex. This
-        // should be called often enough to keep up with any and all streams
-        // regardless.
-        mWakeThread.notify_all();
-    }
+    // Buffers that were in use when going over the cache budget may be
+    // evictable now, and ones that finished loading may have changed size.
+    updateCachedSizes();
+    if(UNLIKELY(mBufferCacheBudget && mBufferCacheSize > mBufferCacheBudget))
+        evictBuffers();
 
     if(hasExtension(AL::EXT_disconnect) && mIsConnected)
     {
         ALCint connected;
         alcGetIntegerv(mDevice.getALCdevice(), ALC_CONNECTED, 1, &connected);
         mIsConnected = static_cast<bool>(connected);
-        if(!mIsConnected && mMessage.get()) mMessage->deviceDisconnected(Device(&mDevice));
+        // A disconnected device stops its sources early.
+        if(!mIsConnected) resetStopTimes();
+        if(!mIsConnected) send(&MessageHandler::deviceDisconnected, Device(&mDevice));
     }
 }
 
 DECL_THUNK0(Device, Context, getDevice,)
 DECL_THUNK0(std::chrono::milliseconds, Context, getAsyncWakeInterval, const)
+DECL_THUNK0(ALuint, Context, getAsyncDecodeThreadCount, const)
+DECL_THUNK0(std::chrono::microseconds, Context, getAsyncUploadBudget, const)
+DECL_THUNK1(void, Context, setStagingPoolLimit,, size_t)
+DECL_THUNK0(size_t, Context, getStagingPoolLimit, const)
+DECL_THUNK0(StagingPoolStats, Context, getStagingPoolStats, const)
+DECL_THUNK0(UpdateStats, Context, getUpdateStats, const)
+DECL_THUNK0(bool, Context, getVirtualVoices, const)
+DECL_THUNK0(ALfloat, Context, getAudibilityThreshold, const)
 DECL_THUNK0(Listener, Context, getListener,)
 DECL_THUNK0(SharedPtr<MessageHandler>, Context, getMessageHandler, const)
 
@@ -1701,14 +3153,23 @@ void Context::MakeThreadCurrent(Context context)
 Context Context::GetThreadCurrent()
 { return Context(ContextImpl::GetThreadCurrent()); }
 
+uint64_t Context::GetLockContention()
+{ return ContextImpl::GetLockContention(); }
+
 
 DECL_THUNK1(void, Listener, setGain,, ALfloat)
 void ListenerImpl::setGain(ALfloat gain)
 {
     if(!(gain >= 0.0f))
         throw std::out_of_range("Gain out of range");
+    if(mContext->deferCall())
+    {
+        mContext->queueCommand(Command(Command::ListenerGain, this, &gain, 1));
+        return;
+    }
     CheckContext(mContext);
     alListenerf(AL_GAIN, gain);
+    mGain = gain;
 }
 
 
@@ -1716,44 +3177,89 @@ DECL_THUNK3(void, Listener, set3DParameters,, const Vector3&, const Vector3&, co
 void ListenerImpl::set3DParameters(const Vector3 &position, const Vector3 &velocity, const std::pair<Vector3,Vector3> &orientation)
 {
     static_assert(sizeof(orientation) == sizeof(ALfloat[6]), "Invalid Vector3 pair size");
+    if(mContext->deferCall())
+    {
+        const ALfloat ori[6] = { orientation.first[0], orientation.first[1], orientation.first[2],
+                                 orientation.second[0], orientation.second[1], orientation.second[2] };
+        mContext->queueCommand(Command(Command::ListenerPosition, this, position.getPtr(), 3));
+        mContext->queueCommand(Command(Command::ListenerVelocity, this, velocity.getPtr(), 3));
+        mContext->queueCommand(Command(Command::ListenerOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
     Batcher batcher = mContext->getBatcher();
     alListenerfv(AL_POSITION, position.getPtr());
     alListenerfv(AL_VELOCITY, velocity.getPtr());
     alListenerfv(AL_ORIENTATION, orientation.first.getPtr());
+    mPosition = position;
+    mVelocity = velocity;
+    mContext->resetStopTimes();
 }
 
 DECL_THUNK1(void, Listener, setPosition,, const Vector3&)
 void ListenerImpl::setPosition(const Vector3 &position)
 {
+    if(mContext->deferCall())
+    {
+        mContext->queueCommand(Command(Command::ListenerPosition, this, position.getPtr(), 3));
+        return;
+    }
     CheckContext(mContext);
     alListenerfv(AL_POSITION, position.getPtr());
+    mPosition = position;
 }
 
 DECL_THUNK1(void, Listener, setPosition,, const ALfloat*)
 void ListenerImpl::setPosition(const ALfloat *pos)
 {
+    if(mContext->deferCall())
+    {
+        mContext->queueCommand(Command(Command::ListenerPosition, this, pos, 3));
+        return;
+    }
     CheckContext(mContext);
     alListenerfv(AL_POSITION, pos);
+    mPosition = Vector3(pos);
 }
 
 DECL_THUNK1(void, Listener, setVelocity,, const Vector3&)
 void ListenerImpl::setVelocity(const Vector3 &velocity)
 {
+    if(mContext->deferCall())
+    {
+        mContext->queueCommand(Command(Command::ListenerVelocity, this, velocity.getPtr(), 3));
+        return;
+    }
     CheckContext(mContext);
     alListenerfv(AL_VELOCITY, velocity.getPtr());
+    mVelocity = velocity;
+    mContext->resetStopTimes();
 }
 
 DECL_THUNK1(void, Listener, setVelocity,, const ALfloat*)
 void ListenerImpl::setVelocity(const ALfloat *vel)
 {
+    if(mContext->deferCall())
+    {
+        mContext->queueCommand(Command(Command::ListenerVelocity, this, vel, 3));
+        return;
+    }
     CheckContext(mContext);
     alListenerfv(AL_VELOCITY, vel);
+    mVelocity = Vector3(vel);
+    mContext->resetStopTimes();
 }
 
 DECL_THUNK1(void, Listener, setOrientation,, const Vector3Pair&)
 void ListenerImpl::setOrientation(const std::pair<Vector3,Vector3> &orientation)
 {
+    if(mContext->deferCall())
+    {
+        const ALfloat ori[6] = { orientation.first[0], orientation.first[1], orientation.first[2],
+                                 orientation.second[0], orientation.second[1], orientation.second[2] };
+        mContext->queueCommand(Command(Command::ListenerOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
     alListenerfv(AL_ORIENTATION, orientation.first.getPtr());
 }
@@ -1761,6 +3267,12 @@ void ListenerImpl::setOrientation(const std::pair<Vector3,Vector3> &orientation)
 DECL_THUNK2(void, Listener, setOrientation,, const ALfloat*, const ALfloat*)
 void ListenerImpl::setOrientation(const ALfloat *at, const ALfloat *up)
 {
+    if(mContext->deferCall())
+    {
+        const ALfloat ori[6] = { at[0], at[1], at[2], up[0], up[1], up[2] };
+        mContext->queueCommand(Command(Command::ListenerOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
     ALfloat ori[6] = { at[0], at[1], at[2], up[0], up[1], up[2] };
     alListenerfv(AL_ORIENTATION, ori);
@@ -1769,6 +3281,11 @@ void ListenerImpl::setOrientation(const ALfloat *at, const ALfloat *up)
 DECL_THUNK1(void, Listener, setOrientation,, const ALfloat*)
 void ListenerImpl::setOrientation(const ALfloat *ori)
 {
+    if(mContext->deferCall())
+    {
+        mContext->queueCommand(Command(Command::ListenerOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
     alListenerfv(AL_ORIENTATION, ori);
 }
@@ -12,6 +12,13 @@
 
 #include "main.h"
 
+#include "hashindex.h"
+#include "ringbuffer.h"
+#include "command.h"
+#include "audibility.h"
+#include "fade.h"
+#include "stagingpool.h"
+#include "buffer.h"
 #include "device.h"
 #include "source.h"
 
@@ -35,6 +42,8 @@ enum class AL {
     SOFT_source_latency,
     SOFT_source_resampler,
     SOFT_source_spatialize,
+    SOFT_buffer_sub_data,
+    SOFT_events,
 
     EXT_disconnect,
 
@@ -67,9 +76,18 @@ public:
 class ListenerImpl {
     ContextImpl *const mContext;
 
+    // Kept for estimating how audible sources are, and when they may stop.
+    Vector3 mPosition;
+    Vector3 mVelocity;
+    ALfloat mGain{1.0f};
+
 public:
     ListenerImpl(ContextImpl *ctx) : mContext(ctx) { }
 
+    const Vector3 &getPosition() const { return mPosition; }
+    const Vector3 &getVelocity() const { return mVelocity; }
+    ALfloat getGain() const { return mGain; }
+
     void setGain(ALfloat gain);
 
     void set3DParameters(const Vector3 &position, const Vector3 &velocity, const std::pair<Vector3,Vector3> &orientation);
@@ -88,6 +106,10 @@ public:
 };
 
 
+// The size of the blocks decoded samples are staged in for uploading in
+// slices. Frames of up to 32 bytes fit evenly.
+constexpr size_t StagingBlockSize = 256*1024;
+
 using DecoderOrExceptT = std::variant<SharedPtr<Decoder>,std::exception_ptr>;
 using BufferOrExceptT = std::variant<Buffer,std::exception_ptr>;
 
@@ -106,6 +128,8 @@ public:
     static void MakeThreadCurrent(ContextImpl *context);
     static ContextImpl *GetThreadCurrent() { return sThreadCurrentCtx; }
 
+    static uint64_t GetLockContention();
+
     static std::atomic<uint64_t> sContextSetCount;
     mutable uint64_t mContextSetCounter{std::numeric_limits<uint64_t>::max()};
 
@@ -118,14 +142,24 @@ private:
     ListenerImpl mListener;
 
     ContextPtr mContext;
+    // Source ids not in use, how many have been generated, and how many the
+    // context can have (0 if unknown).
     Vector<ALuint> mSourceIds;
+    ALuint mSourceCount{0};
+    ALuint mSourceLimit{0};
 
     struct PendingBuffer { BufferImpl *mBuffer;  SharedFuture<Buffer> mFuture; };
     struct PendingSource { SourceImpl *mSource;  SharedFuture<Buffer> mFuture; };
-    using BufferListT = Vector<UniquePtr<BufferImpl>>;
-    using FutureBufferListT = Vector<PendingBuffer>;
+    struct BufferNameOf {
+        StringView operator()(const UniquePtr<BufferImpl> &buffer) const;
+        StringView operator()(const PendingBuffer &entry) const;
+    };
+    using BufferListT = NameHashIndex<UniquePtr<BufferImpl>,BufferNameOf>;
+    using FutureBufferListT = NameHashIndex<PendingBuffer,BufferNameOf>;
 
     DeviceImpl &mDevice;
+    // Declared before anything holding staging memory, so it goes last.
+    StagingPool mStagingPool;
     FutureBufferListT mFutureBuffers;
     BufferListT mBuffers;
     Vector<UniquePtr<SourceGroupImpl>> mSourceGroups;
@@ -135,17 +169,81 @@ private:
     Vector<SourceImpl*> mFreeSources;
 
     Vector<PendingSource> mPendingSources;
-    Vector<SourceFadeUpdateEntry> mFadingSources;
+    FadeTable mFades;
+    Vector<SourceImpl*> mFadesDone;
+    void updateFades();
     Vector<SourceBufferUpdateEntry> mPlaySources;
     Vector<SourceStreamUpdateEntry> mStreamSources;
 
+    // Ids of playing buffer sources that may have stopped, and their states,
+    // to check them all together. Also the counts from the last check.
+    Vector<ALuint> mPollIds;
+    Vector<ALint> mPollStates;
+    UpdateStats mUpdateStats{};
+    ALfloat mDopplerFactor{1.0f};
+    void updatePlayingSources();
+
+    // Ids of sources OpenAL reported as stopped, from its event thread, when
+    // it supports events. Only these are checked by update then, unless the
+    // queue filled up and some were missed.
+    static constexpr size_t StopEventQueueSize = 1024;
+    RingBuffer<ALuint> mStopEvents{StopEventQueueSize};
+    Vector<ALuint> mEventIds;
+    std::atomic<bool> mStopEventsMissed{false};
+    bool mStopEventsEnabled{false};
+    static void AL_APIENTRY EventCallback(ALenum eventType, ALuint object, ALuint param,
+        ALsizei length, const ALchar *message, void *userParam) noexcept;
+
+    // Calls on sources, source groups, and the listener made by threads other
+    // than the one that enabled deferring them, queued by each thread for
+    // update to make. Queues are kept until the context is destroyed, and
+    // found by each thread through a cache keyed on the context's serial.
+    static std::atomic<uint64_t> sNextSerial;
+    const uint64_t mSerial{sNextSerial.fetch_add(1, std::memory_order_relaxed)};
+    std::atomic<bool> mDeferCalls{false};
+    std::atomic<std::thread::id> mDeferThread{std::thread::id()};
+    std::mutex mCommandQueueMutex;
+    Vector<SharedPtr<CommandQueue>> mCommandQueues;
+    CommandQueue *getCommandQueue();
+    void applyCommand(const Command &cmd);
+
+    // The sources in mPlaySources and mStreamSources, lowest priority first,
+    // to find the one to stop or make virtual when out of source ids.
+    SourcePriorityHeap<false> mPriorityHeap;
+
+    // Sources playing buffers without an OpenAL source, and those of them not
+    // paused, highest priority first, to give source ids to as they free up.
+    bool mVirtualVoices{false};
+    Vector<SourceImpl*> mVirtualSources;
+    SourcePriorityHeap<true> mVirtualHeap;
+    void updateVirtualSources();
+
+    // The gain below which playing buffer sources are made virtual, or 0 to
+    // not cull sources, and the parameters used to estimate their gain.
+    // Culled sources aren't given a source id again until they're audible.
+    ALfloat mAudibilityThreshold{0.0f};
+    AudibilityTable mAudibility;
+    Vector<std::pair<SourceImpl*,bool>> mCullChanges;
+    DistanceModel mDistanceModel{DistanceModel::InverseClamped};
+    void cullInaudibleSources();
+
+    // 3D properties set in bulk, applied on the next update.
+    BulkSourceProps mBulkProps;
+    void checkBulkSources(ArrayView<Source> sources, size_t count) const;
+
+    bool genSourceIds(ALuint count);
+
     Vector<SourceImpl*> mStreamingSources;
     std::mutex mSourceStreamMutex;
 
     std::atomic<std::chrono::milliseconds> mWakeInterval{std::chrono::milliseconds::zero()};
     std::mutex mWakeMutex;
     std::condition_variable mWakeThread;
+    std::condition_variable mWakeStream;
 
+    // Messages are also sent from the background threads, which don't hold
+    // the global context lock.
+    mutable std::mutex mMessageMutex;
     SharedPtr<MessageHandler> mMessage;
 
     struct PendingPromise {
@@ -154,24 +252,96 @@ private:
         ALenum mFormat{AL_NONE};
         ALuint mFrames{0};
         Promise<Buffer> mPromise;
+        bool mStaged{false};
+        std::chrono::steady_clock::time_point mStartTime;
 
-        std::atomic<PendingPromise*> mNext;
+        std::atomic<PendingPromise*> mNext{nullptr};
 
         PendingPromise() = default;
         PendingPromise(BufferImpl *buffer, SharedPtr<Decoder> decoder, ALenum format,
-                       ALuint frames, Promise<Buffer> promise)
+                       ALuint frames, Promise<Buffer> promise, bool staged)
           : mBuffer(buffer), mDecoder(std::move(decoder)), mFormat(format), mFrames(frames)
-          , mPromise(std::move(promise))
+          , mPromise(std::move(promise)), mStaged(staged)
+          , mStartTime(std::chrono::steady_clock::now())
         { }
     };
     std::atomic<PendingPromise*> mPendingCurrent{nullptr};
     PendingPromise *mPendingTail{nullptr};
     PendingPromise *mPendingHead{nullptr};
 
+    // Pending buffers handed off to the decode workers, and decoded buffers
+    // waiting for the background thread to upload them. Staged buffers are
+    // instead decoded into staging blocks and wait for update to upload them.
+    struct DecodeJob {
+        BufferImpl *mBuffer;
+        SharedPtr<Decoder> mDecoder;
+        ALenum mFormat;
+        ALuint mFrames;
+        Promise<Buffer> mPromise;
+        bool mStaged;
+        std::chrono::steady_clock::time_point mStartTime;
+
+        Vector<ALbyte> mData;
+        ArrayView<ALbyte> mSamples;
+        StagedSamples mStaging;
+        std::pair<uint64_t,uint64_t> mLoopPts{0, 0};
+        BufferLoadTiming mTiming{};
+        // Set if decoding failed, to be given to the promise.
+        std::exception_ptr mError;
+
+        DecodeJob(PendingPromise &pb)
+          : mBuffer(pb.mBuffer), mDecoder(std::move(pb.mDecoder)), mFormat(pb.mFormat)
+          , mFrames(pb.mFrames), mPromise(std::move(pb.mPromise)), mStaged(pb.mStaged)
+          , mStartTime(pb.mStartTime)
+        { }
+    };
+    std::deque<DecodeJob> mDecodeJobs;
+    std::deque<DecodeJob> mDecodedJobs;
+    std::deque<DecodeJob> mStagedJobs;
+    ALuint mDecodeThreadCount{0};
+    bool mQuitDecode{false};
+    std::mutex mDecodeMutex;
+    std::condition_variable mDecodeCond;
+    std::condition_variable mStagedCond;
+    Vector<std::thread> mDecodeThreads;
+    void decodeProc();
+    void stopDecodeThreads();
+    void decodeJob(DecodeJob &job);
+    void finishJob(DecodeJob &job);
+
+    // Staged buffers being uploaded by update, the number of staged buffers
+    // not yet uploaded, and the upload rate seen so far (in bytes per
+    // nanosecond), used to size slices to the budget.
+    std::deque<DecodeJob> mUploadJobs;
+    size_t mStagedLoads{0};
+    double mUploadRate{0.0};
+    std::chrono::microseconds mUploadBudget{std::chrono::microseconds::zero()};
+    bool uploadStagedStep(DecodeJob &job, size_t maxbytes);
+    void uploadStagedBuffers();
+    void finishStagedBuffer(BufferImpl *buffer);
+
     std::atomic<bool> mQuitThread{false};
     std::thread mThread;
     void backgroundProc();
 
+    // Streaming sources are refilled on their own thread, so loading large
+    // buffers in the background can't make them underrun.
+    std::thread mStreamThread;
+    void streamProc();
+
+    // Streams decoding ahead, and the thread decoding for them.
+    Vector<SharedPtr<StreamReader>> mReadAheads;
+    uint64_t mReadAheadSignal{0};
+    std::atomic<bool> mQuitReadAhead{false};
+    std::mutex mReadAheadMutex;
+    std::condition_variable mReadAheadCond;
+    std::thread mReadAheadThread;
+    void readAheadProc();
+
+    bool waitForCurrent(std::unique_lock<std::mutex> &ctxlock, std::condition_variable &cond);
+    std::mutex &setBackgroundContext(std::mutex &private_mutex);
+    void stopThreads();
+
     size_t mRefs{0};
 
     Vector<String> mResamplers;
@@ -181,9 +351,27 @@ private:
     std::once_flag mSetExts;
     void setupExts();
 
+    // Cached buffers, most recently used first, and the memory they use.
+    BufferImpl *mLruHead{nullptr};
+    BufferImpl *mLruTail{nullptr};
+    size_t mBufferCacheSize{0};
+    size_t mBufferCacheBudget{0};
+    void addCachedBuffer(BufferImpl *buffer, size_t size);
+    void removeCachedBuffer(BufferImpl *buffer);
+    void resizeCachedBuffer(BufferImpl *buffer, size_t size);
+
+    // Asynchronously loaded buffers are accounted for at the size they're
+    // expected to have. Once loaded, their real sizes are left here for this
+    // thread to correct them with.
+    mutable std::mutex mLoadedSizeMutex;
+    Vector<std::pair<BufferImpl*,size_t>> mLoadedSizes;
+    void addLoadedSize(BufferImpl *buffer, size_t size);
+    void updateCachedSizes();
+    void evictBuffers(BufferImpl *keep=nullptr);
+
     DecoderOrExceptT findDecoder(StringView name);
-    BufferOrExceptT doCreateBuffer(StringView name, size_t name_hash, BufferListT::const_iterator iter, SharedPtr<Decoder> decoder);
-    BufferOrExceptT doCreateBufferAsync(StringView name, size_t name_hash, BufferListT::const_iterator iter, SharedPtr<Decoder> decoder, Promise<Buffer> promise);
+    BufferOrExceptT doCreateBuffer(StringView name, size_t name_hash, SharedPtr<Decoder> decoder);
+    BufferOrExceptT doCreateBufferAsync(StringView name, size_t name_hash, SharedPtr<Decoder> decoder, Promise<Buffer> promise);
 
     bool mIsConnected : 1;
     bool mIsBatching : 1;
@@ -201,6 +389,9 @@ public:
     LPALGETSTRINGISOFT alGetStringiSOFT{nullptr};
     LPALGETSOURCEI64VSOFT alGetSourcei64vSOFT{nullptr};
     LPALGETSOURCEDVSOFT alGetSourcedvSOFT{nullptr};
+    PFNALBUFFERSUBDATASOFTPROC alBufferSubDataSOFT{nullptr};
+    LPALEVENTCONTROLSOFT alEventControlSOFT{nullptr};
+    LPALEVENTCALLBACKSOFT alEventCallbackSOFT{nullptr};
 
     LPALGENEFFECTS alGenEffects{nullptr};
     LPALDELETEEFFECTS alDeleteEffects{nullptr};
@@ -238,26 +429,67 @@ public:
     LPALGETAUXILIARYEFFECTSLOTF alGetAuxiliaryEffectSlotf{nullptr};
     LPALGETAUXILIARYEFFECTSLOTFV alGetAuxiliaryEffectSlotfv{nullptr};
 
-    FutureBufferListT::const_iterator findFutureBufferName(StringView name, size_t name_hash) const;
-    BufferListT::const_iterator findBufferName(StringView name, size_t name_hash) const;
-
-    ALuint getSourceId(ALuint maxprio);
+    // Gets a free source id, making one or taking one from a lower priority
+    // source if needed. If none can be had, this throws, or returns 0 if the
+    // source can be virtual and virtual voices are enabled.
+    ALuint getSourceId(ALuint maxprio, bool can_virtualize=false);
     void insertSourceId(ALuint id) { mSourceIds.push_back(id); }
 
     void addPendingSource(SourceImpl *source, SharedFuture<Buffer> future);
     void removePendingSource(SourceImpl *source);
     bool isPendingSource(const SourceImpl *source) const;
-    void addFadingSource(SourceImpl *source, std::chrono::nanoseconds duration, ALfloat gain);
+    void addFadingSource(SourceImpl *source, std::chrono::nanoseconds duration, ALfloat gain,
+                         FadeCurve curve, bool fade_in);
     void removeFadingSource(SourceImpl *source);
     void addPlayingSource(SourceImpl *source, ALuint id);
     void addPlayingSource(SourceImpl *source);
     void removePlayingSource(SourceImpl *source);
+    void updatePlayingPriority(SourceImpl *source);
+    void addVirtualSource(SourceImpl *source);
+    void virtualizeSource(SourceImpl *source);
+    void setVirtualPaused(SourceImpl *source, bool paused);
+    void updateAudibleSource(SourceImpl *source)
+    { mAudibility.update(source, source->getAudibilityParams()); }
+    void cancelBulkProps(SourceImpl *source, unsigned props)
+    { mBulkProps.cancel(source, props); }
+
+    // Whether a call on a source, source group, or the listener should be
+    // queued instead of made now.
+    bool deferCall() const
+    {
+        return mDeferCalls.load(std::memory_order_acquire) &&
+               mDeferThread.load(std::memory_order_relaxed) != std::this_thread::get_id();
+    }
+    // Throws if the call would have to be queued, for calls that can't be.
+    // Made from another thread, they would race with update.
+    void checkCallThread() const
+    {
+        if(UNLIKELY(deferCall()))
+            throw std::runtime_error("Call can't be deferred from another thread");
+    }
+    void queueCommand(const Command &cmd) { getCommandQueue()->push(cmd); }
+    // Makes the calls queued so far.
+    void applyCommands();
+    // Forgets when playing sources could stop, after something changed that
+    // can make them stop sooner.
+    void resetStopTime(SourceImpl *source);
+    void resetStopTimes();
 
     void addStream(SourceImpl *source);
     void removeStream(SourceImpl *source);
     void removeStreamNoLock(SourceImpl *source);
+    void wakeStreamThread();
+
+    void addReadAhead(SharedPtr<StreamReader> reader);
+    void wakeReadAhead();
+
+    StagingPool &getStagingPool() { return mStagingPool; }
 
-    void freeSource(SourceImpl *source) { mFreeSources.push_back(source); }
+    void freeSource(SourceImpl *source)
+    {
+        mBulkProps.remove(source);
+        mFreeSources.push_back(source);
+    }
     void freeSourceGroup(SourceGroupImpl *group);
     void freeEffectSlot(AuxiliaryEffectSlotImpl *slot);
     void freeEffect(EffectImpl *effect);
@@ -275,7 +507,10 @@ public:
 
     template<typename R, typename... Args>
     void send(R MessageHandler::* func, Args&&... args)
-    { if(mMessage.get()) (mMessage.get()->*func)(std::forward<Args>(args)...); }
+    {
+        SharedPtr<MessageHandler> handler = getMessageHandler();
+        if(handler.get()) (handler.get()->*func)(std::forward<Args>(args)...);
+    }
 
     Device getDevice() { return Device(&mDevice); }
 
@@ -287,11 +522,27 @@ public:
     Listener getListener() { return Listener(&mListener); }
 
     SharedPtr<MessageHandler> setMessageHandler(SharedPtr<MessageHandler>&& handler);
-    SharedPtr<MessageHandler> getMessageHandler() const { return mMessage; }
+    SharedPtr<MessageHandler> getMessageHandler() const
+    {
+        std::lock_guard<std::mutex> lock(mMessageMutex);
+        return mMessage;
+    }
 
     void setAsyncWakeInterval(std::chrono::milliseconds interval);
     std::chrono::milliseconds getAsyncWakeInterval() const { return mWakeInterval.load(); }
 
+    void setAsyncDecodeThreadCount(ALuint count);
+    ALuint getAsyncDecodeThreadCount() const { return static_cast<ALuint>(mDecodeThreads.size()); }
+
+    void setAsyncUploadBudget(std::chrono::microseconds budget);
+    std::chrono::microseconds getAsyncUploadBudget() const { return mUploadBudget; }
+
+    void setStagingPoolLimit(size_t limit) { mStagingPool.setLimit(limit); }
+    size_t getStagingPoolLimit() const { return mStagingPool.getLimit(); }
+    StagingPoolStats getStagingPoolStats() const { return mStagingPool.getStats(); }
+
+    UpdateStats getUpdateStats() const { return mUpdateStats; }
+
     SharedPtr<Decoder> createDecoder(StringView name);
 
     bool isSupported(ChannelConfig channels, SampleType type) const;
@@ -309,7 +560,27 @@ public:
     void removeBuffer(StringView name);
     void removeBuffer(Buffer buffer) { removeBuffer(buffer.getName()); }
 
+    void setBufferCacheBudget(size_t bytes);
+    size_t getBufferCacheBudget() const { return mBufferCacheBudget; }
+    size_t getBufferCacheSize() const;
+    Vector<BufferInfo> getBufferInfo(ArrayView<Buffer> buffers) const;
+    void touchBuffer(BufferImpl *buffer);
+
     Source createSource();
+    ALuint reserveSources(ALuint count);
+
+    void setVirtualVoices(bool enable);
+    bool getVirtualVoices() const { return mVirtualVoices; }
+
+    void setAudibilityThreshold(ALfloat gain);
+    ALfloat getAudibilityThreshold() const { return mAudibilityThreshold; }
+
+    void setDeferredCalls(bool enable);
+    bool getDeferredCalls() const { return mDeferCalls.load(std::memory_order_acquire); }
+
+    void setSourcePositions(ArrayView<Source> sources, ArrayView<Vector3> positions);
+    void setSourceVelocities(ArrayView<Source> sources, ArrayView<Vector3> velocities);
+    void setSourceOrientations(ArrayView<Source> sources, ArrayView<Vector3Pair> orientations);
 
     AuxiliaryEffectSlot createAuxiliaryEffectSlot();
 
@@ -336,6 +607,7 @@ inline void CheckContext(const ContextImpl &ctx)
             throw std::runtime_error("Called context is not current");
         ctx.mContextSetCounter = count;
     }
+    ctx.checkCallThread();
 }
 
 inline void CheckContexts(const ContextImpl &ctx0, const ContextImpl &ctx1)
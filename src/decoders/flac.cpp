@@ -6,6 +6,8 @@
 #include <cstring>
 
 #include "main.h"
+#include "memreader.h"
+#include "sampleconv.h"
 
 #include "FLAC/all.h"
 
@@ -15,6 +17,8 @@ namespace alure
 
 class FlacDecoder final : public Decoder {
     UniquePtr<std::istream> mFile;
+    // Reads memory streams directly, rather than through the stream.
+    UniquePtr<MemoryReader> mReader;
 
     FLAC__StreamDecoder *mFlacFile{nullptr};
     ChannelConfig mChannelConfig{ChannelConfig::Mono};
@@ -32,46 +36,16 @@ class FlacDecoder final : public Decoder {
     void CopySamples(ALubyte *output, ALuint todo, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], ALuint offset)
     {
         if(mSampleType == SampleType::UInt8)
-        {
-            int shift = 8 - frame->header.bits_per_sample;
-            ALubyte *samples = output;
-            for(ALuint c = 0;c < frame->header.channels;c++)
-            {
-                for(ALuint i = 0;i < todo;i++)
-                    samples[i*frame->header.channels + c] = ALubyte((buffer[c][offset+i]<<shift) + 0x80);
-            }
-        }
+            InterleaveUInt8(output, buffer, frame->header.channels, offset, todo,
+                            8 - frame->header.bits_per_sample);
         else if(mSampleType == SampleType::Int16)
-        {
-            int shift = 16 - frame->header.bits_per_sample;
-            ALshort *samples = reinterpret_cast<ALshort*>(output);
-            if(shift >= 0)
-            {
-                for(ALuint c = 0;c < frame->header.channels;c++)
-                {
-                    for(ALuint i = 0;i < todo;i++)
-                        samples[i*frame->header.channels + c] = buffer[c][offset+i] << shift;
-                }
-            }
-            else
-            {
-                shift = -shift;
-                for(ALuint c = 0;c < frame->header.channels;c++)
-                {
-                    for(ALuint i = 0;i < todo;i++)
-                        samples[i*frame->header.channels + c] = buffer[c][offset+i] >> shift;
-                }
-            }
-        }
+            InterleaveInt16(reinterpret_cast<ALshort*>(output), buffer, frame->header.channels,
+                            offset, todo, 16 - frame->header.bits_per_sample);
         else
         {
             ALfloat scale = 1.0f / (float)(1<<(frame->header.bits_per_sample-1));
-            ALfloat *samples = reinterpret_cast<ALfloat*>(output);
-            for(ALuint c = 0;c < frame->header.channels;c++)
-            {
-                for(ALuint i = 0;i < todo;i++)
-                    samples[i*frame->header.channels + c] = (ALfloat)buffer[c][offset+i] * scale;
-            }
+            InterleaveFloat32(reinterpret_cast<ALfloat*>(output), buffer, frame->header.channels,
+                              offset, todo, scale);
         }
     }
 
@@ -112,10 +86,20 @@ class FlacDecoder final : public Decoder {
                 return;
 
             const FLAC__StreamMetadata_StreamInfo &info = mdata->data.stream_info;
+            // FLAC's channel orders for 4, 6, 7, and 8 channels match
+            // OpenAL's. 3 and 5 channels have no matching configuration.
             if(info.channels == 1)
                 self->mChannelConfig = ChannelConfig::Mono;
             else if(info.channels == 2)
                 self->mChannelConfig = ChannelConfig::Stereo;
+            else if(info.channels == 4)
+                self->mChannelConfig = ChannelConfig::Quad;
+            else if(info.channels == 6)
+                self->mChannelConfig = ChannelConfig::X51;
+            else if(info.channels == 7)
+                self->mChannelConfig = ChannelConfig::X61;
+            else if(info.channels == 8)
+                self->mChannelConfig = ChannelConfig::X71;
             else
                 return;
 
@@ -186,12 +170,20 @@ class FlacDecoder final : public Decoder {
 
     static FLAC__StreamDecoderReadStatus ReadCallback(const FLAC__StreamDecoder*, FLAC__byte buffer[], size_t *bytes, void *client_data)
     {
-        std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
-        stream->clear();
-
         if(*bytes <= 0)
             return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
 
+        if(MemoryReader *reader = static_cast<FlacDecoder*>(client_data)->mReader.get())
+        {
+            *bytes = reader->read(buffer, *bytes);
+            if(*bytes == 0)
+                return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+            return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+        }
+
+        std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
+        stream->clear();
+
         stream->read(reinterpret_cast<char*>(buffer), *bytes);
         *bytes = stream->gcount();
         if(*bytes == 0 && stream->eof())
@@ -201,6 +193,14 @@ class FlacDecoder final : public Decoder {
     }
     static FLAC__StreamDecoderSeekStatus SeekCallback(const FLAC__StreamDecoder*, FLAC__uint64 absolute_byte_offset, void *client_data)
     {
+        if(MemoryReader *reader = static_cast<FlacDecoder*>(client_data)->mReader.get())
+        {
+            if(absolute_byte_offset > reader->size() ||
+               !reader->seek(static_cast<int64_t>(absolute_byte_offset), SEEK_SET))
+                return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+            return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+        }
+
         std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
         stream->clear();
 
@@ -210,6 +210,12 @@ class FlacDecoder final : public Decoder {
     }
     static FLAC__StreamDecoderTellStatus TellCallback(const FLAC__StreamDecoder*, FLAC__uint64 *absolute_byte_offset, void *client_data)
     {
+        if(MemoryReader *reader = static_cast<FlacDecoder*>(client_data)->mReader.get())
+        {
+            *absolute_byte_offset = reader->tell();
+            return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+        }
+
         std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
         stream->clear();
 
@@ -218,6 +224,12 @@ class FlacDecoder final : public Decoder {
     }
     static FLAC__StreamDecoderLengthStatus LengthCallback(const FLAC__StreamDecoder*, FLAC__uint64 *stream_length, void *client_data)
     {
+        if(MemoryReader *reader = static_cast<FlacDecoder*>(client_data)->mReader.get())
+        {
+            *stream_length = reader->size();
+            return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+        }
+
         std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
         stream->clear();
 
@@ -234,6 +246,9 @@ class FlacDecoder final : public Decoder {
     }
     static FLAC__bool EofCallback(const FLAC__StreamDecoder*, void *client_data)
     {
+        if(MemoryReader *reader = static_cast<FlacDecoder*>(client_data)->mReader.get())
+            return reader->eof() ? true : false;
+
         std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
         return stream->eof() ? true : false;
     }
@@ -274,6 +289,10 @@ bool FlacDecoder::open(UniquePtr<std::istream> &file) noexcept
     {
         FLAC__stream_decoder_set_metadata_respond(mFlacFile, FLAC__METADATA_TYPE_VORBIS_COMMENT);
 
+        ArrayView<char> memory = GetStreamMemory(*file);
+        if(!memory.empty())
+            mReader = MakeUnique<MemoryReader>(memory, static_cast<size_t>(file->tellg()));
+
         mFile = std::move(file);
         if(FLAC__stream_decoder_init_stream(mFlacFile, ReadCallback, SeekCallback, TellCallback, LengthCallback, EofCallback, WriteCallback, MetadataCallback, ErrorCallback, this) == FLAC__STREAM_DECODER_INIT_STATUS_OK)
         {
@@ -288,6 +307,7 @@ bool FlacDecoder::open(UniquePtr<std::istream> &file) noexcept
         FLAC__stream_decoder_delete(mFlacFile);
         mFlacFile = nullptr;
 
+        mReader = nullptr;
         file = std::move(mFile);
     }
 
@@ -350,6 +370,11 @@ ALuint FlacDecoder::read(ALvoid *ptr, ALuint count) noexcept
 }
 
 
+bool FlacDecoderFactory::checkSignature(ArrayView<char> header) noexcept
+{
+    return header.size() >= 4 && memcmp(header.data(), "fLaC", 4) == 0;
+}
+
 SharedPtr<Decoder> FlacDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
     auto decoder = MakeShared<FlacDecoder>();
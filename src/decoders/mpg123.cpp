@@ -3,6 +3,7 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 
 #include "context.h"
 
@@ -125,6 +126,17 @@ Mpg123DecoderFactory::~Mpg123DecoderFactory()
     mIsInited = false;
 }
 
+bool Mpg123DecoderFactory::checkSignature(ArrayView<char> header) noexcept
+{
+    if(!mIsInited) return false;
+
+    // An ID3v2 tag, or an MPEG audio frame sync.
+    if(header.size() >= 3 && memcmp(header.data(), "ID3", 3) == 0)
+        return true;
+    return header.size() >= 2 && static_cast<ALubyte>(header[0]) == 0xff &&
+           (static_cast<ALubyte>(header[1])&0xe0) == 0xe0;
+}
+
 SharedPtr<Decoder> Mpg123DecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
     if(!mIsInited) return nullptr;
@@ -13,6 +13,7 @@ public:
     ~Mpg123DecoderFactory() override;
 
     SharedPtr<Decoder> createDecoder(UniquePtr<std::istream> &file) noexcept override;
+    bool checkSignature(ArrayView<char> header) noexcept override;
 };
 
 } // namespace alure
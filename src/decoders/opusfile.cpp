@@ -3,9 +3,11 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 #include <limits>
 
 #include "buffer.h"
+#include "sampleconv.h"
 
 #include "opusfile.h"
 
@@ -103,45 +105,7 @@ class OpusFileDecoder final : public Decoder {
         // 1, 2, and 4 channel files decode into the same channel order as
         // OpenAL, however 6 (5.1), 7 (6.1), and 8 (7.1) channel files need to be
         // re-ordered.
-        if(mChannelConfig == ChannelConfig::X51)
-        {
-            samples = ptr;
-            for(ALuint i = 0;i < total;++i)
-            {
-                // OpenAL : FL, FR, FC, LFE, RL, RR
-                // Opus   : FL, FC, FR,  RL, RR, LFE
-                std::swap(samples[i*6 + 1], samples[i*6 + 2]);
-                std::swap(samples[i*6 + 3], samples[i*6 + 5]);
-                std::swap(samples[i*6 + 4], samples[i*6 + 5]);
-            }
-        }
-        else if(mChannelConfig == ChannelConfig::X61)
-        {
-            samples = ptr;
-            for(ALuint i = 0;i < total;++i)
-            {
-                // OpenAL : FL, FR, FC, LFE, RC, SL, SR
-                // Opus   : FL, FC, FR,  SL, SR, RC, LFE
-                std::swap(samples[i*7 + 1], samples[i*7 + 2]);
-                std::swap(samples[i*7 + 3], samples[i*7 + 6]);
-                std::swap(samples[i*7 + 4], samples[i*7 + 5]);
-                std::swap(samples[i*7 + 5], samples[i*7 + 6]);
-            }
-        }
-        else if(mChannelConfig == ChannelConfig::X71)
-        {
-            samples = ptr;
-            for(ALuint i = 0;i < total;++i)
-            {
-                // OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
-                // Opus   : FL, FC, FR,  SL, SR, RL, RR, LFE
-                std::swap(samples[i*8 + 1], samples[i*8 + 2]);
-                std::swap(samples[i*8 + 3], samples[i*8 + 7]);
-                std::swap(samples[i*8 + 4], samples[i*8 + 5]);
-                std::swap(samples[i*8 + 5], samples[i*8 + 6]);
-                std::swap(samples[i*8 + 6], samples[i*8 + 7]);
-            }
-        }
+        ReorderVorbisChannels(ptr, total, mChannelConfig);
 
         return total;
     }
@@ -195,13 +159,32 @@ ALuint OpusFileDecoder::read(ALvoid *ptr, ALuint count) noexcept
 }
 
 
+bool OpusFileDecoderFactory::checkSignature(ArrayView<char> header) noexcept
+{
+    // The first page of an Ogg Opus file starts with the identification
+    // header packet, after a 27-byte page header and 1-byte segment table.
+    return header.size() >= 36 && memcmp(header.data(), "OggS", 4) == 0 &&
+           memcmp(header.data()+28, "OpusHead", 8) == 0;
+}
+
 SharedPtr<Decoder> OpusFileDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
     static const OpusFileCallbacks streamIO = {
         istream_read, istream_seek, istream_tell, nullptr
     };
 
-    OggOpusFilePtr oggfile(op_open_callbacks(file.get(), &streamIO, nullptr, 0, nullptr));
+    // opusfile can read memory streams directly, rather than through the
+    // stream.
+    OggOpusFilePtr oggfile;
+    ArrayView<char> memory = GetStreamMemory(*file);
+    if(!memory.empty())
+    {
+        memory = memory.slice(static_cast<size_t>(file->tellg()));
+        oggfile.reset(op_open_memory(reinterpret_cast<const unsigned char*>(memory.data()),
+                                     memory.size(), nullptr));
+    }
+    else
+        oggfile.reset(op_open_callbacks(file.get(), &streamIO, nullptr, 0, nullptr));
     if(!oggfile) return nullptr;
 
     std::pair<uint64_t,uint64_t> loop_points = { 0, std::numeric_limits<uint64_t>::max() };
@@ -2,8 +2,11 @@
 #include "vorbisfile.hpp"
 
 #include <iostream>
+#include <cstring>
 
 #include "context.h"
+#include "memreader.h"
+#include "sampleconv.h"
 
 #include "vorbis/vorbisfile.h"
 
@@ -45,6 +48,25 @@ long istream_tell(void *user_data)
 
 int istream_close(void*) { return 0; }
 
+// Callbacks for reading straight from a memory stream's memory.
+size_t memory_read(void *ptr, size_t size, size_t nmemb, void *user_data)
+{
+    alure::MemoryReader *reader = static_cast<alure::MemoryReader*>(user_data);
+    return reader->read(ptr, nmemb*size) / size;
+}
+
+int memory_seek(void *user_data, ogg_int64_t offset, int whence)
+{
+    alure::MemoryReader *reader = static_cast<alure::MemoryReader*>(user_data);
+    return reader->seek(offset, whence) ? 0 : -1;
+}
+
+long memory_tell(void *user_data)
+{
+    alure::MemoryReader *reader = static_cast<alure::MemoryReader*>(user_data);
+    return static_cast<long>(reader->tell());
+}
+
 
 struct OggVorbisfileHolder : public OggVorbis_File {
     OggVorbisfileHolder() { this->datasource = nullptr; }
@@ -58,21 +80,24 @@ namespace alure {
 
 class VorbisFileDecoder final : public Decoder {
     UniquePtr<std::istream> mFile;
+    UniquePtr<MemoryReader> mReader;
 
     OggVorbisfilePtr mOggFile;
     vorbis_info *mVorbisInfo{nullptr};
     int mOggBitstream{0};
 
     ChannelConfig mChannelConfig{ChannelConfig::Mono};
+    SampleType mSampleType{SampleType::Int16};
 
     std::pair<uint64_t,uint64_t> mLoopPoints{0, 0};
 
 public:
-    VorbisFileDecoder(UniquePtr<std::istream> file, OggVorbisfilePtr oggfile,
-                      vorbis_info *vorbisinfo, ChannelConfig sconfig,
-                      std::pair<uint64_t,uint64_t> loop_points) noexcept
-      : mFile(std::move(file)), mOggFile(std::move(oggfile)), mVorbisInfo(vorbisinfo)
-      , mChannelConfig(sconfig), mLoopPoints(loop_points)
+    VorbisFileDecoder(UniquePtr<std::istream> file, UniquePtr<MemoryReader> reader,
+                      OggVorbisfilePtr oggfile, vorbis_info *vorbisinfo, ChannelConfig sconfig,
+                      SampleType stype, std::pair<uint64_t,uint64_t> loop_points) noexcept
+      : mFile(std::move(file)), mReader(std::move(reader)), mOggFile(std::move(oggfile))
+      , mVorbisInfo(vorbisinfo), mChannelConfig(sconfig), mSampleType(stype)
+      , mLoopPoints(loop_points)
     { }
     ~VorbisFileDecoder() override { }
 
@@ -86,11 +111,14 @@ public:
     std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override;
 
     ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+
+private:
+    ALuint readFloat(ALfloat *samples, ALuint count) noexcept;
 };
 
 ALuint VorbisFileDecoder::getFrequency() const noexcept { return mVorbisInfo->rate; }
 ChannelConfig VorbisFileDecoder::getChannelConfig() const noexcept { return mChannelConfig; }
-SampleType VorbisFileDecoder::getSampleType() const noexcept { return SampleType::Int16; }
+SampleType VorbisFileDecoder::getSampleType() const noexcept { return mSampleType; }
 
 uint64_t VorbisFileDecoder::getLength() const noexcept
 {
@@ -110,6 +138,9 @@ std::pair<uint64_t,uint64_t> VorbisFileDecoder::getLoopPoints() const noexcept
 
 ALuint VorbisFileDecoder::read(ALvoid *ptr, ALuint count) noexcept
 {
+    if(mSampleType == SampleType::Float32)
+        return readFloat(static_cast<ALfloat*>(ptr), count);
+
     ALuint total = 0;
     ALshort *samples = (ALshort*)ptr;
     while(total < count)
@@ -131,58 +162,67 @@ ALuint VorbisFileDecoder::read(ALvoid *ptr, ALuint count) noexcept
     // 1, 2, and 4 channel files decode into the same channel order as
     // OpenAL, however 6 (5.1), 7 (6.1), and 8 (7.1) channel files need to be
     // re-ordered.
-    if(mChannelConfig == ChannelConfig::X51)
-    {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RL, RR
-            // Vorbis : FL, FC, FR,  RL, RR, LFE
-            std::swap(samples[i*6 + 1], samples[i*6 + 2]);
-            std::swap(samples[i*6 + 3], samples[i*6 + 5]);
-            std::swap(samples[i*6 + 4], samples[i*6 + 5]);
-        }
-    }
-    else if(mChannelConfig == ChannelConfig::X61)
-    {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RC, SL, SR
-            // Vorbis : FL, FC, FR,  SL, SR, RC, LFE
-            std::swap(samples[i*7 + 1], samples[i*7 + 2]);
-            std::swap(samples[i*7 + 3], samples[i*7 + 6]);
-            std::swap(samples[i*7 + 4], samples[i*7 + 5]);
-            std::swap(samples[i*7 + 5], samples[i*7 + 6]);
-        }
-    }
-    else if(mChannelConfig == ChannelConfig::X71)
+    ReorderVorbisChannels(static_cast<ALshort*>(ptr), total, mChannelConfig);
+
+    return total;
+}
+
+ALuint VorbisFileDecoder::readFloat(ALfloat *samples, ALuint count) noexcept
+{
+    // Interleave the decoded channels straight from libvorbis's output, which
+    // also puts them in OpenAL's order.
+    const ALubyte *chanmap = GetVorbisChannelMap(mChannelConfig);
+    const ALuint channels = mVorbisInfo->channels;
+    ALuint total = 0;
+    while(total < count)
     {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
+        float **pcm;
+        long got = ov_read_float(mOggFile.get(), &pcm, count-total, &mOggBitstream);
+        if(got <= 0) break;
+
+        for(ALuint c = 0;c < channels;++c)
         {
-            // OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
-            // Vorbis : FL, FC, FR,  SL, SR, RL, RR, LFE
-            std::swap(samples[i*8 + 1], samples[i*8 + 2]);
-            std::swap(samples[i*8 + 3], samples[i*8 + 7]);
-            std::swap(samples[i*8 + 4], samples[i*8 + 5]);
-            std::swap(samples[i*8 + 5], samples[i*8 + 6]);
-            std::swap(samples[i*8 + 6], samples[i*8 + 7]);
+            const float *src = pcm[chanmap[c]];
+            for(long i = 0;i < got;++i)
+                samples[i*channels + c] = src[i];
         }
+        samples += got * channels;
+        total += got;
     }
-
     return total;
 }
 
 
+bool VorbisFileDecoderFactory::checkSignature(ArrayView<char> header) noexcept
+{
+    // The first page of an Ogg Vorbis file starts with the identification
+    // header packet, after a 27-byte page header and 1-byte segment table.
+    return header.size() >= 35 && memcmp(header.data(), "OggS", 4) == 0 &&
+           memcmp(header.data()+28, "\x01vorbis", 7) == 0;
+}
+
 SharedPtr<Decoder> VorbisFileDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
     static const ov_callbacks streamIO = {
         istream_read, istream_seek, istream_close, istream_tell
     };
+    static const ov_callbacks memoryIO = {
+        memory_read, memory_seek, istream_close, memory_tell
+    };
+
+    // Read memory streams directly, rather than through the stream.
+    UniquePtr<MemoryReader> reader;
+    ArrayView<char> memory = GetStreamMemory(*file);
+    if(!memory.empty())
+        reader = MakeUnique<MemoryReader>(memory, static_cast<size_t>(file->tellg()));
 
     auto oggfile = MakeUnique<OggVorbisfilePtr::element_type>();
-    if(ov_open_callbacks(file.get(), oggfile.get(), NULL, 0, streamIO) != 0)
+    if(reader)
+    {
+        if(ov_open_callbacks(reader.get(), oggfile.get(), NULL, 0, memoryIO) != 0)
+            return nullptr;
+    }
+    else if(ov_open_callbacks(file.get(), oggfile.get(), NULL, 0, streamIO) != 0)
         return nullptr;
 
     vorbis_info *vorbisinfo = ov_info(oggfile.get(), -1);
@@ -243,8 +283,21 @@ SharedPtr<Decoder> VorbisFileDecoderFactory::createDecoder(UniquePtr<std::istrea
     else
         return nullptr;
 
+    SampleType type = SampleType::Int16;
+    if(GetDecoderFloatOutput())
+    {
+        try {
+            Context ctx = Context::GetCurrent();
+            if(ctx && ctx.isSupported(channels, SampleType::Float32))
+                type = SampleType::Float32;
+        }
+        catch(...) {
+        }
+    }
+
     return MakeShared<VorbisFileDecoder>(
-        std::move(file), std::move(oggfile), vorbisinfo, channels, loop_points
+        std::move(file), std::move(reader), std::move(oggfile), vorbisinfo, channels, type,
+        loop_points
     );
 }
 
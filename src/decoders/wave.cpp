@@ -76,6 +76,8 @@ namespace alure {
 
 class WaveDecoder final : public Decoder {
     UniquePtr<std::istream> mFile;
+    // The file's memory, if it's a memory stream.
+    ArrayView<char> mMemory;
 
     ChannelConfig mChannelConfig{ChannelConfig::Mono};
     SampleType mSampleType{SampleType::UInt8};
@@ -95,7 +97,16 @@ public:
                 std::istream::pos_type end, uint64_t loopstart, uint64_t loopend) noexcept
       : mFile(std::move(file)), mChannelConfig(channels), mSampleType(type), mFrequency(frequency)
       , mFrameSize(framesize), mLoopPts{loopstart,loopend}, mStart(start), mEnd(end)
-    { mCurrentPos = mFile->tellg(); }
+    {
+        mCurrentPos = mFile->tellg();
+        mMemory = GetStreamMemory(*mFile);
+        if(!mMemory.empty() && mEnd > std::streamoff(mMemory.size()))
+        {
+            // Don't read past the end of a truncated file.
+            std::streamoff size = std::streamoff(mMemory.size()) - mStart;
+            mEnd = mStart + std::max<std::streamoff>(size - size%mFrameSize, 0);
+        }
+    }
     ~WaveDecoder() override { }
 
     ALuint getFrequency() const noexcept override;
@@ -108,6 +119,7 @@ public:
     std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override;
 
     ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+    ArrayView<ALbyte> readDirect(ALuint count) noexcept override;
 };
 
 ALuint WaveDecoder::getFrequency() const noexcept { return mFrequency; }
@@ -120,9 +132,14 @@ uint64_t WaveDecoder::getLength() const noexcept
 bool WaveDecoder::seek(uint64_t pos) noexcept
 {
     std::streamsize offset = pos*mFrameSize + mStart;
-    mFile->clear();
-    if(offset > mEnd || !mFile->seekg(offset))
+    if(offset > mEnd)
         return false;
+    if(mMemory.empty())
+    {
+        mFile->clear();
+        if(!mFile->seekg(offset))
+            return false;
+    }
     mCurrentPos = offset;
     return true;
 }
@@ -131,6 +148,16 @@ std::pair<uint64_t,uint64_t> WaveDecoder::getLoopPoints() const noexcept { retur
 
 ALuint WaveDecoder::read(ALvoid *ptr, ALuint count) noexcept
 {
+#ifndef __BIG_ENDIAN__
+    if(!mMemory.empty())
+    {
+        // Copy straight out of the stream's memory.
+        ArrayView<ALbyte> samples = readDirect(count);
+        if(!samples.empty())
+            memcpy(ptr, samples.data(), samples.size());
+        return static_cast<ALuint>(samples.size() / mFrameSize);
+    }
+#endif
     mFile->clear();
 
     ALuint total = 0;
@@ -196,6 +223,32 @@ ALuint WaveDecoder::read(ALvoid *ptr, ALuint count) noexcept
     return total;
 }
 
+ArrayView<ALbyte> WaveDecoder::readDirect(ALuint count) noexcept
+{
+#ifdef __BIG_ENDIAN__
+    // Multi-byte samples need to be byte-swapped.
+    if(mSampleType != SampleType::UInt8 && mSampleType != SampleType::Mulaw)
+        return {};
+#endif
+    if(mMemory.empty() || mCurrentPos >= mEnd)
+        return {};
+
+    size_t len = static_cast<size_t>(
+        std::min<uint64_t>(uint64_t{count}*mFrameSize, mEnd-mCurrentPos)
+    );
+    ArrayView<ALbyte> samples(
+        reinterpret_cast<const ALbyte*>(mMemory.data()) + std::streamoff(mCurrentPos), len
+    );
+    mCurrentPos += len;
+    return samples;
+}
+
+
+bool WaveDecoderFactory::checkSignature(ArrayView<char> header) noexcept
+{
+    return header.size() >= 12 && memcmp(header.data(), "RIFF", 4) == 0 &&
+           memcmp(header.data()+8, "WAVE", 4) == 0;
+}
 
 SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
@@ -7,6 +7,7 @@ namespace alure {
 
 class WaveDecoderFactory final : public DecoderFactory {
     SharedPtr<Decoder> createDecoder(UniquePtr<std::istream> &file) noexcept override;
+    bool checkSignature(ArrayView<char> header) noexcept override;
 };
 
 } // namespace alure
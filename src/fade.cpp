@@ -0,0 +1,164 @@
+#include "config.h"
+
+#include "fade.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "source.h"
+
+namespace alure
+{
+
+namespace
+{
+
+// 2^x for x down to -126, within about 0.0001dB. Done with a polynomial
+// rather than a library call so the loop using it vectorizes.
+inline ALfloat FastExp2(ALfloat x)
+{
+    x = std::max(x, -126.0f);
+    const int32_t trunc = static_cast<int32_t>(x);
+    const int32_t ipart = trunc - ((x < static_cast<ALfloat>(trunc)) ? 1 : 0);
+    const ALfloat f = x - static_cast<ALfloat>(ipart);
+
+    // Taylor series of 2^f for f in [0,1).
+    const ALfloat p = 1.0f + f*(0.693147181f + f*(0.240226507f + f*(0.0555041087f +
+                      f*(0.00961812911f + f*(0.00133335581f + f*0.000154035304f)))));
+
+    const int32_t bits = (ipart+127) << 23;
+    ALfloat scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// Kept free of branches that depend on the fade, so it vectorizes. Every
+// curve is worked out for each fade and the one it uses is picked.
+void FadeGains(size_t count, ALfloat *RESTRICT gains, ALfloat *RESTRICT progress,
+    ALfloat cur_time, const ALfloat *start, const ALfloat *invdur, const ALfloat *reverse,
+    const ALfloat *target, const ALfloat *targetlog2, const ALfloat *scale, const ALint *curve)
+{
+    for(size_t i = 0;i < count;++i)
+    {
+        const ALfloat t = std::min(std::max((cur_time-start[i]) * invdur[i], 0.0f), 1.0f);
+        // How far along the curve toward the target gain.
+        const ALfloat pos = t + reverse[i]*(1.0f - 2.0f*t);
+
+        const ALfloat linear = 1.0f + pos*(target[i] - 1.0f);
+        const ALfloat power = std::sqrt(std::max(1.0f - pos*(1.0f - target[i]*target[i]), 0.0f));
+        const ALfloat expo = FastExp2(pos * targetlog2[i]);
+
+        const ALfloat gain = (curve[i] == static_cast<ALint>(FadeCurve::Linear)) ? linear :
+                             (curve[i] == static_cast<ALint>(FadeCurve::EqualPower)) ? power : expo;
+        gains[i] = gain * scale[i];
+        progress[i] = t;
+    }
+}
+
+} // namespace
+
+
+std::array<Vector<ALfloat>*,FadeTable::NumLists> FadeTable::getLists()
+{
+    return {{&mStart, &mInvDuration, &mReverse, &mTarget, &mTargetLog2, &mScale, &mGains,
+             &mProgress}};
+}
+
+void FadeTable::move(size_t dst, size_t src)
+{
+    mSources[dst] = mSources[src];
+    mSources[dst]->mFadeIndex = dst;
+    mCurve[dst] = mCurve[src];
+    for(Vector<ALfloat> *list : getLists())
+        (*list)[dst] = (*list)[src];
+}
+
+
+void FadeTable::add(SourceImpl *source, std::chrono::nanoseconds cur_time,
+                    std::chrono::nanoseconds duration, ALfloat target, ALfloat scale,
+                    FadeCurve curve, bool fade_in)
+{
+    size_t idx = source->mFadeIndex;
+    if(idx >= mSources.size() || mSources[idx] != source)
+    {
+        if(mSources.empty())
+            mEpoch = cur_time;
+        idx = mSources.size();
+        mSources.push_back(source);
+        mCurve.emplace_back();
+        for(Vector<ALfloat> *list : getLists())
+            list->emplace_back();
+        source->mFadeIndex = idx;
+    }
+
+    // Exponential curves can't reach silence, so stop short of it. The log is
+    // kept finite for the other curves too, as it's worked out for every fade.
+    const ALfloat exptarget = std::max(target, 0.0001f);
+    if(curve == FadeCurve::Exponential)
+        target = exptarget;
+
+    mStart[idx] = std::chrono::duration_cast<std::chrono::duration<ALfloat>>(cur_time - mEpoch).count();
+    mInvDuration[idx] = 1.0f / std::chrono::duration_cast<std::chrono::duration<ALfloat>>(duration).count();
+    mReverse[idx] = fade_in ? 1.0f : 0.0f;
+    mTarget[idx] = target;
+    mTargetLog2[idx] = std::log2(exptarget);
+    mScale[idx] = fade_in ? 1.0f : scale;
+    mCurve[idx] = static_cast<ALint>(curve);
+    mGains[idx] = fade_in ? target : scale;
+    mProgress[idx] = 0.0f;
+}
+
+void FadeTable::remove(SourceImpl *source)
+{
+    const size_t idx = source->mFadeIndex;
+    if(idx >= mSources.size() || mSources[idx] != source)
+        return;
+    source->mFadeIndex = SourceImpl::NoFadeIndex;
+
+    const size_t last = mSources.size()-1;
+    if(idx < last) move(idx, last);
+    mSources.pop_back();
+    mCurve.pop_back();
+    for(Vector<ALfloat> *list : getLists())
+        list->pop_back();
+}
+
+void FadeTable::clear()
+{
+    for(SourceImpl *source : mSources)
+        source->mFadeIndex = SourceImpl::NoFadeIndex;
+    mSources.clear();
+    mCurve.clear();
+    for(Vector<ALfloat> *list : getLists())
+        list->clear();
+}
+
+
+void FadeTable::update(std::chrono::nanoseconds cur_time)
+{
+    // Fades can keep overlapping so the table never empties, so move the epoch
+    // up to the oldest fade before the times since it lose precision.
+    if(!mStart.empty())
+    {
+        const ALfloat oldest = *std::min_element(mStart.begin(), mStart.end());
+        if(oldest > RebaseThreshold)
+        {
+            const auto offset = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::duration<ALfloat>(oldest)
+            );
+            const ALfloat offset_secs = std::chrono::duration_cast<
+                std::chrono::duration<ALfloat>>(offset).count();
+            mEpoch += offset;
+            for(ALfloat &start : mStart)
+                start -= offset_secs;
+        }
+    }
+
+    const ALfloat now = std::chrono::duration_cast<std::chrono::duration<ALfloat>>(cur_time - mEpoch).count();
+    FadeGains(mSources.size(), mGains.data(), mProgress.data(), now, mStart.data(),
+        mInvDuration.data(), mReverse.data(), mTarget.data(), mTargetLog2.data(), mScale.data(),
+        mCurve.data());
+}
+
+} // namespace alure
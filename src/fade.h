@@ -0,0 +1,63 @@
+#ifndef FADE_H
+#define FADE_H
+
+#include <array>
+#include <chrono>
+
+#include "main.h"
+
+namespace alure {
+
+// The fades of sources, kept as parallel arrays so the gains of all fading
+// sources can be worked out in one vectorizable pass. Sources record their
+// place in mFadeIndex, and so may only be in one table.
+//
+// Start times are kept as seconds since an epoch that's reset whenever the
+// table empties, and moved up to the oldest fade once it's RebaseThreshold
+// seconds past it, so single precision is enough for them.
+class FadeTable {
+    Vector<SourceImpl*> mSources;
+    Vector<ALfloat> mStart, mInvDuration;
+    // 1 for fades in, which run the curve backward, or 0 for fades out.
+    Vector<ALfloat> mReverse;
+    // The gain at the quiet end of the curve, and its base-2 log.
+    Vector<ALfloat> mTarget, mTargetLog2;
+    // The fade gain the source had when a fade out started.
+    Vector<ALfloat> mScale;
+    Vector<ALint> mCurve;
+    Vector<ALfloat> mGains, mProgress;
+    std::chrono::nanoseconds mEpoch{0};
+
+    static constexpr ALfloat RebaseThreshold = 4.0f;
+
+    static constexpr size_t NumLists = 8;
+    std::array<Vector<ALfloat>*,NumLists> getLists();
+    void move(size_t dst, size_t src);
+
+public:
+    size_t size() const { return mSources.size(); }
+    bool empty() const { return mSources.empty(); }
+    SourceImpl *getSource(size_t idx) const { return mSources[idx]; }
+
+    // Starts fading the source from now, replacing any fade it already has.
+    // Fades out go from scale to target*scale, and fades in from target to 1.
+    void add(SourceImpl *source, std::chrono::nanoseconds cur_time,
+             std::chrono::nanoseconds duration, ALfloat target, ALfloat scale,
+             FadeCurve curve, bool fade_in);
+    // Removes the source, if it's in the table. The last source takes its
+    // place.
+    void remove(SourceImpl *source);
+    void clear();
+
+    bool isFadeIn(size_t idx) const { return mReverse[idx] != 0.0f; }
+
+    // Works out the gain of each fade, in table order, at the given time.
+    // Fades at or past 1 in the progress list are done.
+    void update(std::chrono::nanoseconds cur_time);
+    ArrayView<ALfloat> getGains() const { return ArrayView<ALfloat>(mGains.data(), mGains.size()); }
+    ArrayView<ALfloat> getProgress() const { return ArrayView<ALfloat>(mProgress.data(), mProgress.size()); }
+};
+
+} // namespace alure
+
+#endif /* FADE_H */
@@ -0,0 +1,210 @@
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include <functional>
+
+#include "main.h"
+
+namespace std {
+
+// Implements a FNV-1a hash for StringView. NOTE: This is *NOT* guaranteed
+// compatible with std::hash<String>! The standard does not give any specific
+// hash implementation, nor a way for applications to access the same hash
+// function as std::string (short of copying into a string and hashing that).
+// So if you need Strings and StringViews to result in the same hash for the
+// same set of characters, hash StringViews created from the Strings.
+template<>
+struct hash<alure::StringView> {
+    size_t operator()(const alure::StringView &str) const noexcept
+    {
+        using traits_type = alure::StringView::traits_type;
+
+        if /*constexpr*/ (sizeof(size_t) == 8)
+        {
+            static constexpr size_t hash_offset = 0xcbf29ce484222325;
+            static constexpr size_t hash_prime = 0x100000001b3;
+
+            size_t val = hash_offset;
+            for(auto ch : str)
+                val = (val^traits_type::to_int_type(ch)) * hash_prime;
+            return val;
+        }
+        else
+        {
+            static constexpr size_t hash_offset = 0x811c9dc5;
+            static constexpr size_t hash_prime = 0x1000193;
+
+            size_t val = hash_offset;
+            for(auto ch : str)
+                val = (val^traits_type::to_int_type(ch)) * hash_prime;
+            return val;
+        }
+    }
+};
+
+}
+
+namespace alure {
+
+// An open-addressing (linear probing) hash table of named values, looked up by
+// a StringView and its std::hash<StringView>. Values are expected to be cheap
+// handles to the named objects (e.g. a UniquePtr), so the objects themselves
+// keep a stable address when the table grows. NameOf is a functor returning
+// the name of a given value.
+template<typename T, typename NameOf>
+class NameHashIndex {
+    enum class SlotState : unsigned char { Empty, Used, Deleted };
+
+    struct Slot {
+        size_t mHash{0};
+        SlotState mState{SlotState::Empty};
+        T mValue;
+    };
+    Vector<Slot> mSlots;
+    size_t mSize{0};
+    size_t mDeleted{0};
+
+    void rehash(size_t newsize)
+    {
+        Vector<Slot> oldslots(newsize);
+        oldslots.swap(mSlots);
+        mDeleted = 0;
+
+        const size_t mask = mSlots.size()-1;
+        for(Slot &slot : oldslots)
+        {
+            if(slot.mState != SlotState::Used)
+                continue;
+            size_t idx = slot.mHash & mask;
+            while(mSlots[idx].mState != SlotState::Empty)
+                idx = (idx+1) & mask;
+            mSlots[idx].mHash = slot.mHash;
+            mSlots[idx].mState = SlotState::Used;
+            mSlots[idx].mValue = std::move(slot.mValue);
+        }
+    }
+
+    size_t findSlot(StringView name, size_t hash) const noexcept
+    {
+        if(mSlots.empty()) return mSlots.size();
+
+        const size_t mask = mSlots.size()-1;
+        size_t idx = hash & mask;
+        while(mSlots[idx].mState != SlotState::Empty)
+        {
+            const Slot &slot = mSlots[idx];
+            if(slot.mState == SlotState::Used && slot.mHash == hash && NameOf()(slot.mValue) == name)
+                return idx;
+            idx = (idx+1) & mask;
+        }
+        return mSlots.size();
+    }
+
+    void eraseSlot(Slot &slot)
+    {
+        slot.mValue = T();
+        slot.mState = SlotState::Deleted;
+        --mSize;
+        ++mDeleted;
+    }
+
+public:
+    template<typename SlotT, typename ValueT>
+    class Iter {
+        SlotT *mSlot, *mEnd;
+
+        void skip() { while(mSlot != mEnd && mSlot->mState != SlotState::Used) ++mSlot; }
+
+    public:
+        Iter(SlotT *slot, SlotT *end) : mSlot(slot), mEnd(end) { skip(); }
+
+        ValueT &operator*() const { return mSlot->mValue; }
+        ValueT *operator->() const { return &mSlot->mValue; }
+
+        Iter& operator++() { ++mSlot; skip(); return *this; }
+
+        bool operator==(const Iter &rhs) const { return mSlot == rhs.mSlot; }
+        bool operator!=(const Iter &rhs) const { return mSlot != rhs.mSlot; }
+    };
+    using iterator = Iter<Slot,T>;
+    using const_iterator = Iter<const Slot,const T>;
+
+    iterator begin() { return iterator(mSlots.data(), mSlots.data()+mSlots.size()); }
+    iterator end() { return iterator(mSlots.data()+mSlots.size(), mSlots.data()+mSlots.size()); }
+    const_iterator begin() const
+    { return const_iterator(mSlots.data(), mSlots.data()+mSlots.size()); }
+    const_iterator end() const
+    { return const_iterator(mSlots.data()+mSlots.size(), mSlots.data()+mSlots.size()); }
+
+    size_t size() const noexcept { return mSize; }
+    bool empty() const noexcept { return mSize == 0; }
+
+    void clear()
+    {
+        mSlots.clear();
+        mSize = 0;
+        mDeleted = 0;
+    }
+
+    T *find(StringView name, size_t hash) noexcept
+    {
+        size_t idx = findSlot(name, hash);
+        return (idx < mSlots.size()) ? &mSlots[idx].mValue : nullptr;
+    }
+    const T *find(StringView name, size_t hash) const noexcept
+    {
+        size_t idx = findSlot(name, hash);
+        return (idx < mSlots.size()) ? &mSlots[idx].mValue : nullptr;
+    }
+
+    // Inserts a value with the given name hash. The name must not already be
+    // in the index.
+    T &insert(size_t hash, T value)
+    {
+        // Keep the load (including deleted slots) under 3/4. Only grow if the
+        // live entries need it, otherwise just clear out the deleted slots.
+        if((mSize+mDeleted+1)*4 > mSlots.size()*3)
+        {
+            size_t newsize = mSlots.empty() ? 16 : mSlots.size();
+            while((mSize+1)*2 > newsize)
+                newsize <<= 1;
+            rehash(newsize);
+        }
+
+        const size_t mask = mSlots.size()-1;
+        size_t idx = hash & mask;
+        while(mSlots[idx].mState == SlotState::Used)
+            idx = (idx+1) & mask;
+
+        Slot &slot = mSlots[idx];
+        if(slot.mState == SlotState::Deleted)
+            --mDeleted;
+        slot.mHash = hash;
+        slot.mState = SlotState::Used;
+        slot.mValue = std::move(value);
+        ++mSize;
+        return slot.mValue;
+    }
+
+    bool erase(StringView name, size_t hash)
+    {
+        size_t idx = findSlot(name, hash);
+        if(idx >= mSlots.size()) return false;
+        eraseSlot(mSlots[idx]);
+        return true;
+    }
+
+    template<typename F>
+    void eraseIf(F pred)
+    {
+        for(Slot &slot : mSlots)
+        {
+            if(slot.mState == SlotState::Used && pred(slot.mValue))
+                eraseSlot(slot);
+        }
+    }
+};
+
+} // namespace alure
+
+#endif /* HASHINDEX_H */
@@ -26,6 +26,12 @@ using mpark::holds_alternative;
 #define UNLIKELY(x) static_cast<bool>(x)
 #endif
 
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define RESTRICT __restrict
+#else
+#define RESTRICT
+#endif
+
 #define DECL_THUNK0(ret, C, Name, cv)                                         \
 ret C::Name() cv { return pImpl->Name(); }
 #define DECL_THUNK1(ret, C, Name, cv, T1)                                     \
@@ -0,0 +1,56 @@
+#ifndef MEMREADER_H
+#define MEMREADER_H
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include "main.h"
+
+namespace alure {
+
+// Reads from the memory of a memory stream (see GetStreamMemory), for
+// decoders to use in their I/O callbacks instead of going through the
+// std::istream. Positions are byte offsets into the memory, so they match the
+// stream's positions.
+class MemoryReader {
+    ArrayView<char> mData;
+    size_t mPos{0};
+
+public:
+    MemoryReader(ArrayView<char> data, size_t pos) noexcept
+      : mData(data), mPos(std::min(pos, data.size()))
+    { }
+
+    size_t read(void *ptr, size_t len) noexcept
+    {
+        len = std::min(len, mData.size()-mPos);
+        if(len > 0) memcpy(ptr, mData.data()+mPos, len);
+        mPos += len;
+        return len;
+    }
+
+    // Seeks using the stdio SEEK_* constants. Returns false if the new
+    // position would be outside of the memory.
+    bool seek(int64_t offset, int whence) noexcept
+    {
+        if(whence == SEEK_CUR)
+            offset += mPos;
+        else if(whence == SEEK_END)
+            offset += mData.size();
+        else if(whence != SEEK_SET)
+            return false;
+        if(offset < 0 || static_cast<uint64_t>(offset) > mData.size())
+            return false;
+        mPos = static_cast<size_t>(offset);
+        return true;
+    }
+
+    size_t tell() const noexcept { return mPos; }
+    size_t size() const noexcept { return mData.size(); }
+    bool eof() const noexcept { return mPos >= mData.size(); }
+};
+
+} // namespace alure
+
+#endif /* MEMREADER_H */
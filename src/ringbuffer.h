@@ -0,0 +1,61 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+
+#include "main.h"
+
+namespace alure {
+
+// A fixed-size queue for one thread to push items while another pops them,
+// without locking. The size is rounded up to a power of two, with one slot
+// kept empty to tell a full queue from an empty one.
+template<typename T>
+class RingBuffer {
+    Vector<T> mItems;
+    size_t mMask;
+    std::atomic<size_t> mWritePos{0};
+    std::atomic<size_t> mReadPos{0};
+
+    static size_t RoundUp(size_t size)
+    {
+        size_t ret = 2;
+        while(ret < size) ret <<= 1;
+        return ret;
+    }
+
+public:
+    explicit RingBuffer(size_t size) : mItems(RoundUp(size+1)), mMask(mItems.size()-1)
+    { }
+
+    bool empty() const
+    { return mReadPos.load(std::memory_order_acquire) == mWritePos.load(std::memory_order_acquire); }
+
+    // Called by the writing thread. Returns false, leaving the queue as it
+    // was, if it's full.
+    bool push(T item)
+    {
+        const size_t write = mWritePos.load(std::memory_order_relaxed);
+        const size_t next = (write+1) & mMask;
+        if(next == mReadPos.load(std::memory_order_acquire))
+            return false;
+        mItems[write] = std::move(item);
+        mWritePos.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the reading thread. Returns false if the queue is empty.
+    bool pop(T &item)
+    {
+        const size_t read = mReadPos.load(std::memory_order_relaxed);
+        if(read == mWritePos.load(std::memory_order_acquire))
+            return false;
+        item = std::move(mItems[read]);
+        mReadPos.store((read+1) & mMask, std::memory_order_release);
+        return true;
+    }
+};
+
+} // namespace alure
+
+#endif /* RINGBUFFER_H */
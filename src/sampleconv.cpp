@@ -0,0 +1,449 @@
+
+#include "config.h"
+
+#include "sampleconv.h"
+
+#include <type_traits>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+using namespace alure;
+
+#ifdef USE_SSE2
+// Transposes four vectors of four channels' samples into four frames.
+inline void Transpose4(__m128i &v0, __m128i &v1, __m128i &v2, __m128i &v3)
+{
+    __m128i t0 = _mm_unpacklo_epi32(v0, v1);
+    __m128i t1 = _mm_unpacklo_epi32(v2, v3);
+    __m128i t2 = _mm_unpackhi_epi32(v0, v1);
+    __m128i t3 = _mm_unpackhi_epi32(v2, v3);
+    v0 = _mm_unpacklo_epi64(t0, t1);
+    v1 = _mm_unpackhi_epi64(t0, t1);
+    v2 = _mm_unpacklo_epi64(t2, t3);
+    v3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Reorders N vectors, each holding four samples of one channel, into the
+// interleaved order of the four frames.
+inline void InterleaveLanes(__m128i (&)[1])
+{ }
+inline void InterleaveLanes(__m128i (&v)[2])
+{
+    __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+    __m128i t1 = _mm_unpackhi_epi32(v[0], v[1]);
+    v[0] = t0;
+    v[1] = t1;
+}
+inline void InterleaveLanes(__m128i (&v)[4])
+{ Transpose4(v[0], v[1], v[2], v[3]); }
+inline void InterleaveLanes(__m128i (&v)[6])
+{
+    // The last two channels of each frame are paired up, then placed between
+    // the transposed first four.
+    Transpose4(v[0], v[1], v[2], v[3]);
+    __m128i ef01 = _mm_unpacklo_epi32(v[4], v[5]);
+    __m128i ef23 = _mm_unpackhi_epi32(v[4], v[5]);
+    __m128i t[6]{
+        v[0], _mm_unpacklo_epi64(ef01, v[1]), _mm_unpackhi_epi64(v[1], ef01),
+        v[2], _mm_unpacklo_epi64(ef23, v[3]), _mm_unpackhi_epi64(v[3], ef23)
+    };
+    std::copy(std::begin(t), std::end(t), std::begin(v));
+}
+inline void InterleaveLanes(__m128i (&v)[8])
+{
+    Transpose4(v[0], v[1], v[2], v[3]);
+    Transpose4(v[4], v[5], v[6], v[7]);
+    __m128i t[8]{v[0], v[4], v[1], v[5], v[2], v[6], v[3], v[7]};
+    std::copy(std::begin(t), std::end(t), std::begin(v));
+}
+
+inline __m128i Load(const ALint *src)
+{ return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)); }
+
+template<size_t N>
+inline void StoreInt16(ALshort *dst, const __m128i (&v)[N])
+{
+    if(N == 1)
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packs_epi32(v[0], v[0]));
+    else for(size_t k = 0;k+1 < N;k += 2)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + k*4), _mm_packs_epi32(v[k], v[k+1]));
+}
+#endif /* USE_SSE2 */
+
+
+// The conversions, as a scalar operator() and, where supported, a vector
+// convert (four samples of one channel) and store (four frames of N channels).
+struct UInt8Conv {
+    int mShift;
+
+    ALubyte operator()(ALint s) const
+    { return static_cast<ALubyte>((static_cast<ALuint>(s)<<mShift) + 0x80); }
+
+#ifdef USE_SSE2
+    static constexpr bool Simd = true;
+    using vec_t = __m128i;
+
+    vec_t convert(const ALint *src) const
+    {
+        return _mm_add_epi32(_mm_sll_epi32(Load(src), _mm_cvtsi32_si128(mShift)),
+                             _mm_set1_epi32(0x80));
+    }
+    template<size_t N>
+    void store(ALubyte *dst, vec_t (&v)[N]) const
+    {
+        InterleaveLanes(v);
+        for(size_t k = 0;k < N;++k)
+        {
+            __m128i p = _mm_packs_epi32(v[k], v[k]);
+            ALint out = _mm_cvtsi128_si32(_mm_packus_epi16(p, p));
+            memcpy(dst + k*4, &out, 4);
+        }
+    }
+#else
+    static constexpr bool Simd = false;
+#endif
+};
+
+struct ShlInt16 {
+    int mShift;
+
+    ALshort operator()(ALint s) const
+    { return static_cast<ALshort>(static_cast<ALuint>(s) << mShift); }
+
+#ifdef USE_SSE2
+    static constexpr bool Simd = true;
+    using vec_t = __m128i;
+
+    vec_t convert(const ALint *src) const
+    { return _mm_sll_epi32(Load(src), _mm_cvtsi32_si128(mShift)); }
+    template<size_t N>
+    void store(ALshort *dst, vec_t (&v)[N]) const
+    { InterleaveLanes(v); StoreInt16(dst, v); }
+#elif defined(USE_NEON)
+    static constexpr bool Simd = true;
+    using vec_t = int32x4_t;
+
+    vec_t convert(const ALint *src) const
+    { return vshlq_s32(vld1q_s32(src), vdupq_n_s32(mShift)); }
+#else
+    static constexpr bool Simd = false;
+#endif
+};
+
+struct SarInt16 {
+    int mShift;
+
+    ALshort operator()(ALint s) const
+    { return static_cast<ALshort>(s >> mShift); }
+
+#ifdef USE_SSE2
+    static constexpr bool Simd = true;
+    using vec_t = __m128i;
+
+    vec_t convert(const ALint *src) const
+    { return _mm_sra_epi32(Load(src), _mm_cvtsi32_si128(mShift)); }
+    template<size_t N>
+    void store(ALshort *dst, vec_t (&v)[N]) const
+    { InterleaveLanes(v); StoreInt16(dst, v); }
+#elif defined(USE_NEON)
+    static constexpr bool Simd = true;
+    using vec_t = int32x4_t;
+
+    // NEON shifts right with a negative shift.
+    vec_t convert(const ALint *src) const
+    { return vshlq_s32(vld1q_s32(src), vdupq_n_s32(-mShift)); }
+#else
+    static constexpr bool Simd = false;
+#endif
+};
+
+struct Float32Conv {
+    ALfloat mScale;
+
+    ALfloat operator()(ALint s) const
+    { return static_cast<ALfloat>(s) * mScale; }
+
+#ifdef USE_SSE2
+    static constexpr bool Simd = true;
+    using vec_t = __m128i;
+
+    vec_t convert(const ALint *src) const
+    { return _mm_castps_si128(_mm_mul_ps(_mm_cvtepi32_ps(Load(src)), _mm_set1_ps(mScale))); }
+    template<size_t N>
+    void store(ALfloat *dst, vec_t (&v)[N]) const
+    {
+        InterleaveLanes(v);
+        for(size_t k = 0;k < N;++k)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + k*4), v[k]);
+    }
+#elif defined(USE_NEON)
+    static constexpr bool Simd = true;
+    using vec_t = float32x4_t;
+
+    vec_t convert(const ALint *src) const
+    { return vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src)), mScale); }
+#else
+    static constexpr bool Simd = false;
+#endif
+};
+
+#ifdef USE_NEON
+// NEON's structured stores interleave 2 and 4 channels as they store. Both
+// Int16 conversions narrow the same way.
+template<typename Conv>
+void StoreNeon(ALshort *dst, int32x4_t (&v)[1], const Conv&)
+{ vst1_s16(dst, vmovn_s32(v[0])); }
+template<typename Conv>
+void StoreNeon(ALshort *dst, int32x4_t (&v)[2], const Conv&)
+{
+    int16x4x2_t out;
+    out.val[0] = vmovn_s32(v[0]);
+    out.val[1] = vmovn_s32(v[1]);
+    vst2_s16(dst, out);
+}
+template<typename Conv>
+void StoreNeon(ALshort *dst, int32x4_t (&v)[4], const Conv&)
+{
+    int16x4x4_t out;
+    for(size_t k = 0;k < 4;++k)
+        out.val[k] = vmovn_s32(v[k]);
+    vst4_s16(dst, out);
+}
+
+inline void StoreNeon(ALfloat *dst, float32x4_t (&v)[1], const Float32Conv&)
+{ vst1q_f32(dst, v[0]); }
+inline void StoreNeon(ALfloat *dst, float32x4_t (&v)[2], const Float32Conv&)
+{
+    float32x4x2_t out;
+    out.val[0] = v[0];
+    out.val[1] = v[1];
+    vst2q_f32(dst, out);
+}
+inline void StoreNeon(ALfloat *dst, float32x4_t (&v)[4], const Float32Conv&)
+{
+    float32x4x4_t out;
+    for(size_t k = 0;k < 4;++k)
+        out.val[k] = v[k];
+    vst4q_f32(dst, out);
+}
+#endif /* USE_NEON */
+
+
+// Which channel counts are converted four frames at a time.
+template<typename Conv>
+constexpr bool HasBlocks(ALuint channels)
+{
+#if defined(USE_SSE2)
+    return Conv::Simd && (channels == 1 || channels == 2 || channels == 4 || channels == 6 ||
+                          channels == 8);
+#else
+    return Conv::Simd && (channels == 1 || channels == 2 || channels == 4);
+#endif
+}
+
+template<ALuint N, typename T, typename Conv>
+ALuint InterleaveBlocks(T*, const ALint *const[], size_t, ALuint, const Conv&, std::false_type)
+{ return 0; }
+
+template<ALuint N, typename T, typename Conv>
+ALuint InterleaveBlocks(T *dst, const ALint *const src[], size_t offset, ALuint count,
+                        const Conv &conv, std::true_type)
+{
+    ALuint i = 0;
+    for(;count-i >= 4;i += 4)
+    {
+        typename Conv::vec_t v[N];
+        for(ALuint c = 0;c < N;++c)
+            v[c] = conv.convert(src[c] + offset + i);
+#ifdef USE_NEON
+        StoreNeon(dst + i*N, v, conv);
+#else
+        conv.store(dst + i*N, v);
+#endif
+    }
+    return i;
+}
+
+template<ALuint N, typename T, typename Conv>
+void InterleaveChannels(T *dst, const ALint *const src[], size_t offset, ALuint count,
+                        const Conv &conv)
+{
+    ALuint i = InterleaveBlocks<N>(dst, src, offset, count, conv,
+        std::integral_constant<bool,HasBlocks<Conv>(N)>{}
+    );
+    for(;i < count;++i)
+    {
+        for(ALuint c = 0;c < N;++c)
+            dst[i*N + c] = conv(src[c][offset+i]);
+    }
+}
+
+template<typename T, typename Conv>
+void Interleave(T *dst, const ALint *const src[], ALuint channels, size_t offset, ALuint count,
+                const Conv &conv)
+{
+    switch(channels)
+    {
+        case 1: InterleaveChannels<1>(dst, src, offset, count, conv); break;
+        case 2: InterleaveChannels<2>(dst, src, offset, count, conv); break;
+        case 3: InterleaveChannels<3>(dst, src, offset, count, conv); break;
+        case 4: InterleaveChannels<4>(dst, src, offset, count, conv); break;
+        case 5: InterleaveChannels<5>(dst, src, offset, count, conv); break;
+        case 6: InterleaveChannels<6>(dst, src, offset, count, conv); break;
+        case 7: InterleaveChannels<7>(dst, src, offset, count, conv); break;
+        case 8: InterleaveChannels<8>(dst, src, offset, count, conv); break;
+    }
+}
+
+
+// The channel maps, as for GetVorbisChannelMap.
+//   OpenAL : FL, FR, FC, LFE, RL, RR
+//   Vorbis : FL, FC, FR,  RL, RR, LFE
+constexpr ALubyte VorbisMapX51[6]{0, 2, 1, 5, 3, 4};
+//   OpenAL : FL, FR, FC, LFE, RC, SL, SR
+//   Vorbis : FL, FC, FR,  SL, SR, RC, LFE
+constexpr ALubyte VorbisMapX61[7]{0, 2, 1, 6, 5, 3, 4};
+//   OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
+//   Vorbis : FL, FC, FR,  SL, SR, RL, RR, LFE
+constexpr ALubyte VorbisMapX71[8]{0, 2, 1, 7, 5, 6, 3, 4};
+constexpr ALubyte IdentityMap[4]{0, 1, 2, 3};
+
+// 5.1 and 6.1 frames don't fit vectors evenly, and compilers handle these
+// swaps better than other in-place scalar approaches.
+template<typename T>
+void ReorderX51(T *samples, ALuint frames)
+{
+    for(ALuint i = 0;i < frames;++i)
+    {
+        std::swap(samples[i*6 + 1], samples[i*6 + 2]);
+        std::swap(samples[i*6 + 3], samples[i*6 + 5]);
+        std::swap(samples[i*6 + 4], samples[i*6 + 5]);
+    }
+}
+
+template<typename T>
+void ReorderX61(T *samples, ALuint frames)
+{
+    for(ALuint i = 0;i < frames;++i)
+    {
+        std::swap(samples[i*7 + 1], samples[i*7 + 2]);
+        std::swap(samples[i*7 + 3], samples[i*7 + 6]);
+        std::swap(samples[i*7 + 4], samples[i*7 + 5]);
+        std::swap(samples[i*7 + 5], samples[i*7 + 6]);
+    }
+}
+
+#ifdef USE_SSE2
+// A 16-bit 7.1 frame fits one vector. Most channels move within their half of
+// it, except lanes 3 and 6 which come from the other half.
+void ReorderX71(ALshort *samples, ALuint frames)
+{
+    const __m128i mask = _mm_setr_epi16(0, 0, 0, -1, 0, 0, -1, 0);
+    for(ALuint i = 0;i < frames;++i)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples));
+        __m128i swapped = _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2));
+        // 0, 2, 1, -, 5, 6, -, 4
+        __m128i p = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3,1,2,0)),
+                                        _MM_SHUFFLE(0,3,2,1));
+        // -, -, -, 7, -, -, 3, -
+        __m128i q = _mm_shufflehi_epi16(_mm_shufflelo_epi16(swapped, _MM_SHUFFLE(3,3,3,3)),
+                                        _MM_SHUFFLE(3,3,3,3));
+        v = _mm_or_si128(_mm_andnot_si128(mask, p), _mm_and_si128(mask, q));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(samples), v);
+        samples += 8;
+    }
+}
+
+// A float 7.1 frame is two vectors, which are mixed with shuffles.
+void ReorderX71(ALfloat *samples, ALuint frames)
+{
+    for(ALuint i = 0;i < frames;++i)
+    {
+        __m128 lo = _mm_loadu_ps(samples);
+        __m128 hi = _mm_loadu_ps(samples+4);
+        // 0, 2, 1, 7
+        __m128 a = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3,3,1,1));
+        __m128 out0 = _mm_shuffle_ps(lo, a, _MM_SHUFFLE(2,0,2,0));
+        // 5, 6, 3, 4
+        __m128 b = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(0,0,2,1));
+        __m128 c = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(0,0,3,3));
+        __m128 out1 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2,0,1,0));
+        _mm_storeu_ps(samples, out0);
+        _mm_storeu_ps(samples+4, out1);
+        samples += 8;
+    }
+}
+#else
+template<typename T>
+void ReorderX71(T *samples, ALuint frames)
+{
+    for(ALuint i = 0;i < frames;++i)
+    {
+        std::swap(samples[i*8 + 1], samples[i*8 + 2]);
+        std::swap(samples[i*8 + 3], samples[i*8 + 7]);
+        std::swap(samples[i*8 + 4], samples[i*8 + 5]);
+        std::swap(samples[i*8 + 5], samples[i*8 + 6]);
+        std::swap(samples[i*8 + 6], samples[i*8 + 7]);
+    }
+}
+#endif
+
+template<typename T>
+void ReorderVorbis(T *samples, ALuint frames, ChannelConfig chans)
+{
+    if(chans == ChannelConfig::X51)
+        ReorderX51(samples, frames);
+    else if(chans == ChannelConfig::X61)
+        ReorderX61(samples, frames);
+    else if(chans == ChannelConfig::X71)
+        ReorderX71(samples, frames);
+}
+
+} // namespace
+
+namespace alure {
+
+void InterleaveUInt8(ALubyte *dst, const ALint *const src[], ALuint channels, size_t offset,
+                     ALuint count, int shift) noexcept
+{ Interleave(dst, src, channels, offset, count, UInt8Conv{shift}); }
+
+void InterleaveInt16(ALshort *dst, const ALint *const src[], ALuint channels, size_t offset,
+                     ALuint count, int shift) noexcept
+{
+    if(shift >= 0)
+        Interleave(dst, src, channels, offset, count, ShlInt16{shift});
+    else
+        Interleave(dst, src, channels, offset, count, SarInt16{-shift});
+}
+
+void InterleaveFloat32(ALfloat *dst, const ALint *const src[], ALuint channels, size_t offset,
+                       ALuint count, ALfloat scale) noexcept
+{ Interleave(dst, src, channels, offset, count, Float32Conv{scale}); }
+
+const ALubyte *GetVorbisChannelMap(ChannelConfig chans) noexcept
+{
+    if(chans == ChannelConfig::X51) return VorbisMapX51;
+    if(chans == ChannelConfig::X61) return VorbisMapX61;
+    if(chans == ChannelConfig::X71) return VorbisMapX71;
+    return IdentityMap;
+}
+
+void ReorderVorbisChannels(ALshort *samples, ALuint frames, ChannelConfig chans) noexcept
+{ ReorderVorbis(samples, frames, chans); }
+
+void ReorderVorbisChannels(ALfloat *samples, ALuint frames, ChannelConfig chans) noexcept
+{ ReorderVorbis(samples, frames, chans); }
+
+} // namespace alure
@@ -0,0 +1,45 @@
+#ifndef SAMPLECONV_H
+#define SAMPLECONV_H
+
+#include "main.h"
+
+namespace alure {
+
+// Conversions from planar 32-bit integer samples (one array per channel, as
+// decoders like libFLAC produce) to interleaved output samples. Each reads
+// count samples from src[c]+offset for channels c in [0,channels), and writes
+// count*channels samples to dst. Up to 8 channels are supported.
+//
+// The conversions use SSE2 or NEON when the target has them, processing
+// 1, 2, 4, 6, and 8 channels (1, 2, and 4 with NEON) four frames at a time,
+// and plain loops otherwise. The results are the same either way, as long as
+// the samples fit the output type after shifting.
+
+// Stores (sample<<shift) + 0x80, for samples of up to 8 bits.
+void InterleaveUInt8(ALubyte *dst, const ALint *const src[], ALuint channels, size_t offset,
+                     ALuint count, int shift) noexcept;
+
+// Stores sample<<shift, or sample>>-shift if shift is negative, for samples
+// that fit in 16 bits afterward.
+void InterleaveInt16(ALshort *dst, const ALint *const src[], ALuint channels, size_t offset,
+                     ALuint count, int shift) noexcept;
+
+// Stores sample*scale.
+void InterleaveFloat32(ALfloat *dst, const ALint *const src[], ALuint channels, size_t offset,
+                       ALuint count, ALfloat scale) noexcept;
+
+
+// Maps OpenAL's channel order to the Vorbis channel order (also used by Opus),
+// giving the Vorbis channel for each OpenAL channel. 1, 2, and 4 channel
+// configurations use the same order, and get an identity map.
+const ALubyte *GetVorbisChannelMap(ChannelConfig chans) noexcept;
+
+// Reorders interleaved samples in place, from the Vorbis channel order to
+// OpenAL's. 7.1 is shuffled a frame at a time with SSE2 when available,
+// while 5.1 and 6.1 are swapped in place.
+void ReorderVorbisChannels(ALshort *samples, ALuint frames, ChannelConfig chans) noexcept;
+void ReorderVorbisChannels(ALfloat *samples, ALuint frames, ChannelConfig chans) noexcept;
+
+} // namespace alure
+
+#endif /* SAMPLECONV_H */
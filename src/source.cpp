@@ -17,16 +17,195 @@
 namespace alure
 {
 
+constexpr size_t SourceImpl::NoPriorityIndex;
+constexpr size_t SourceImpl::NoAudibilityIndex;
+constexpr size_t SourceImpl::NoBulkIndex;
+constexpr size_t SourceImpl::NoFadeIndex;
+
+StreamReader::StreamReader(ContextImpl &context, SharedPtr<Decoder> decoder,
+                           ALsizei updatelen, ALuint framesize, size_t chunks,
+                           std::pair<uint64_t,uint64_t> loop_pts)
+  : mContext(context), mDecoder(std::move(decoder)), mUpdateLen(updatelen), mFrameSize(framesize)
+  , mChunks(chunks)
+{
+    mState.mLoopPts = loop_pts;
+    mConsumed = mState;
+    StagingPool &pool = mContext.getStagingPool();
+    for(Chunk &chunk : mChunks)
+        chunk.mData = pool.acquire(static_cast<size_t>(mUpdateLen) * mFrameSize);
+}
+
+StreamReader::~StreamReader()
+{
+    StagingPool &pool = mContext.getStagingPool();
+    for(Chunk &chunk : mChunks)
+        pool.release(std::move(chunk.mData));
+}
+
+ALsizei StreamReader::decode(ALbyte *data, bool loop)
+{
+    if(mState.mDone)
+        return 0;
+
+    ALsizei len = mUpdateLen;
+    if(loop && mState.mSamplePos < mState.mLoopPts.second)
+        len = static_cast<ALsizei>(
+            std::min<uint64_t>(len, mState.mLoopPts.second - mState.mSamplePos)
+        );
+    else
+        loop = false;
+
+    ALsizei frames = mDecoder->read(data, len);
+    mState.mSamplePos += frames;
+    if(loop && ((frames < mUpdateLen && mState.mSamplePos > 0) ||
+                (mState.mSamplePos == mState.mLoopPts.second)))
+    {
+        if(mState.mSamplePos < mState.mLoopPts.second)
+        {
+            mState.mLoopPts.second = mState.mSamplePos;
+            if(mState.mLoopPts.first >= mState.mLoopPts.second)
+                mState.mLoopPts.first = 0;
+        }
+
+        do {
+            if(!mDecoder->seek(mState.mLoopPts.first))
+            {
+                len = mUpdateLen-frames;
+                if(len > 0)
+                {
+                    ALuint got = mDecoder->read(&data[frames*mFrameSize], len);
+                    mState.mSamplePos += got;
+                    frames += got;
+                }
+                break;
+            }
+            mState.mSamplePos = mState.mLoopPts.first;
+            mState.mHasLooped = true;
+
+            len = static_cast<ALsizei>(std::min<uint64_t>(
+                mUpdateLen-frames, mState.mLoopPts.second-mState.mLoopPts.first
+            ));
+            if(len == 0) break;
+            ALuint got = mDecoder->read(&data[frames*mFrameSize], len);
+            if(got == 0) break;
+            mState.mSamplePos += got;
+            frames += got;
+        } while(frames < mUpdateLen);
+    }
+    if(frames < mUpdateLen)
+        mState.mDone = true;
+    return frames;
+}
+
+bool StreamReader::seek(uint64_t pos)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(!mDecoder->seek(pos))
+        return false;
+    mState.mSamplePos = pos;
+    mState.mHasLooped = false;
+    mState.mDone = false;
+    mConsumed = mState;
+    mReadIdx.store(0, std::memory_order_relaxed);
+    mWriteIdx.store(0, std::memory_order_relaxed);
+    if(!mChunks.empty())
+        mContext.wakeReadAhead();
+    return true;
+}
+
+ArrayView<ALbyte> StreamReader::read(Vector<ALbyte> &data, bool loop, State &state)
+{
+    mFromChunk = false;
+    if(!mChunks.empty() && loop != mConsumedLoop)
+    {
+        // Chunks decoded ahead are for the old looping mode. Go back to where
+        // playback is, if possible, and decode them again.
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mReadIdx.load(std::memory_order_relaxed) != mWriteIdx.load(std::memory_order_relaxed) &&
+           mDecoder->seek(mConsumed.mSamplePos))
+        {
+            mState = mConsumed;
+            mReadIdx.store(0, std::memory_order_relaxed);
+            mWriteIdx.store(0, std::memory_order_relaxed);
+        }
+        mLooping = loop;
+        mConsumedLoop = loop;
+    }
+
+    ArrayView<ALbyte> samples;
+    size_t readidx = mReadIdx.load(std::memory_order_relaxed);
+    if(readidx != mWriteIdx.load(std::memory_order_acquire))
+    {
+        const Chunk &chunk = mChunks[readidx % mChunks.size()];
+        samples = ArrayView<ALbyte>(chunk.mData.data(), chunk.mFrames*mFrameSize);
+        mConsumed = chunk.mState;
+        mFromChunk = true;
+    }
+    else
+    {
+        // Nothing was decoded ahead (or reading ahead is off), so decode the
+        // chunk now.
+        std::lock_guard<std::mutex> lock(mMutex);
+        readidx = mReadIdx.load(std::memory_order_relaxed);
+        if(readidx != mWriteIdx.load(std::memory_order_acquire))
+        {
+            const Chunk &chunk = mChunks[readidx % mChunks.size()];
+            samples = ArrayView<ALbyte>(chunk.mData.data(), chunk.mFrames*mFrameSize);
+            mConsumed = chunk.mState;
+            mFromChunk = true;
+        }
+        else
+        {
+            ALsizei frames = decode(data.data(), loop);
+            samples = ArrayView<ALbyte>(data.data(), frames*mFrameSize);
+            mConsumed = mState;
+        }
+    }
+    state = mConsumed;
+    return samples;
+}
+
+void StreamReader::release()
+{
+    if(!mFromChunk) return;
+    mFromChunk = false;
+    mReadIdx.store(mReadIdx.load(std::memory_order_relaxed)+1, std::memory_order_release);
+    mContext.wakeReadAhead();
+}
+
+bool StreamReader::fill()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mDetached.load(std::memory_order_acquire) || mState.mDone)
+        return false;
+
+    size_t writeidx = mWriteIdx.load(std::memory_order_relaxed);
+    if(writeidx - mReadIdx.load(std::memory_order_acquire) >= mChunks.size())
+        return false;
+
+    Chunk &chunk = mChunks[writeidx % mChunks.size()];
+    chunk.mFrames = decode(chunk.mData.data(), mLooping);
+    chunk.mState = mState;
+    if(chunk.mFrames == 0)
+        return false;
+    mWriteIdx.store(writeidx+1, std::memory_order_release);
+    return true;
+}
+
+
 class ALBufferStream {
     SharedPtr<Decoder> mDecoder;
+    SharedPtr<StreamReader> mReader;
 
     ALsizei mUpdateLen{0};
     ALsizei mNumUpdates{0};
+    Seconds mReadAhead{0.0};
 
     ALenum mFormat{AL_NONE};
     ALuint mFrequency{0};
     ALuint mFrameSize{0};
 
+    StagingPool *mPool{nullptr};
     Vector<ALbyte> mData;
     ALbyte mSilence{0};
 
@@ -42,14 +221,19 @@ class ALBufferStream {
     std::atomic<bool> mDone{false};
 
 public:
-    ALBufferStream(SharedPtr<Decoder> decoder, ALsizei updatelen, ALsizei numupdates)
-      : mDecoder(decoder), mUpdateLen(updatelen), mNumUpdates(numupdates)
+    ALBufferStream(SharedPtr<Decoder> decoder, ALsizei updatelen, ALsizei numupdates,
+                   Seconds readahead)
+      : mDecoder(decoder), mUpdateLen(updatelen), mNumUpdates(numupdates), mReadAhead(readahead)
     { }
     ~ALBufferStream()
     {
+        if(mReader)
+            mReader->detach();
         for(auto &buflen : mBuffers)
             alDeleteBuffers(1, &buflen.mId);
         mBuffers.clear();
+        if(mPool)
+            mPool->release(std::move(mData));
     }
 
     uint64_t getPosition() const { return mSamplePos; }
@@ -60,9 +244,15 @@ public:
 
     ALuint getFrequency() const { return mFrequency; }
 
+    // The time it takes to play the given number of frames at normal pitch.
+    std::chrono::nanoseconds framesToTime(uint64_t frames) const
+    { return std::chrono::nanoseconds(std::chrono::seconds(frames)) / mFrequency; }
+
+    const SharedPtr<StreamReader> &getReader() const { return mReader; }
+
     bool seek(uint64_t pos)
     {
-        if(!mDecoder->seek(pos))
+        if(!mReader->seek(pos))
             return false;
         mSamplePos = pos;
         mHasLooped = false;
@@ -70,7 +260,7 @@ public:
         return true;
     }
 
-    void prepare()
+    void prepare(ContextImpl &context)
     {
         ALuint srate = mDecoder->getFrequency();
         ChannelConfig chans = mDecoder->getChannelConfig();
@@ -93,11 +283,19 @@ public:
             throw std::runtime_error(str);
         }
 
-        mData.resize(mUpdateLen * mFrameSize);
+        mPool = &context.getStagingPool();
+        mData = mPool->acquire(static_cast<size_t>(mUpdateLen) * mFrameSize);
         if(type == SampleType::UInt8) mSilence = -128;
         else if(type == SampleType::Mulaw) mSilence = 127;
         else mSilence = 0;
 
+        // Decode enough chunks ahead to cover the read-ahead time.
+        size_t chunks = 0;
+        if(mReadAhead > Seconds::zero())
+            chunks = static_cast<size_t>(std::ceil(mReadAhead.count()*srate / mUpdateLen));
+        mReader = MakeShared<StreamReader>(context, mDecoder, mUpdateLen, mFrameSize, chunks,
+                                           mLoopPts);
+
         mBuffers.assign(mNumUpdates, {0,0});
         for(auto &buflen : mBuffers)
             alGenBuffers(1, &buflen.mId);
@@ -137,57 +335,26 @@ public:
         if(mDone.load(std::memory_order_acquire))
             return false;
 
-        ALsizei len = mUpdateLen;
-        if(loop && mSamplePos < mLoopPts.second)
-            len = static_cast<ALsizei>(std::min<uint64_t>(len, mLoopPts.second - mSamplePos));
-        else
-            loop = false;
-
-        ALsizei frames = mDecoder->read(mData.data(), len);
-        mSamplePos += frames;
-        if(loop && ((frames < mUpdateLen && mSamplePos > 0) || (mSamplePos == mLoopPts.second)))
+        StreamReader::State state;
+        ArrayView<ALbyte> samples = mReader->read(mData, loop, state);
+        mSamplePos = state.mSamplePos;
+        mLoopPts = state.mLoopPts;
+        mHasLooped = state.mHasLooped;
+        if(state.mDone)
         {
-            if(mSamplePos < mLoopPts.second)
+            mDone.store(true, std::memory_order_release);
+            if(samples.empty())
             {
-                mLoopPts.second = mSamplePos;
-                if(mLoopPts.first >= mLoopPts.second)
-                    mLoopPts.first = 0;
+                mReader->release();
+                return false;
             }
-
-            do {
-                if(!mDecoder->seek(mLoopPts.first))
-                {
-                    len = mUpdateLen-frames;
-                    if(len > 0)
-                    {
-                        ALuint got = mDecoder->read(&mData[frames*mFrameSize], len);
-                        mSamplePos += got;
-                        frames += got;
-                    }
-                    break;
-                }
-                mSamplePos = mLoopPts.first;
-                mHasLooped = true;
-
-                len = static_cast<ALsizei>(
-                    std::min<uint64_t>(mUpdateLen-frames, mLoopPts.second-mLoopPts.first)
-                );
-                if(len == 0) break;
-                ALuint got = mDecoder->read(&mData[frames*mFrameSize], len);
-                if(got == 0) break;
-                mSamplePos += got;
-                frames += got;
-            } while(frames < mUpdateLen);
-        }
-        if(frames < mUpdateLen)
-        {
-            mDone.store(true, std::memory_order_release);
-            if(frames == 0) return false;
         }
 
+        ALsizei frames = static_cast<ALsizei>(samples.size() / mFrameSize);
         alBufferData(mBuffers[mWriteIdx].mId,
-            mFormat, mData.data(), frames * mFrameSize, mFrequency
+            mFormat, samples.data(), static_cast<ALsizei>(samples.size()), mFrequency
         );
+        mReader->release();
         alSourceQueueBuffers(srcid, 1, &mBuffers[mWriteIdx].mId);
         mBuffers[mWriteIdx].mFrameLength = frames;
         mTotalBuffered += frames;
@@ -281,6 +448,7 @@ void SourceImpl::resetProperties()
     mEffectSlots.clear();
 
     mPriority = 0;
+    mReadAhead = Seconds::zero();
 }
 
 void SourceImpl::applyProperties(bool looping, ALuint offset) const
@@ -343,8 +511,12 @@ void SourceImpl::groupPropUpdate(ALfloat gain, ALfloat pitch)
         alSourcef(mId, AL_PITCH, mPitch * pitch);
         alSourcef(mId, AL_GAIN, mGain * gain * mFadeGain);
     }
+    if(mStream && pitch > mGroupPitch) mContext.wakeStreamThread();
+    if(mVirtual) rebaseVirtual();
+    if(pitch > mGroupPitch) resetStopTime();
     mGroupPitch = pitch;
     mGroupGain = gain;
+    audibilityUpdate();
 }
 
 
@@ -354,16 +526,31 @@ void SourceImpl::play(Buffer buffer)
     BufferImpl *albuf = buffer.getHandle();
     if(!albuf) throw std::invalid_argument("Buffer is not valid");
     CheckContexts(mContext, albuf->getContext());
+    if(mContext.deferCall())
+    {
+        Command cmd(Command::SourcePlay, this);
+        cmd.mBuffer = albuf;
+        albuf->addPendingUse();
+        mContext.queueCommand(cmd);
+        return;
+    }
     CheckContext(mContext);
 
     if(mStream)
         mContext.removeStream(this);
     mIsAsync.store(false, std::memory_order_release);
 
+    if(mVirtual)
+    {
+        mContext.removeFadingSource(this);
+        mContext.removePlayingSource(this);
+        mVirtual = false;
+    }
     if(mId == 0)
     {
-        mId = mContext.getSourceId(mPriority);
-        applyProperties(mLooping, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
+        mId = mContext.getSourceId(mPriority, true);
+        if(mId)
+            applyProperties(mLooping, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
     }
     else
     {
@@ -374,6 +561,7 @@ void SourceImpl::play(Buffer buffer)
         alSourcei(mId, AL_LOOPING, mLooping ? AL_TRUE : AL_FALSE);
         alSourcei(mId, AL_SAMPLE_OFFSET, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
     }
+    const uint64_t offset = mOffset;
     mOffset = 0;
 
     mStream.reset();
@@ -381,6 +569,16 @@ void SourceImpl::play(Buffer buffer)
         mBuffer->removeSource(Source(this));
     mBuffer = albuf;
     mBuffer->addSource(Source(this));
+    mContext.touchBuffer(mBuffer);
+
+    if(mId == 0)
+    {
+        // No source could be had, so play virtually until one frees up.
+        startVirtual(offset);
+        mContext.removePendingSource(this);
+        mContext.addVirtualSource(this);
+        return;
+    }
 
     alSourcei(mId, AL_BUFFER, mBuffer->getId());
     alSourcePlay(mId);
@@ -398,13 +596,19 @@ void SourceImpl::play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei q
         throw std::out_of_range("Queue size out of range");
     CheckContext(mContext);
 
-    auto stream = MakeUnique<ALBufferStream>(decoder, chunk_len, queue_size);
-    stream->prepare();
+    auto stream = MakeUnique<ALBufferStream>(decoder, chunk_len, queue_size, mReadAhead);
+    stream->prepare(mContext);
 
     if(mStream)
         mContext.removeStream(this);
     mIsAsync.store(false, std::memory_order_release);
 
+    if(mVirtual)
+    {
+        mContext.removeFadingSource(this);
+        mContext.removePlayingSource(this);
+        mVirtual = false;
+    }
     if(mId == 0)
     {
         mId = mContext.getSourceId(mPriority);
@@ -426,6 +630,7 @@ void SourceImpl::play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei q
     mBuffer = 0;
 
     mStream = std::move(stream);
+    mUnderruns.store(0, std::memory_order_relaxed);
 
     mStream->seek(mOffset);
     mOffset = 0;
@@ -438,6 +643,8 @@ void SourceImpl::play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei q
     alSourcePlay(mId);
     mPaused.store(false, std::memory_order_release);
 
+    if(mReadAhead > Seconds::zero())
+        mContext.addReadAhead(mStream->getReader());
     mContext.addStream(this);
     mIsAsync.store(true, std::memory_order_release);
     mContext.removePendingSource(this);
@@ -468,6 +675,11 @@ void SourceImpl::play(SharedFuture<Buffer>&& future_buffer)
 DECL_THUNK0(void, Source, stop,)
 void SourceImpl::stop()
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceStop, this));
+        return;
+    }
     CheckContext(mContext);
     mContext.removePendingSource(this);
     mContext.removeFadingSource(this);
@@ -488,18 +700,8 @@ void SourceImpl::makeStopped(bool dolock)
 
     mFadeGain = 1.0f;
     if(mId != 0)
-    {
-        alSourceRewind(mId);
-        alSourcei(mId, AL_BUFFER, 0);
-        if(mContext.hasExtension(AL::EXT_EFX))
-        {
-            alSourcei(mId, AL_DIRECT_FILTER, AL_FILTER_NULL);
-            for(auto &i : mEffectSlots)
-                alSource3i(mId, AL_AUXILIARY_SEND_FILTER, 0, i.mSendIdx, AL_FILTER_NULL);
-        }
-        mContext.insertSourceId(mId);
-        mId = 0;
-    }
+        releaseId();
+    mVirtual = false;
 
     mStream.reset();
     if(mBuffer)
@@ -509,26 +711,207 @@ void SourceImpl::makeStopped(bool dolock)
     mPaused.store(false, std::memory_order_release);
 }
 
+void SourceImpl::releaseId()
+{
+    alSourceRewind(mId);
+    alSourcei(mId, AL_BUFFER, 0);
+    if(mContext.hasExtension(AL::EXT_EFX))
+    {
+        alSourcei(mId, AL_DIRECT_FILTER, AL_FILTER_NULL);
+        for(auto &i : mEffectSlots)
+            alSource3i(mId, AL_AUXILIARY_SEND_FILTER, 0, i.mSendIdx, AL_FILTER_NULL);
+    }
+    mContext.insertSourceId(mId);
+    mId = 0;
+}
+
+
+void SourceImpl::startVirtual(uint64_t offset)
+{
+    mVirtual = true;
+    mVirtualOffset = offset;
+    mVirtualTime = mContext.getDevice().getClockTime();
+    mPaused.store(false, std::memory_order_release);
+}
+
+void SourceImpl::rebaseVirtual()
+{
+    auto cur_time = mContext.getDevice().getClockTime();
+    mVirtualOffset = getVirtualOffset(cur_time);
+    mVirtualTime = cur_time;
+}
+
+uint64_t SourceImpl::getVirtualOffset(std::chrono::nanoseconds cur_time) const
+{
+    if(mPaused.load(std::memory_order_acquire) || cur_time <= mVirtualTime)
+        return mVirtualOffset;
+
+    // Advance by the time since the offset was set, at the current pitch.
+    double frames = std::chrono::duration<double>(cur_time - mVirtualTime).count() *
+                    mBuffer->getFrequency() * mPitch * mGroupPitch;
+    uint64_t offset = mVirtualOffset + static_cast<uint64_t>(frames);
+    if(mLooping)
+    {
+        std::pair<ALuint,ALuint> loop_pts = mBuffer->getLoopPoints();
+        if(offset >= loop_pts.second && loop_pts.second > loop_pts.first)
+            offset = loop_pts.first + (offset-loop_pts.first)%(loop_pts.second-loop_pts.first);
+    }
+    return offset;
+}
+
+void SourceImpl::makeVirtual(std::chrono::nanoseconds cur_time)
+{
+    // A source that stopped on its own, and hasn't been noticed yet, is
+    // already at the end.
+    ALint state = -1, srcpos = 0;
+    alGetSourcei(mId, AL_SOURCE_STATE, &state);
+    alGetSourcei(mId, AL_SAMPLE_OFFSET, &srcpos);
+    uint64_t offset = (state == AL_STOPPED) ? mBuffer->getLength() : static_cast<ALuint>(srcpos);
+
+    releaseId();
+    mVirtual = true;
+    mVirtualOffset = offset;
+    mVirtualTime = cur_time;
+}
+
+bool SourceImpl::virtualUpdate(std::chrono::nanoseconds cur_time)
+{
+    // Looping and paused sources play on until stopped.
+    return mLooping || getVirtualOffset(cur_time) < mBuffer->getLength();
+}
 
-DECL_THUNK2(void, Source, fadeOutToStop,, ALfloat, std::chrono::milliseconds)
-void SourceImpl::fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration)
+void SourceImpl::bindVirtual(ALuint id, std::chrono::nanoseconds cur_time)
+{
+    uint64_t offset = getVirtualOffset(cur_time);
+    mVirtual = false;
+    mId = id;
+    applyProperties(mLooping, (ALuint)std::min<uint64_t>(offset, std::numeric_limits<ALint>::max()));
+    alSourcei(mId, AL_BUFFER, mBuffer->getId());
+    alSourcePlay(mId);
+    mContext.addPlayingSource(this, mId);
+}
+
+void SourceImpl::setVirtualPaused(bool paused)
+{
+    if(paused)
+    {
+        mVirtualOffset = getVirtualOffset(mContext.getDevice().getClockTime());
+        mPaused.store(true, std::memory_order_release);
+    }
+    else
+    {
+        mVirtualTime = mContext.getDevice().getClockTime();
+        mPaused.store(false, std::memory_order_release);
+    }
+    mContext.setVirtualPaused(this, paused);
+}
+
+
+AudibilityParams SourceImpl::getAudibilityParams() const
+{
+    return AudibilityParams{mPosition, mDirection, mGain * mGroupGain, mMinGain, mMaxGain,
+        mRefDist, mMaxDist, mRolloffFactor, mConeInnerAngle, mConeOuterAngle, mConeOuterGain,
+        mRelative};
+}
+
+void SourceImpl::audibilityUpdate()
+{
+    if(mAudibilityIndex != NoAudibilityIndex)
+        mContext.updateAudibleSource(this);
+}
+
+void SourceImpl::resetStopTime()
+{
+    if(mId != 0 && mBuffer)
+        mContext.resetStopTime(this);
+}
+
+void SourceImpl::cancelBulk(unsigned props)
+{
+    if(mBulkIndex != NoBulkIndex)
+        mContext.cancelBulkProps(this, props);
+}
+
+void SourceImpl::applyBulkProps(unsigned props, const Vector3 &position, const Vector3 &velocity,
+                                const std::pair<Vector3,Vector3> &orientation)
+{
+    if((props&BulkSourceProps::Position))
+    {
+        if(mId != 0)
+            alSourcefv(mId, AL_POSITION, position.getPtr());
+        mPosition = position;
+    }
+    if((props&BulkSourceProps::Velocity))
+    {
+        if(mId != 0)
+            alSourcefv(mId, AL_VELOCITY, velocity.getPtr());
+        mVelocity = velocity;
+        resetStopTime();
+    }
+    if((props&BulkSourceProps::Orientation))
+    {
+        if(mId != 0)
+        {
+            if(mContext.hasExtension(AL::EXT_BFORMAT))
+                alSourcefv(mId, AL_ORIENTATION, orientation.first.getPtr());
+            alSourcefv(mId, AL_DIRECTION, orientation.first.getPtr());
+        }
+        mDirection = mOrientation[0] = orientation.first;
+        mOrientation[1] = orientation.second;
+    }
+    audibilityUpdate();
+}
+
+
+DECL_THUNK3(void, Source, fadeOutToStop,, ALfloat, std::chrono::milliseconds, FadeCurve)
+void SourceImpl::fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration, FadeCurve curve)
 {
     if(!(gain < 1.0f && gain >= 0.0f))
         throw std::out_of_range("Fade gain target out of range");
     if(duration.count() <= 0)
         throw std::out_of_range("Fade duration out of range");
+    if(mContext.deferCall())
+    {
+        Command cmd(Command::SourceFadeOut, this);
+        cmd.mFade = Command::Fade{gain, curve, duration.count()};
+        mContext.queueCommand(cmd);
+        return;
+    }
     CheckContext(mContext);
 
-    gain = std::max<ALfloat>(gain, 0.0001f);
-    float mult = std::pow(gain, float(1.0/Seconds(duration).count()));
+    mContext.addFadingSource(this, duration, gain, curve, false);
+}
 
-    mContext.addFadingSource(this, duration, mult);
+DECL_THUNK3(void, Source, fadeIn,, ALfloat, std::chrono::milliseconds, FadeCurve)
+void SourceImpl::fadeIn(ALfloat gain, std::chrono::milliseconds duration, FadeCurve curve)
+{
+    if(!(gain < 1.0f && gain >= 0.0f))
+        throw std::out_of_range("Fade gain out of range");
+    if(duration.count() <= 0)
+        throw std::out_of_range("Fade duration out of range");
+    if(mContext.deferCall())
+    {
+        Command cmd(Command::SourceFadeIn, this);
+        cmd.mFade = Command::Fade{gain, curve, duration.count()};
+        mContext.queueCommand(cmd);
+        return;
+    }
+    CheckContext(mContext);
+
+    mContext.addFadingSource(this, duration, gain, curve, true);
 }
 
 
 void SourceImpl::checkPaused()
 {
-    if(mPaused.load(std::memory_order_acquire) || mId == 0)
+    if(mPaused.load(std::memory_order_acquire))
+        return;
+    if(mVirtual)
+    {
+        setVirtualPaused(true);
+        return;
+    }
+    if(mId == 0)
         return;
 
     ALint state = -1;
@@ -538,14 +921,33 @@ void SourceImpl::checkPaused()
                   std::memory_order_release);
 }
 
+void SourceImpl::unsetPaused()
+{
+    if(mVirtual && mPaused.load(std::memory_order_acquire))
+        setVirtualPaused(false);
+    else
+    {
+        mPaused.store(false, std::memory_order_release);
+        // Paused streams aren't scheduled for refilling.
+        if(mStream) mContext.wakeStreamThread();
+    }
+}
+
 DECL_THUNK0(void, Source, pause,)
 void SourceImpl::pause()
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourcePause, this));
+        return;
+    }
     CheckContext(mContext);
     if(mPaused.load(std::memory_order_acquire))
         return;
 
-    if(mId != 0)
+    if(mVirtual)
+        setVirtualPaused(true);
+    else if(mId != 0)
     {
         std::lock_guard<std::mutex> lock(mMutex);
         alSourcePause(mId);
@@ -560,13 +962,25 @@ void SourceImpl::pause()
 DECL_THUNK0(void, Source, resume,)
 void SourceImpl::resume()
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceResume, this));
+        return;
+    }
     CheckContext(mContext);
     if(!mPaused.load(std::memory_order_acquire))
         return;
 
+    if(mVirtual)
+    {
+        setVirtualPaused(false);
+        return;
+    }
     if(mId != 0)
         alSourcePlay(mId);
     mPaused.store(false, std::memory_order_release);
+    // Paused streams aren't scheduled for refilling.
+    if(mStream) mContext.wakeStreamThread();
 }
 
 
@@ -581,6 +995,7 @@ DECL_THUNK0(bool, Source, isPlaying, const)
 bool SourceImpl::isPlaying() const
 {
     CheckContext(mContext);
+    if(mVirtual) return !mPaused.load(std::memory_order_acquire);
     if(mId == 0) return false;
 
     ALint state = -1;
@@ -596,7 +1011,7 @@ DECL_THUNK0(bool, Source, isPaused, const)
 bool SourceImpl::isPaused() const
 {
     CheckContext(mContext);
-    return mId != 0 && mPaused.load(std::memory_order_acquire);
+    return (mId != 0 || mVirtual) && mPaused.load(std::memory_order_acquire);
 }
 
 DECL_THUNK0(bool, Source, isPlayingOrPending, const)
@@ -605,7 +1020,9 @@ bool SourceImpl::isPlayingOrPending() const
     CheckContext(mContext);
 
     bool playing = false;
-    if(mId != 0)
+    if(mVirtual)
+        playing = !mPaused.load(std::memory_order_acquire);
+    else if(mId != 0)
     {
         ALint state = -1;
         alGetSourcei(mId, AL_SOURCE_STATE, &state);
@@ -628,6 +1045,8 @@ void SourceImpl::setGroup(SourceGroup group)
     SourceGroupImpl *parent = group.getHandle();
     if(parent == mGroup) return;
 
+    if(mVirtual)
+        rebaseVirtual();
     if(mGroup)
         mGroup->eraseSource(this);
     mGroup = parent;
@@ -662,8 +1081,9 @@ bool SourceImpl::checkPending(SharedFuture<Buffer> &future)
 
     if(mId == 0)
     {
-        mId = mContext.getSourceId(mPriority);
-        applyProperties(mLooping, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
+        mId = mContext.getSourceId(mPriority, true);
+        if(mId)
+            applyProperties(mLooping, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
     }
     else
     {
@@ -672,10 +1092,19 @@ bool SourceImpl::checkPending(SharedFuture<Buffer> &future)
         alSourcei(mId, AL_LOOPING, mLooping ? AL_TRUE : AL_FALSE);
         alSourcei(mId, AL_SAMPLE_OFFSET, (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
     }
+    const uint64_t offset = mOffset;
     mOffset = 0;
 
     mBuffer = buffer;
     mBuffer->addSource(Source(this));
+    mContext.touchBuffer(mBuffer);
+
+    if(mId == 0)
+    {
+        startVirtual(offset);
+        mContext.addVirtualSource(this);
+        return false;
+    }
 
     alSourcei(mId, AL_BUFFER, mBuffer->getId());
     alSourcePlay(mId);
@@ -684,45 +1113,37 @@ bool SourceImpl::checkPending(SharedFuture<Buffer> &future)
     return false;
 }
 
-bool SourceImpl::fadeUpdate(std::chrono::nanoseconds cur_fade_time, SourceFadeUpdateEntry &fade)
+void SourceImpl::setFadeGain(ALfloat gain)
 {
-    std::chrono::nanoseconds duration = cur_fade_time - fade.mFadeTimeStart;
-    if(duration.count() < 0) return true;
-    std::chrono::nanoseconds dur_total = fade.mFadeTimeTarget - fade.mFadeTimeStart;
-
-    if(duration >= dur_total)
-    {
-        mFadeGain = 1.0f;
-        if(!fade.mIsFadeOut)
-        {
-            if(mId != 0)
-                alSourcef(mId, AL_GAIN, mGain * mGroupGain);
-            return false;
-        }
-        mContext.removePendingSource(this);
-        mContext.removePlayingSource(this);
-        makeStopped(true);
-        return false;
-    }
-
-    if(!fade.mIsFadeOut) duration = dur_total - duration;
-    mFadeGain = std::pow(fade.mFadeGainMult, float(Seconds(duration).count()));
-
+    if(gain == mFadeGain)
+        return;
+    mFadeGain = gain;
     if(mId != 0)
         alSourcef(mId, AL_GAIN, mGain * mGroupGain * mFadeGain);
-    return true;
 }
 
-bool SourceImpl::playUpdate(ALuint id)
+std::chrono::nanoseconds SourceImpl::getStopTime(std::chrono::nanoseconds cur_time, bool doppler,
+                                                 bool listener_moving, ALuint &queries) const
 {
-    ALint state = -1;
-    alGetSourcei(id, AL_SOURCE_STATE, &state);
-    if(LIKELY(state == AL_PLAYING || state == AL_PAUSED))
-        return true;
+    // Looping sources only stop when told to.
+    if(mLooping)
+        return std::chrono::nanoseconds::max();
+    // The Doppler effect can raise the pitch by an unknown amount.
+    if(doppler && mDopplerFactor > 0.0f &&
+       (listener_moving || mVelocity[0] != 0.0f || mVelocity[1] != 0.0f || mVelocity[2] != 0.0f))
+        return std::chrono::nanoseconds::zero();
 
-    makeStopped();
-    mContext.send(&MessageHandler::sourceStopped, Source(this));
-    return false;
+    ALint srcpos = 0;
+    alGetSourcei(mId, AL_SAMPLE_OFFSET, &srcpos);
+    ++queries;
+    const ALuint length = mBuffer->getLength();
+    if(srcpos < 0 || static_cast<ALuint>(srcpos) >= length)
+        return std::chrono::nanoseconds::zero();
+
+    // Pausing or lowering the pitch only makes it stop later.
+    std::chrono::duration<double> remaining((length - srcpos) /
+        (static_cast<double>(mBuffer->getFrequency()) * mPitch * mGroupPitch));
+    return cur_time + std::chrono::duration_cast<std::chrono::nanoseconds>(remaining);
 }
 
 bool SourceImpl::playUpdate()
@@ -757,7 +1178,7 @@ ALint SourceImpl::refillBufferStream()
     return queued;
 }
 
-bool SourceImpl::updateAsync()
+bool SourceImpl::updateAsync(std::chrono::nanoseconds &refill_delay)
 {
     std::lock_guard<std::mutex> lock(mMutex);
 
@@ -772,9 +1193,14 @@ bool SourceImpl::updateAsync()
     alGetSourcei(mId, AL_SOURCE_STATE, &state);
     if(!mPaused.load(std::memory_order_acquire))
     {
-        // Make sure the source is still playing if it's not paused.
+        // Make sure the source is still playing if it's not paused. If it
+        // stopped, it played everything queued before it could be refilled.
         if(state != AL_PLAYING)
+        {
+            if(state == AL_STOPPED)
+                mUnderruns.fetch_add(1, std::memory_order_relaxed);
             alSourcePlay(mId);
+        }
     }
     else
     {
@@ -783,6 +1209,26 @@ bool SourceImpl::updateAsync()
         if(state == AL_STOPPED)
             alSourceRewind(mId);
     }
+
+    // Schedule the next refill for when the queue is down to about its last
+    // chunk, or half of what's left if less, and a bit earlier to allow for
+    // the thread waking up late.
+    refill_delay = std::chrono::nanoseconds::max();
+    if(!mPaused.load(std::memory_order_relaxed))
+    {
+        ALint offset = 0;
+        ALfloat pitch = 1.0f;
+        alGetSourcei(mId, AL_SAMPLE_OFFSET, &offset);
+        alGetSourcef(mId, AL_PITCH, &pitch);
+
+        uint64_t remaining = mStream->getTotalBuffered();
+        remaining -= std::min<uint64_t>(remaining, std::max(offset, 0));
+        uint64_t margin = std::min<uint64_t>(mStream->getUpdateLength(), remaining/2);
+        auto delay = mStream->framesToTime(remaining - margin);
+        refill_delay = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            delay / std::max(pitch, 0.001f)
+        ) - std::chrono::milliseconds(2);
+    }
     return true;
 }
 
@@ -790,14 +1236,38 @@ bool SourceImpl::updateAsync()
 DECL_THUNK1(void, Source, setPriority,, ALuint)
 void SourceImpl::setPriority(ALuint priority)
 {
+    mContext.checkCallThread();
     mPriority = priority;
+    mContext.updatePlayingPriority(this);
+}
+
+DECL_THUNK1(void, Source, setStreamReadAhead,, Seconds)
+void SourceImpl::setStreamReadAhead(Seconds readahead)
+{
+    if(!(readahead >= Seconds::zero() && readahead <= Seconds(60.0)))
+        throw std::out_of_range("Read-ahead out of range");
+    mContext.checkCallThread();
+    mReadAhead = readahead;
 }
 
 
 DECL_THUNK1(void, Source, setOffset,, uint64_t)
 void SourceImpl::setOffset(uint64_t offset)
 {
+    if(mContext.deferCall())
+    {
+        Command cmd(Command::SourceOffset, this);
+        cmd.mOffset = offset;
+        mContext.queueCommand(cmd);
+        return;
+    }
     CheckContext(mContext);
+    if(mVirtual)
+    {
+        mVirtualOffset = offset;
+        mVirtualTime = mContext.getDevice().getClockTime();
+        return;
+    }
     if(mId == 0)
     {
         mOffset = offset;
@@ -811,6 +1281,7 @@ void SourceImpl::setOffset(uint64_t offset)
         alGetError();
         alSourcei(mId, AL_SAMPLE_OFFSET, (ALint)offset);
         throw_al_error("Failed to set offset");
+        resetStopTime();
     }
     else
     {
@@ -829,6 +1300,11 @@ std::pair<uint64_t,std::chrono::nanoseconds> SourceImpl::getSampleOffsetLatency(
 {
     std::pair<uint64_t,std::chrono::nanoseconds> ret{0, std::chrono::nanoseconds::zero()};
     CheckContext(mContext);
+    if(mVirtual)
+    {
+        ret.first = getVirtualOffset(mContext.getDevice().getClockTime());
+        return ret;
+    }
     if(mId == 0) return ret;
 
     if(mStream)
@@ -890,6 +1366,12 @@ std::pair<Seconds,Seconds> SourceImpl::getSecOffsetLatency() const
 {
     std::pair<Seconds,Seconds> ret{Seconds::zero(), Seconds::zero()};
     CheckContext(mContext);
+    if(mVirtual)
+    {
+        uint64_t offset = getVirtualOffset(mContext.getDevice().getClockTime());
+        ret.first = Seconds(static_cast<double>(offset) / mBuffer->getFrequency());
+        return ret;
+    }
     if(mId == 0) return ret;
 
     if(mStream)
@@ -961,11 +1443,29 @@ std::pair<Seconds,Seconds> SourceImpl::getSecOffsetLatency() const
 DECL_THUNK1(void, Source, setLooping,, bool)
 void SourceImpl::setLooping(bool looping)
 {
+    if(mContext.deferCall())
+    {
+        const ALfloat value = looping ? 1.0f : 0.0f;
+        mContext.queueCommand(Command(Command::SourceLooping, this, &value, 1));
+        return;
+    }
     CheckContext(mContext);
 
+    if(mVirtual)
+        rebaseVirtual();
     if(mId && !mStream)
         alSourcei(mId, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
-    mLooping = looping;
+    if(mStream)
+    {
+        // The streaming thread reads this when refilling.
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLooping = looping;
+    }
+    else
+    {
+        mLooping = looping;
+        resetStopTime();
+    }
 }
 
 
@@ -974,9 +1474,19 @@ void SourceImpl::setPitch(ALfloat pitch)
 {
     if(!(pitch > 0.0f))
         throw std::out_of_range("Pitch out of range");
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourcePitch, this, &pitch, 1));
+        return;
+    }
     CheckContext(mContext);
+    if(mVirtual)
+        rebaseVirtual();
     if(mId != 0)
         alSourcef(mId, AL_PITCH, pitch * mGroupPitch);
+    // A higher pitch plays through the queue sooner than scheduled.
+    if(mStream && pitch > mPitch) mContext.wakeStreamThread();
+    if(pitch > mPitch) resetStopTime();
     mPitch = pitch;
 }
 
@@ -986,10 +1496,16 @@ void SourceImpl::setGain(ALfloat gain)
 {
     if(!(gain >= 0.0f))
         throw std::out_of_range("Gain out of range");
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceGain, this, &gain, 1));
+        return;
+    }
     CheckContext(mContext);
     if(mId != 0)
         alSourcef(mId, AL_GAIN, gain * mGroupGain * mFadeGain);
     mGain = gain;
+    audibilityUpdate();
 }
 
 DECL_THUNK2(void, Source, setGainRange,, ALfloat, ALfloat)
@@ -1005,6 +1521,7 @@ void SourceImpl::setGainRange(ALfloat mingain, ALfloat maxgain)
     }
     mMinGain = mingain;
     mMaxGain = maxgain;
+    audibilityUpdate();
 }
 
 
@@ -1021,13 +1538,22 @@ void SourceImpl::setDistanceRange(ALfloat refdist, ALfloat maxdist)
     }
     mRefDist = refdist;
     mMaxDist = maxdist;
+    audibilityUpdate();
 }
 
 
 DECL_THUNK3(void, Source, set3DParameters,, const Vector3&, const Vector3&, const Vector3&)
 void SourceImpl::set3DParameters(const Vector3 &position, const Vector3 &velocity, const Vector3 &direction)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourcePosition, this, position.getPtr(), 3));
+        mContext.queueCommand(Command(Command::SourceVelocity, this, velocity.getPtr(), 3));
+        mContext.queueCommand(Command(Command::SourceDirection, this, direction.getPtr(), 3));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Position | BulkSourceProps::Velocity | BulkSourceProps::Orientation);
     if(mId != 0)
     {
         Batcher batcher = mContext.getBatcher();
@@ -1038,13 +1564,25 @@ void SourceImpl::set3DParameters(const Vector3 &position, const Vector3 &velocit
     mPosition = position;
     mVelocity = velocity;
     mDirection = direction;
+    audibilityUpdate();
+    resetStopTime();
 }
 
 DECL_THUNK3(void, Source, set3DParameters,, const Vector3&, const Vector3&, const Vector3Pair&)
 void SourceImpl::set3DParameters(const Vector3 &position, const Vector3 &velocity, const std::pair<Vector3,Vector3> &orientation)
 {
     static_assert(sizeof(orientation) == sizeof(ALfloat[6]), "Invalid Vector3 pair size");
+    if(mContext.deferCall())
+    {
+        const ALfloat ori[6] = { orientation.first[0], orientation.first[1], orientation.first[2],
+                                 orientation.second[0], orientation.second[1], orientation.second[2] };
+        mContext.queueCommand(Command(Command::SourcePosition, this, position.getPtr(), 3));
+        mContext.queueCommand(Command(Command::SourceVelocity, this, velocity.getPtr(), 3));
+        mContext.queueCommand(Command(Command::SourceOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Position | BulkSourceProps::Velocity | BulkSourceProps::Orientation);
     if(mId != 0)
     {
         Batcher batcher = mContext.getBatcher();
@@ -1058,73 +1596,125 @@ void SourceImpl::set3DParameters(const Vector3 &position, const Vector3 &velocit
     mVelocity = velocity;
     mDirection = mOrientation[0] = orientation.first;
     mOrientation[1] = orientation.second;
+    audibilityUpdate();
+    resetStopTime();
 }
 
 
 DECL_THUNK1(void, Source, setPosition,, const Vector3&)
 void SourceImpl::setPosition(const Vector3 &position)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourcePosition, this, position.getPtr(), 3));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Position);
     if(mId != 0)
         alSourcefv(mId, AL_POSITION, position.getPtr());
     mPosition = position;
+    audibilityUpdate();
 }
 
 DECL_THUNK1(void, Source, setPosition,, const ALfloat*)
 void SourceImpl::setPosition(const ALfloat *pos)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourcePosition, this, pos, 3));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Position);
     if(mId != 0)
         alSourcefv(mId, AL_POSITION, pos);
     mPosition[0] = pos[0];
     mPosition[1] = pos[1];
     mPosition[2] = pos[2];
+    audibilityUpdate();
 }
 
 DECL_THUNK1(void, Source, setVelocity,, const Vector3&)
 void SourceImpl::setVelocity(const Vector3 &velocity)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceVelocity, this, velocity.getPtr(), 3));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Velocity);
     if(mId != 0)
         alSourcefv(mId, AL_VELOCITY, velocity.getPtr());
     mVelocity = velocity;
+    resetStopTime();
 }
 
 DECL_THUNK1(void, Source, setVelocity,, const ALfloat*)
 void SourceImpl::setVelocity(const ALfloat *vel)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceVelocity, this, vel, 3));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Velocity);
     if(mId != 0)
         alSourcefv(mId, AL_VELOCITY, vel);
     mVelocity[0] = vel[0];
     mVelocity[1] = vel[1];
     mVelocity[2] = vel[2];
+    resetStopTime();
 }
 
 DECL_THUNK1(void, Source, setDirection,, const Vector3&)
 void SourceImpl::setDirection(const Vector3 &direction)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceDirection, this, direction.getPtr(), 3));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Orientation);
     if(mId != 0)
         alSourcefv(mId, AL_DIRECTION, direction.getPtr());
     mDirection = direction;
+    audibilityUpdate();
 }
 
 DECL_THUNK1(void, Source, setDirection,, const ALfloat*)
 void SourceImpl::setDirection(const ALfloat *dir)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceDirection, this, dir, 3));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Orientation);
     if(mId != 0)
         alSourcefv(mId, AL_DIRECTION, dir);
     mDirection[0] = dir[0];
     mDirection[1] = dir[1];
     mDirection[2] = dir[2];
+    audibilityUpdate();
 }
 
 DECL_THUNK1(void, Source, setOrientation,, const Vector3Pair&)
 void SourceImpl::setOrientation(const std::pair<Vector3,Vector3> &orientation)
 {
+    if(mContext.deferCall())
+    {
+        const ALfloat ori[6] = { orientation.first[0], orientation.first[1], orientation.first[2],
+                                 orientation.second[0], orientation.second[1], orientation.second[2] };
+        mContext.queueCommand(Command(Command::SourceOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Orientation);
     if(mId != 0)
     {
         if(mContext.hasExtension(AL::EXT_BFORMAT))
@@ -1133,12 +1723,20 @@ void SourceImpl::setOrientation(const std::pair<Vector3,Vector3> &orientation)
     }
     mDirection = mOrientation[0] = orientation.first;
     mOrientation[1] = orientation.second;
+    audibilityUpdate();
 }
 
 DECL_THUNK2(void, Source, setOrientation,, const ALfloat*, const ALfloat*)
 void SourceImpl::setOrientation(const ALfloat *at, const ALfloat *up)
 {
+    if(mContext.deferCall())
+    {
+        const ALfloat ori[6] = { at[0], at[1], at[2], up[0], up[1], up[2] };
+        mContext.queueCommand(Command(Command::SourceOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Orientation);
     if(mId != 0)
     {
         ALfloat ori[6] = { at[0], at[1], at[2], up[0], up[1], up[2] };
@@ -1152,12 +1750,19 @@ void SourceImpl::setOrientation(const ALfloat *at, const ALfloat *up)
     mOrientation[1][0] = up[0];
     mOrientation[1][1] = up[1];
     mOrientation[1][2] = up[2];
+    audibilityUpdate();
 }
 
 DECL_THUNK1(void, Source, setOrientation,, const ALfloat*)
 void SourceImpl::setOrientation(const ALfloat *ori)
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::SourceOrientation, this, ori, 6));
+        return;
+    }
     CheckContext(mContext);
+    cancelBulk(BulkSourceProps::Orientation);
     if(mId != 0)
     {
         if(mContext.hasExtension(AL::EXT_BFORMAT))
@@ -1170,6 +1775,7 @@ void SourceImpl::setOrientation(const ALfloat *ori)
     mOrientation[1][0] = ori[3];
     mOrientation[1][1] = ori[4];
     mOrientation[1][2] = ori[5];
+    audibilityUpdate();
 }
 
 
@@ -1186,6 +1792,7 @@ void SourceImpl::setConeAngles(ALfloat inner, ALfloat outer)
     }
     mConeInnerAngle = inner;
     mConeOuterAngle = outer;
+    audibilityUpdate();
 }
 
 DECL_THUNK2(void, Source, setOuterConeGains,, ALfloat, ALfloat)
@@ -1202,6 +1809,7 @@ void SourceImpl::setOuterConeGains(ALfloat gain, ALfloat gainhf)
     }
     mConeOuterGain = gain;
     mConeOuterGainHF = gainhf;
+    audibilityUpdate();
 }
 
 
@@ -1219,6 +1827,7 @@ void SourceImpl::setRolloffFactors(ALfloat factor, ALfloat roomfactor)
     }
     mRolloffFactor = factor;
     mRoomRolloffFactor = roomfactor;
+    audibilityUpdate();
 }
 
 DECL_THUNK1(void, Source, setDopplerFactor,, ALfloat)
@@ -1230,6 +1839,7 @@ void SourceImpl::setDopplerFactor(ALfloat factor)
     if(mId != 0)
         alSourcef(mId, AL_DOPPLER_FACTOR, factor);
     mDopplerFactor = factor;
+    resetStopTime();
 }
 
 DECL_THUNK1(void, Source, setRelative,, bool)
@@ -1239,6 +1849,7 @@ void SourceImpl::setRelative(bool relative)
     if(mId != 0)
         alSourcei(mId, AL_SOURCE_RELATIVE, relative ? AL_TRUE : AL_FALSE);
     mRelative = relative;
+    audibilityUpdate();
 }
 
 DECL_THUNK1(void, Source, setRadius,, ALfloat)
@@ -1279,6 +1890,7 @@ void SourceImpl::setResamplerIndex(ALsizei index)
 {
     if(index < 0)
         throw std::out_of_range("Resampler index out of range");
+    mContext.checkCallThread();
     if(mId != 0 && mContext.hasExtension(AL::SOFT_source_resampler))
         alSourcei(mId, AL_SOURCE_RESAMPLER_SOFT,
             std::min(index, static_cast<ALsizei>(mContext.getAvailableResamplers().size()))
@@ -1492,6 +2104,9 @@ void Source::destroy()
 }
 void SourceImpl::destroy()
 {
+    mContext.checkCallThread();
+    // Make calls queued for it while it's still this source.
+    mContext.applyCommands();
     stop();
 
     resetProperties();
@@ -1499,8 +2114,84 @@ void SourceImpl::destroy()
 }
 
 
+
+size_t BulkSourceProps::getSlot(SourceImpl *source)
+{
+    if(source->mBulkIndex != SourceImpl::NoBulkIndex)
+        return source->mBulkIndex;
+
+    const size_t idx = mSources.size();
+    mSources.push_back(source);
+    mPositions.emplace_back();
+    mVelocities.emplace_back();
+    mOrientations.emplace_back();
+    mPending.push_back(0);
+    source->mBulkIndex = idx;
+    return idx;
+}
+
+void BulkSourceProps::cancel(SourceImpl *source, unsigned props)
+{
+    const size_t idx = source->mBulkIndex;
+    if(!mPending[idx]) return;
+    mPending[idx] &= ~props;
+    if(!mPending[idx]) --mPendingCount;
+}
+
+void BulkSourceProps::remove(SourceImpl *source)
+{
+    const size_t idx = source->mBulkIndex;
+    if(idx == SourceImpl::NoBulkIndex)
+        return;
+    source->mBulkIndex = SourceImpl::NoBulkIndex;
+    if(mPending[idx]) --mPendingCount;
+
+    const size_t last = mSources.size()-1;
+    if(idx < last)
+    {
+        mSources[idx] = mSources[last];
+        mSources[idx]->mBulkIndex = idx;
+        mPositions[idx] = mPositions[last];
+        mVelocities[idx] = mVelocities[last];
+        mOrientations[idx] = mOrientations[last];
+        mPending[idx] = mPending[last];
+    }
+    mSources.pop_back();
+    mPositions.pop_back();
+    mVelocities.pop_back();
+    mOrientations.pop_back();
+    mPending.pop_back();
+}
+
+void BulkSourceProps::clear()
+{
+    for(SourceImpl *source : mSources)
+        source->mBulkIndex = SourceImpl::NoBulkIndex;
+    mSources.clear();
+    mPositions.clear();
+    mVelocities.clear();
+    mOrientations.clear();
+    mPending.clear();
+    mPendingCount = 0;
+}
+
+void BulkSourceProps::apply()
+{
+    const size_t count = mSources.size();
+    for(size_t i = 0;i < count && mPendingCount > 0;++i)
+    {
+        if(!mPending[i]) continue;
+        mSources[i]->applyBulkProps(mPending[i], mPositions[i], mVelocities[i], mOrientations[i]);
+        mPending[i] = 0;
+        --mPendingCount;
+    }
+}
+
 DECL_THUNK0(SourceGroup, Source, getGroup, const)
+DECL_THUNK0(bool, Source, isVirtual, const)
 DECL_THUNK0(ALuint, Source, getPriority, const)
+DECL_THUNK0(ALuint, Source, getUnderrunCount, const)
+DECL_THUNK0(Seconds, Source, getStreamReadAhead, const)
 DECL_THUNK0(bool, Source, getLooping, const)
 DECL_THUNK0(ALfloat, Source, getPitch, const)
 DECL_THUNK0(ALfloat, Source, getGain, const)
@@ -3,6 +3,9 @@
 
 #include "main.h"
 
+#include "audibility.h"
+
+#include <limits>
 #include <atomic>
 #include <mutex>
 
@@ -10,6 +13,69 @@ namespace alure {
 
 class ALBufferStream;
 
+// Decodes chunks of samples for a stream. Chunks may be decoded ahead of time
+// by the context's read-ahead thread (which calls fill), leaving the stream
+// to only upload them. Otherwise, or if the read-ahead falls behind, read
+// decodes the next chunk itself.
+class StreamReader {
+public:
+    // The stream's position and loop state after a given chunk.
+    struct State {
+        uint64_t mSamplePos{0};
+        std::pair<uint64_t,uint64_t> mLoopPts{0,0};
+        bool mHasLooped{false};
+        bool mDone{false};
+    };
+
+private:
+    ContextImpl &mContext;
+    SharedPtr<Decoder> mDecoder;
+    ALsizei mUpdateLen;
+    ALuint mFrameSize;
+
+    // Guards the decoder, and its state and looping mode.
+    std::mutex mMutex;
+    State mState;
+    bool mLooping{false};
+
+    // Decoded chunks, with sample data from the context's staging pool.
+    struct Chunk {
+        Vector<ALbyte> mData;
+        ALsizei mFrames{0};
+        State mState;
+    };
+    Vector<Chunk> mChunks;
+    std::atomic<size_t> mReadIdx{0};
+    std::atomic<size_t> mWriteIdx{0};
+    std::atomic<bool> mDetached{false};
+
+    // State of the last chunk given to the stream.
+    State mConsumed;
+    bool mConsumedLoop{false};
+    bool mFromChunk{false};
+
+    ALsizei decode(ALbyte *data, bool loop);
+
+public:
+    StreamReader(ContextImpl &context, SharedPtr<Decoder> decoder, ALsizei updatelen,
+                 ALuint framesize, size_t chunks, std::pair<uint64_t,uint64_t> loop_pts);
+    ~StreamReader();
+
+    bool seek(uint64_t pos);
+
+    // Returns the next chunk, decoded into data if one wasn't decoded ahead,
+    // along with the state after it. Call release when done with the samples.
+    ArrayView<ALbyte> read(Vector<ALbyte> &data, bool loop, State &state);
+    void release();
+
+    // Decodes one chunk ahead, returning false if there was no room or
+    // nothing left to decode.
+    bool fill();
+
+    void detach() { mDetached.store(true, std::memory_order_release); }
+    bool isDetached() const { return mDetached.load(std::memory_order_acquire); }
+};
+
 struct SendProps {
     ALuint mSendIdx;
     AuxiliaryEffectSlotImpl *mSlot{nullptr};
@@ -27,20 +93,14 @@ struct SendProps {
 struct SourceBufferUpdateEntry {
     SourceImpl *mSource;
     ALuint mId;
+    // The earliest device clock time the source could stop on its own, or 0
+    // if not known. Its state doesn't need checking before then.
+    std::chrono::nanoseconds mStopTime;
 };
 struct SourceStreamUpdateEntry {
     SourceImpl *mSource;
 };
 
-struct SourceFadeUpdateEntry {
-    SourceImpl *mSource;
-
-    std::chrono::nanoseconds mFadeTimeStart;
-    std::chrono::nanoseconds mFadeTimeTarget;
-    bool mIsFadeOut;
-    ALfloat mFadeGainMult;
-};
-
 
 class SourceImpl {
     ContextImpl &mContext;
@@ -57,6 +117,7 @@ class SourceImpl {
 
     mutable std::mutex mMutex;
     std::atomic<bool> mIsAsync;
+    std::atomic<ALuint> mUnderruns{0};
 
     std::atomic<bool> mPaused;
     uint64_t mOffset;
@@ -87,38 +148,96 @@ class SourceImpl {
     Vector<SendProps> mEffectSlots;
 
     ALuint mPriority;
+    Seconds mReadAhead{0.0};
+
+    // Set while playing a buffer without an OpenAL source, with the offset
+    // it was at as of the given device clock time.
+    bool mVirtual{false};
+    uint64_t mVirtualOffset{0};
+    std::chrono::nanoseconds mVirtualTime{0};
 
     void resetProperties();
     void applyProperties(bool looping, ALuint offset) const;
+    void releaseId();
+    void startVirtual(uint64_t offset);
+    void rebaseVirtual();
+    void audibilityUpdate();
+    void cancelBulk(unsigned props);
+    void resetStopTime();
 
     ALint refillBufferStream();
 
     void setFilterParams(ALuint &filterid, const FilterParams &params);
 
 public:
+    static constexpr size_t NoPriorityIndex = std::numeric_limits<size_t>::max();
+
+    // The source's place in the context's priority heap of playing or
+    // virtual sources, or NoPriorityIndex. Managed by the context.
+    size_t mPriorityIndex{NoPriorityIndex};
+
+    static constexpr size_t NoAudibilityIndex = std::numeric_limits<size_t>::max();
+
+    // The source's place in the context's audibility table, and whether it
+    // was made virtual for being inaudible. Managed by the context.
+    size_t mAudibilityIndex{NoAudibilityIndex};
+    bool mCulled{false};
+
+    static constexpr size_t NoBulkIndex = std::numeric_limits<size_t>::max();
+
+    // The source's slot in the context's bulk properties. Managed by the
+    // context.
+    size_t mBulkIndex{NoBulkIndex};
+
+    static constexpr size_t NoFadeIndex = std::numeric_limits<size_t>::max();
+
+    // The source's place in the context's fade table. Managed by the
+    // context.
+    size_t mFadeIndex{NoFadeIndex};
+
     SourceImpl(ContextImpl &context);
     ~SourceImpl();
 
     ALuint getId() const { return mId; }
+    ContextImpl &getContext() const { return mContext; }
 
     bool checkPending(SharedFuture<Buffer> &future);
-    bool fadeUpdate(std::chrono::nanoseconds cur_fade_time, SourceFadeUpdateEntry &fade);
-    bool playUpdate(ALuint id);
+    ALfloat getFadeGain() const { return mFadeGain; }
+    void setFadeGain(ALfloat gain);
+    std::chrono::nanoseconds getStopTime(std::chrono::nanoseconds cur_time, bool doppler,
+                                         bool listener_moving, ALuint &queries) const;
     bool playUpdate();
-    bool updateAsync();
+    bool updateAsync(std::chrono::nanoseconds &refill_delay);
+
+    // Virtual sources keep track of where playback would be, and are given
+    // an OpenAL source again at that offset. Only sources playing a buffer
+    // can be made virtual.
+    bool isVirtual() const { return mVirtual; }
+    bool canVirtualize() const { return mBuffer != nullptr && !mVirtual; }
+    uint64_t getVirtualOffset(std::chrono::nanoseconds cur_time) const;
+    void makeVirtual(std::chrono::nanoseconds cur_time);
+    bool virtualUpdate(std::chrono::nanoseconds cur_time);
+    void bindVirtual(ALuint id, std::chrono::nanoseconds cur_time);
+    void setVirtualPaused(bool paused);
+
+    AudibilityParams getAudibilityParams() const;
+
+    void applyBulkProps(unsigned props, const Vector3 &position, const Vector3 &velocity,
+                        const std::pair<Vector3,Vector3> &orientation);
 
     void unsetGroup();
     void groupPropUpdate(ALfloat gain, ALfloat pitch);
 
     void checkPaused();
-    void unsetPaused() { mPaused = false; }
+    void unsetPaused();
 
     void play(Buffer buffer);
     void play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei queue_size);
     void play(SharedFuture<Buffer>&& future_buffer);
     void stop();
     void makeStopped(bool dolock=true);
-    void fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration);
+    void fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration, FadeCurve curve);
+    void fadeIn(ALfloat gain, std::chrono::milliseconds duration, FadeCurve curve);
     void pause();
     void resume();
 
@@ -133,6 +252,11 @@ public:
     void setPriority(ALuint priority);
     ALuint getPriority() const { return mPriority; }
 
+    ALuint getUnderrunCount() const { return mUnderruns.load(std::memory_order_relaxed); }
+
+    void setStreamReadAhead(Seconds readahead);
+    Seconds getStreamReadAhead() const { return mReadAhead; }
+
     void setOffset(uint64_t offset);
     std::pair<uint64_t,std::chrono::nanoseconds> getSampleOffsetLatency() const;
     std::pair<Seconds,Seconds> getSecOffsetLatency() const;
@@ -221,6 +345,150 @@ public:
     void destroy();
 };
 
+
+// A binary heap of sources on their priority, lowest first, or highest first
+// if Highest is true. Sources record their place in mPriorityIndex so they can
+// be removed or moved when their priority changes, and so may only be in one
+// heap at a time.
+template<bool Highest>
+class SourcePriorityHeap {
+    Vector<SourceImpl*> mHeap;
+
+    static bool before(ALuint lhs, ALuint rhs) { return Highest ? (lhs > rhs) : (lhs < rhs); }
+
+    void set(size_t idx, SourceImpl *source)
+    {
+        mHeap[idx] = source;
+        source->mPriorityIndex = idx;
+    }
+
+    void fix(size_t idx)
+    {
+        SourceImpl *source = mHeap[idx];
+        const ALuint prio = source->getPriority();
+
+        // Move it up past parents it goes before, or else down past children
+        // that go before it.
+        while(idx > 0)
+        {
+            size_t parent = (idx-1) / 2;
+            if(!before(prio, mHeap[parent]->getPriority()))
+                break;
+            set(idx, mHeap[parent]);
+            idx = parent;
+        }
+        const size_t count = mHeap.size();
+        while(idx*2 + 1 < count)
+        {
+            size_t child = idx*2 + 1;
+            if(child+1 < count && before(mHeap[child+1]->getPriority(), mHeap[child]->getPriority()))
+                ++child;
+            if(!before(mHeap[child]->getPriority(), prio))
+                break;
+            set(idx, mHeap[child]);
+            idx = child;
+        }
+        set(idx, source);
+    }
+
+public:
+    bool empty() const { return mHeap.empty(); }
+    SourceImpl *top() const { return mHeap.front(); }
+
+    void push(SourceImpl *source)
+    {
+        mHeap.push_back(source);
+        fix(mHeap.size()-1);
+    }
+
+    // Removes the source, if it's in the heap.
+    void erase(SourceImpl *source)
+    {
+        size_t idx = source->mPriorityIndex;
+        if(idx == SourceImpl::NoPriorityIndex || idx >= mHeap.size() || mHeap[idx] != source)
+            return;
+        source->mPriorityIndex = SourceImpl::NoPriorityIndex;
+
+        SourceImpl *last = mHeap.back();
+        mHeap.pop_back();
+        if(idx < mHeap.size())
+        {
+            set(idx, last);
+            fix(idx);
+        }
+    }
+
+    // Moves the source after its priority changed.
+    void update(SourceImpl *source) { fix(source->mPriorityIndex); }
+
+    void clear()
+    {
+        for(SourceImpl *source : mHeap)
+            source->mPriorityIndex = SourceImpl::NoPriorityIndex;
+        mHeap.clear();
+    }
+};
+
+
+// 3D properties set for many sources at once through the context, kept in
+// arrays until update applies them together. Each source keeps its slot
+// between updates, so sources moved every update don't need a new one, with
+// flags for the properties waiting to be applied.
+class BulkSourceProps {
+public:
+    enum Property : unsigned {
+        Position    = 1<<0,
+        Velocity    = 1<<1,
+        Orientation = 1<<2,
+    };
+
+private:
+    Vector<SourceImpl*> mSources;
+    Vector<Vector3> mPositions;
+    Vector<Vector3> mVelocities;
+    Vector<std::pair<Vector3,Vector3>> mOrientations;
+    Vector<unsigned> mPending;
+    size_t mPendingCount{0};
+
+    size_t getSlot(SourceImpl *source);
+    void markPending(size_t idx, unsigned prop)
+    {
+        if(!mPending[idx]) ++mPendingCount;
+        mPending[idx] |= prop;
+    }
+
+public:
+    bool hasPending() const { return mPendingCount > 0; }
+
+    void setPosition(SourceImpl *source, const Vector3 &position)
+    {
+        size_t idx = getSlot(source);
+        mPositions[idx] = position;
+        markPending(idx, Position);
+    }
+    void setVelocity(SourceImpl *source, const Vector3 &velocity)
+    {
+        size_t idx = getSlot(source);
+        mVelocities[idx] = velocity;
+        markPending(idx, Velocity);
+    }
+    void setOrientation(SourceImpl *source, const std::pair<Vector3,Vector3> &orientation)
+    {
+        size_t idx = getSlot(source);
+        mOrientations[idx] = orientation;
+        markPending(idx, Orientation);
+    }
+
+    // Drops pending properties, after they were set on the source directly.
+    void cancel(SourceImpl *source, unsigned props);
+    // Removes the source's slot. The last slot takes its place.
+    void remove(SourceImpl *source);
+    void clear();
+
+    // Applies the pending properties to their sources.
+    void apply();
+};
+
 } // namespace alure
 
 #endif /* SOURCE_H */
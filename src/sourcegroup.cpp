@@ -126,6 +126,11 @@ void SourceGroupImpl::setGain(ALfloat gain)
 {
     if(!(gain >= 0.0f))
         throw std::out_of_range("Gain out of range");
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::GroupGain, this, &gain, 1));
+        return;
+    }
     CheckContext(mContext);
     mGain = gain;
     gain *= mParentProps.mGain;
@@ -142,6 +147,11 @@ void SourceGroupImpl::setPitch(ALfloat pitch)
 {
     if(!(pitch > 0.0f))
         throw std::out_of_range("Pitch out of range");
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::GroupPitch, this, &pitch, 1));
+        return;
+    }
     CheckContext(mContext);
     mPitch = pitch;
     ALfloat gain = mGain * mParentProps.mGain;
@@ -165,6 +175,21 @@ void SourceGroupImpl::collectPlayingSourceIds(Vector<ALuint> &sourceids) const
         group->collectPlayingSourceIds(sourceids);
 }
 
+bool SourceGroupImpl::hasVirtualSources() const
+{
+    for(SourceImpl *alsrc : mSources)
+    {
+        if(alsrc->isVirtual())
+            return true;
+    }
+    for(SourceGroupImpl *group : mSubGroups)
+    {
+        if(group->hasVirtualSources())
+            return true;
+    }
+    return false;
+}
+
 void SourceGroupImpl::updatePausedStatus() const
 {
     for(SourceImpl *alsrc : mSources)
@@ -176,15 +201,21 @@ void SourceGroupImpl::updatePausedStatus() const
 DECL_THUNK0(void, SourceGroup, pauseAll, const)
 void SourceGroupImpl::pauseAll() const
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::GroupPauseAll, const_cast<SourceGroupImpl*>(this)));
+        return;
+    }
     CheckContext(mContext);
     auto lock = mContext.getSourceStreamLock();
 
     Vector<ALuint> sourceids;
     sourceids.reserve(16);
     collectPlayingSourceIds(sourceids);
-    if(!sourceids.empty())
+    if(!sourceids.empty() || hasVirtualSources())
     {
-        alSourcePausev(static_cast<ALsizei>(sourceids.size()), sourceids.data());
+        if(!sourceids.empty())
+            alSourcePausev(static_cast<ALsizei>(sourceids.size()), sourceids.data());
         updatePausedStatus();
     }
     lock.unlock();
@@ -195,7 +226,7 @@ void SourceGroupImpl::collectPausedSourceIds(Vector<ALuint> &sourceids) const
 {
     for(SourceImpl *alsrc : mSources)
     {
-        if(alsrc->isPaused())
+        if(alsrc->isPaused() && alsrc->getId())
             sourceids.push_back(alsrc->getId());
     }
     for(SourceGroupImpl *group : mSubGroups)
@@ -213,15 +244,21 @@ void SourceGroupImpl::updatePlayingStatus() const
 DECL_THUNK0(void, SourceGroup, resumeAll, const)
 void SourceGroupImpl::resumeAll() const
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::GroupResumeAll, const_cast<SourceGroupImpl*>(this)));
+        return;
+    }
     CheckContext(mContext);
     auto lock = mContext.getSourceStreamLock();
 
     Vector<ALuint> sourceids;
     sourceids.reserve(16);
     collectPausedSourceIds(sourceids);
-    if(!sourceids.empty())
+    if(!sourceids.empty() || hasVirtualSources())
     {
-        alSourcePlayv(static_cast<ALsizei>(sourceids.size()), sourceids.data());
+        if(!sourceids.empty())
+            alSourcePlayv(static_cast<ALsizei>(sourceids.size()), sourceids.data());
         updatePlayingStatus();
     }
     lock.unlock();
@@ -256,15 +293,21 @@ void SourceGroupImpl::updateStoppedStatus() const
 DECL_THUNK0(void, SourceGroup, stopAll, const)
 void SourceGroupImpl::stopAll() const
 {
+    if(mContext.deferCall())
+    {
+        mContext.queueCommand(Command(Command::GroupStopAll, const_cast<SourceGroupImpl*>(this)));
+        return;
+    }
     CheckContext(mContext);
 
     Vector<ALuint> sourceids;
     sourceids.reserve(16);
     collectSourceIds(sourceids);
-    if(!sourceids.empty())
+    if(!sourceids.empty() || hasVirtualSources())
     {
         auto lock = mContext.getSourceStreamLock();
-        alSourceRewindv(static_cast<ALsizei>(sourceids.size()), sourceids.data());
+        if(!sourceids.empty())
+            alSourceRewindv(static_cast<ALsizei>(sourceids.size()), sourceids.data());
         updateStoppedStatus();
     }
 }
@@ -279,6 +322,7 @@ void SourceGroup::destroy()
 void SourceGroupImpl::destroy()
 {
     CheckContext(mContext);
+    mContext.applyCommands();
     Batcher batcher = mContext.getBatcher();
     for(SourceImpl *source : mSources)
         source->unsetGroup();
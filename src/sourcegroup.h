@@ -32,6 +32,7 @@ class SourceGroupImpl : SourceGroupProps {
 
     bool findInSubGroups(SourceGroupImpl *group) const;
 
+    bool hasVirtualSources() const;
     void collectPlayingSourceIds(Vector<ALuint> &sourceids) const;
     void updatePausedStatus() const;
 
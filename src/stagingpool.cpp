@@ -0,0 +1,127 @@
+#include "config.h"
+
+#include "stagingpool.h"
+
+namespace alure
+{
+
+namespace
+{
+
+constexpr size_t MinClassShift = 12;
+
+size_t ClassSize(size_t idx)
+{ return (4 + idx%4) << (idx/4 + MinClassShift-2); }
+
+// The smallest class that can hold size bytes.
+size_t ClassIndex(size_t size)
+{
+    if(size <= (size_t{1}<<MinClassShift))
+        return 0;
+
+    // Find the top bit of size-1, then use the two bits below it to pick one
+    // of the four classes above that power of two.
+    size_t val = size-1;
+    size_t shift = 0;
+    while((val>>shift) > 7)
+        ++shift;
+    return (shift-(MinClassShift-2))*4 + ((val>>shift) - 4) + 1;
+}
+
+} // namespace
+
+constexpr size_t StagingPool::NumClasses;
+constexpr size_t StagingPool::DefaultLimit;
+
+
+Vector<ALbyte> StagingPool::acquire(size_t size)
+{
+    Vector<ALbyte> block;
+    if(size == 0)
+        return block;
+
+    const size_t idx = ClassIndex(size);
+    if(idx < NumClasses)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        Vector<Vector<ALbyte>> &blocks = mFree[idx];
+        if(!blocks.empty())
+        {
+            block = std::move(blocks.back());
+            blocks.pop_back();
+            mInUse += block.capacity();
+            ++mAllocationsAvoided;
+            lock.unlock();
+
+            block.resize(size);
+            return block;
+        }
+    }
+
+    block.reserve((idx < NumClasses) ? ClassSize(idx) : size);
+    block.resize(size);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mReserved += block.capacity();
+    mInUse += block.capacity();
+    ++mAllocations;
+    trim();
+    return block;
+}
+
+void StagingPool::release(Vector<ALbyte>&& block)
+{
+    const size_t capacity = block.capacity();
+    if(capacity == 0)
+        return;
+
+    // Only blocks that are exactly a class size came from the pool to be
+    // reused.
+    const size_t idx = ClassIndex(capacity);
+    Vector<ALbyte> unused;
+    std::lock_guard<std::mutex> lock(mMutex);
+    mInUse -= capacity;
+    if(idx < NumClasses && ClassSize(idx) == capacity && mReserved <= mLimit)
+        mFree[idx].push_back(std::move(block));
+    else
+    {
+        mReserved -= capacity;
+        unused = std::move(block);
+    }
+}
+
+void StagingPool::trim()
+{
+    // Drop free blocks, biggest first, until the pool is back within its
+    // limit or there are none left.
+    for(size_t idx = NumClasses;idx > 0 && mReserved > mLimit;)
+    {
+        Vector<Vector<ALbyte>> &blocks = mFree[--idx];
+        while(!blocks.empty() && mReserved > mLimit)
+        {
+            mReserved -= blocks.back().capacity();
+            blocks.pop_back();
+        }
+    }
+}
+
+void StagingPool::setLimit(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLimit = limit;
+    trim();
+}
+
+size_t StagingPool::getLimit() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mLimit;
+}
+
+StagingPoolStats StagingPool::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return StagingPoolStats{mReserved, mInUse, mAllocations, mAllocationsAvoided};
+}
+
+} // namespace alure
@@ -0,0 +1,63 @@
+#ifndef STAGINGPOOL_H
+#define STAGINGPOOL_H
+
+#include <mutex>
+#include <array>
+
+#include "main.h"
+
+namespace alure {
+
+// A pool of memory blocks for staging decoded sample data, shared by buffer
+// loads and streams so they reuse blocks instead of allocating new ones.
+//
+// Blocks are handed out in size classes, four per doubling starting at 4KiB,
+// so a block is at most 25% bigger than what was asked for. Requests above
+// the largest class (64MiB) get a block of their own, which isn't reused.
+// Returned blocks are kept for reuse while the memory held by the pool, in
+// use or not, stays within the limit. May be used from any thread.
+class StagingPool {
+public:
+    static constexpr size_t NumClasses = 57;
+    static constexpr size_t DefaultLimit = 64*1024*1024;
+
+private:
+    std::array<Vector<Vector<ALbyte>>,NumClasses> mFree;
+    size_t mLimit{DefaultLimit};
+    size_t mReserved{0};
+    size_t mInUse{0};
+    uint64_t mAllocations{0};
+    uint64_t mAllocationsAvoided{0};
+    mutable std::mutex mMutex;
+
+    void trim();
+
+public:
+    // Gets a block holding size bytes. The samples it holds are unspecified.
+    Vector<ALbyte> acquire(size_t size);
+    // Returns a block gotten from acquire. It may be resized in between, but
+    // must not grow past its capacity.
+    void release(Vector<ALbyte>&& block);
+
+    void setLimit(size_t limit);
+    size_t getLimit() const;
+
+    StagingPoolStats getStats() const;
+};
+
+// Returns a block to its pool when going out of scope.
+class StagingGuard {
+    StagingPool &mPool;
+    Vector<ALbyte> &mBlock;
+
+public:
+    StagingGuard(StagingPool &pool, Vector<ALbyte> &block) : mPool(pool), mBlock(block) { }
+    StagingGuard(const StagingGuard&) = delete;
+    ~StagingGuard() { mPool.release(std::move(mBlock)); }
+
+    StagingGuard& operator=(const StagingGuard&) = delete;
+};
+
+} // namespace alure
+
+#endif /* STAGINGPOOL_H */